@@ -0,0 +1,110 @@
+#ifndef ACCUMULATOR_H
+#define ACCUMULATOR_H
+
+#include <stdint.h>
+
+// sparse accumulator for one result row: dense values, a generation marker per column and the list of touched columns
+typedef struct
+{
+    uint64_t num_cols;
+    float *values;
+    uint32_t *marker;
+    uint32_t generation;
+    uint64_t *touched;
+    uint64_t num_touched;
+} Accumulator;
+
+// open-addressing hash table for one result row, the used part is sized from the row's flop count
+typedef struct
+{
+    uint64_t *keys;
+    float *values;
+    uint64_t allocated;
+    uint64_t capacity;
+    uint32_t shift;
+    uint64_t num_entries;
+    uint64_t *columns;
+    uint64_t allocated_columns;
+} HashAccumulator;
+
+#define HASH_EMPTY UINT64_MAX
+
+int accumulator_init(Accumulator *acc, uint64_t num_cols);
+void accumulator_free(Accumulator *acc);
+void accumulator_next_row(Accumulator *acc);
+uint64_t accumulator_flush(Accumulator *acc, float *values, uint64_t *indices);
+void sort_columns(uint64_t *columns, uint64_t count);
+
+int hash_accumulator_init(HashAccumulator *hash);
+void hash_accumulator_free(HashAccumulator *hash);
+int hash_accumulator_start_row(HashAccumulator *hash, uint64_t max_entries);
+uint64_t hash_accumulator_flush(HashAccumulator *hash, float *values, uint64_t *indices);
+void hash_accumulator_clear(HashAccumulator *hash);
+
+// adds value to column col of the current row (the first touch overwrites the stale value of an earlier row)
+static inline void accumulator_add(Accumulator *acc, uint64_t col, float value)
+{
+    if (acc->marker[col] != acc->generation)
+    {
+        acc->marker[col] = acc->generation;
+        acc->touched[acc->num_touched++] = col;
+        acc->values[col] = value;
+    }
+    else
+    {
+        acc->values[col] += value;
+    }
+}
+
+// only records that column col of the current row is non-zero (symbolic phase)
+static inline void accumulator_touch(Accumulator *acc, uint64_t col)
+{
+    if (acc->marker[col] != acc->generation)
+    {
+        acc->marker[col] = acc->generation;
+        acc->num_touched++;
+    }
+}
+
+// slot of column col: the slot that holds it or the empty slot where it has to be inserted (Fibonacci hashing, linear probing)
+static inline uint64_t hash_accumulator_slot(const HashAccumulator *hash, uint64_t col)
+{
+    uint64_t mask = hash->capacity - 1;
+    uint64_t slot = (col * 0x9E3779B97F4A7C15ULL) >> hash->shift;
+
+    while (hash->keys[slot] != col && hash->keys[slot] != HASH_EMPTY)
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static inline void hash_accumulator_add(HashAccumulator *hash, uint64_t col, float value)
+{
+    uint64_t slot = hash_accumulator_slot(hash, col);
+
+    if (hash->keys[slot] == HASH_EMPTY)
+    {
+        hash->keys[slot] = col;
+        hash->values[slot] = value;
+        hash->num_entries++;
+    }
+    else
+    {
+        hash->values[slot] += value;
+    }
+}
+
+static inline void hash_accumulator_touch(HashAccumulator *hash, uint64_t col)
+{
+    uint64_t slot = hash_accumulator_slot(hash, col);
+
+    if (hash->keys[slot] == HASH_EMPTY)
+    {
+        hash->keys[slot] = col;
+        hash->num_entries++;
+    }
+}
+
+#endif // ACCUMULATOR_H
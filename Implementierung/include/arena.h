@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+Arena for the rows of a result: every thread carves its rows out of large chunks with its own cursor (no lock per row),
+and the whole arena is released at once. The chunks, like the scratch buffers of the kernels and the writer, come from
+a pool that keeps released blocks, so the iterations of -B reuse memory whose pages are mapped already.
+*/
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next;
+} ArenaChunk;
+
+typedef struct
+{
+    ArenaChunk *chunks;
+    pthread_mutex_t lock;
+} Arena;
+
+// bump pointer of one thread into the current chunk
+typedef struct
+{
+    Arena *arena;
+    char *pos;
+    char *end;
+} ArenaCursor;
+
+#define ARENA_CHUNK_SIZE ((size_t)4 << 20)
+
+Arena *arena_create(void);
+void arena_destroy(Arena *arena);
+ArenaCursor arena_cursor(Arena *arena);
+void *arena_alloc(ArenaCursor *cursor, size_t size);
+
+void *pool_alloc(size_t size);
+void pool_free(void *block);
+void pool_trim(void);
+
+#endif // ARENA_H
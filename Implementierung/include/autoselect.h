@@ -0,0 +1,40 @@
+#ifndef AUTOSELECT_H
+#define AUTOSELECT_H
+
+#include "ellpack.h"
+#include <stdio.h>
+
+// -V auto: the version is picked after reading the inputs
+#define VERSION_AUTO -1
+
+// cheap statistics of an input matrix, the row lengths count the non-zero values of a row
+typedef struct
+{
+    uint64_t non_zero;
+    uint64_t median_length;
+    uint64_t p90_length;
+    uint64_t max_length;
+    double fill;    // non-zero values per ELLPACK slot (1 without padding)
+    double density; // non-zero values per element of the matrix
+} MatrixStats;
+
+typedef struct
+{
+    int version;
+    AccumulatorType accumulator;
+    MatrixStats stats_a;
+    MatrixStats stats_b;
+    double flops;            // multiply-adds of the product
+    double padded_work;      // slots visited by the ELLPACK kernels
+    double csr_work;         // entries visited by the CSR kernel, with its conversions
+    uint64_t dense_bytes;    // memory of a dense accumulator (per thread)
+    uint64_t cache_bytes;    // share of the last level cache per thread
+    const char *reason;
+} KernelChoice;
+
+uint64_t level2_cache(void);
+uint64_t *count_row_lengths(const ELLPACKMatrix *matrix);
+int select_kernel(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, int num_threads, KernelChoice *choice);
+void print_kernel_choice(FILE *file, const KernelChoice *choice);
+
+#endif // AUTOSELECT_H
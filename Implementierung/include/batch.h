@@ -0,0 +1,28 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "ellpack.h"
+
+// settings of a batch run, version may be VERSION_AUTO (picked per product)
+typedef struct
+{
+    int version;
+    int num_threads;
+    int num_jobs; // products computed at the same time, the threads are split between them
+    AccumulatorType accumulator;
+    bool accumulator_set;
+    bool compact_indices;
+} BatchOptions;
+
+// an input file, read once and shared by all products that use it
+typedef struct
+{
+    const char *filename;
+    ELLPACKMatrix matrix;
+} BatchInput;
+
+int batch_read_inputs(BatchInput *inputs, uint64_t num_inputs, int num_threads, bool compact_indices);
+void batch_multiply(int version, const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *result, int num_threads, AccumulatorType accumulator);
+int run_batch(const char *manifest, const BatchOptions *options);
+
+#endif // BATCH_H
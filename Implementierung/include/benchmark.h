@@ -0,0 +1,55 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdio.h>
+
+// phases of one run that are timed separately
+typedef enum
+{
+    PHASE_PARSE,
+    PHASE_CONTROL_INDICES,
+    PHASE_REORDER, // renumbering of the inputs and of the result rows (--reorder), no samples otherwise
+    PHASE_MULTIPLY,
+    PHASE_WRITE,
+    NUM_PHASES
+} BenchmarkPhase;
+
+// all samples of one phase in seconds
+typedef struct
+{
+    double *samples;
+    int num_samples;
+    int capacity;
+} PhaseTimes;
+
+typedef struct
+{
+    double min;
+    double median;
+    double p95;
+    double max;
+    double mean;
+} PhaseStats;
+
+// describes the run in the JSON output
+typedef struct
+{
+    int version;
+    int num_threads;
+    const char *accumulator;
+    const char *input_a;
+    const char *input_b;
+    int warmup;
+    int iterations;
+} BenchmarkInfo;
+
+double benchmark_now(void);
+const char *benchmark_phase_name(BenchmarkPhase phase);
+
+int phase_times_add(PhaseTimes *times, double seconds);
+void phase_times_free(PhaseTimes *times);
+int phase_times_stats(const PhaseTimes *times, PhaseStats *stats);
+
+int benchmark_write_json(FILE *file, const BenchmarkInfo *info, const PhaseTimes times[NUM_PHASES]);
+
+#endif // BENCHMARK_H
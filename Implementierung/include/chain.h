@@ -0,0 +1,18 @@
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include "ellpack.h"
+
+// settings of a chain run, version may be VERSION_AUTO (picked per product)
+typedef struct
+{
+    int version;
+    int num_threads;
+    AccumulatorType accumulator;
+    bool accumulator_set;
+    bool compact_indices;
+} ChainOptions;
+
+int run_chain(char *const *filenames, int num_inputs, const char *output, const ChainOptions *options);
+
+#endif // CHAIN_H
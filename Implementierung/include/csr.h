@@ -0,0 +1,26 @@
+#ifndef CSR_H
+#define CSR_H
+
+#include "ellpack.h"
+
+/*
+Compressed sparse rows: row i is values/indices[row_ptr[i] .. row_ptr[i + 1]), without any padding or zero entries.
+Version 8 converts its inputs to CSR, multiplies CSR x CSR and hands the result over as compressed ELLPACK rows,
+so ELLPACK is only used for reading and writing.
+*/
+typedef struct
+{
+    uint64_t num_rows;
+    uint64_t num_cols;
+    uint64_t *row_ptr;
+    float *values;
+    uint64_t *indices;
+    uint32_t *indices32; // indices with 32 bits if the ELLPACK matrix has them, indices is NULL then
+} CSRMatrix;
+
+int ellpack_to_csr(const ELLPACKMatrix *matrix, CSRMatrix *csr, int num_threads);
+int csr_to_ellpack(CSRMatrix *csr, ELLPACKMatrix *matrix);
+void free_csr(CSRMatrix *csr);
+int matr_mult_csr(const CSRMatrix *matrix_a, const CSRMatrix *matrix_b, CSRMatrix *matrix_result, int num_threads);
+
+#endif // CSR_H
@@ -2,6 +2,9 @@
 #define ELLPACK_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
 
 typedef struct
 {
@@ -10,13 +13,68 @@ typedef struct
     uint64_t num_non_zero;
     float *values;
     uint64_t *indices;
-    float **result_values;
+    uint32_t *indices32; // indices of an input matrix stored with 32 bits (if num_cols fits), indices is NULL then
+    float **result_values;   // ragged result rows, carved out of arena by versions 0, 2, 3, 5, 6, 7 and 9
     uint64_t **result_indices;
+    uint64_t *row_length;    // entries of every ragged row (NULL: every row has num_non_zero entries)
+    Arena *arena;
+    uint64_t *row_ptr; // compressed rows: row i is values/indices[row_ptr[i] .. row_ptr[i + 1]) (NULL for the padded layout)
+    void *mapping;     // binary input file that values/indices point into (NULL if they are heap memory)
+    uint64_t mapping_size;
 
 } ELLPACKMatrix;
 
+// accumulator for the rows of the result: dense row with touched-column list, or hash table for very wide matrices
+typedef enum
+{
+    ACCUMULATOR_DENSE,
+    ACCUMULATOR_HASH
+} AccumulatorType;
+
+// the hot kernels are compiled once per index width: with a constant compact the width check disappears after inlining
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+ALWAYS_INLINE uint64_t load_index(const ELLPACKMatrix *matrix, uint64_t i, bool compact)
+{
+    return compact ? matrix->indices32[i] : matrix->indices[i];
+}
+
+// index i of an input matrix, whichever width it is stored with
+static inline uint64_t ellpack_index(const ELLPACKMatrix *matrix, uint64_t i)
+{
+    return load_index(matrix, i, matrix->indices32 != NULL);
+}
+
+// defines the parallel_for tasks name_32 and name_64 from name_width(context, begin, end, compact)
+#define INDEX_WIDTH_TASKS(name)                                                              \
+    static void name##_32(void *context, int thread_id, uint64_t begin, uint64_t end)       \
+    {                                                                                        \
+        (void)thread_id;                                                                     \
+        name##_width(context, begin, end, true);                                             \
+    }                                                                                        \
+    static void name##_64(void *context, int thread_id, uint64_t begin, uint64_t end)       \
+    {                                                                                        \
+        (void)thread_id;                                                                     \
+        name##_width(context, begin, end, false);                                            \
+    }
+
+void free_input_arrays(const ELLPACKMatrix *matrix);
+void free_matrix(ELLPACKMatrix *matrix);
+int result_rows_init(ELLPACKMatrix *matrix_result);
+int result_row_alloc(ELLPACKMatrix *matrix_result, ArenaCursor *cursor, uint64_t row, uint64_t length);
+void result_rows_finish(ELLPACKMatrix *matrix_result);
+void free_result_rows(ELLPACKMatrix *matrix_result);
+
 void matr_mult_ellpack(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result);
 void matr_mult_ellpack_V1(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result);
 void matr_mult_ellpack_V2(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result);
+void matr_mult_ellpack_V3(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result, int num_threads);
+void matr_mult_ellpack_V4(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result, int num_threads, AccumulatorType accumulator);
+void matr_mult_ellpack_V4_rows(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result, uint64_t first_row_a, uint64_t num_rows_a, int num_threads, AccumulatorType accumulator);
+void matr_mult_ellpack_V5(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result, int num_threads);
+void matr_mult_ellpack_V6(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result, int num_threads);
+void matr_mult_ellpack_V8(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result, int num_threads);
+void matr_mult_ellpack_V9(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *matrix_result, int num_threads);
+const char *simd_level_name(void);
 
 #endif // ELLPACK_H
\ No newline at end of file
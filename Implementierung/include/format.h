@@ -0,0 +1,12 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+
+// longest text format_float and format_uint64 write (no terminating '\0' is written)
+#define FORMAT_MAX_LENGTH 32
+
+int format_float(char *buffer, float value);
+int format_uint64(char *buffer, uint64_t value);
+
+#endif // FORMAT_H
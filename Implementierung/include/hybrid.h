@@ -0,0 +1,36 @@
+#ifndef HYBRID_H
+#define HYBRID_H
+
+#include "ellpack.h"
+
+/*
+Hybrid ELL+COO matrix: an ELLPACK part of width slots per row (chosen from the row-length histogram) and a tail with
+the overflow entries of the longer rows. A few heavy rows no longer make every row as wide as the longest one.
+The tail is sorted by row, the overflow entries of row r are coo_values/coo_indices[coo_ptr[r] .. coo_ptr[r + 1]).
+*/
+typedef struct
+{
+    uint64_t num_rows;
+    uint64_t num_cols;
+    uint64_t width;
+    float *values;       // ELLPACK part, num_rows * width slots, padding has the value 0
+    uint64_t *indices;
+    uint32_t *indices32; // indices with 32 bits (if num_cols fits), indices and coo_indices are NULL then
+    uint64_t *coo_ptr;
+    float *coo_values;
+    uint64_t *coo_indices;
+    uint32_t *coo_indices32;
+} HybridMatrix;
+
+// the ELLPACK part is as wide as this percentile of the row lengths
+#define HYBRID_PERCENTILE 90
+
+uint64_t hybrid_width(const uint64_t *row_length, uint64_t num_rows, uint64_t max_length, unsigned percentile);
+int hybrid_alloc(HybridMatrix *hybrid, const uint64_t *row_length, bool compact);
+void hybrid_store_row(HybridMatrix *hybrid, uint64_t row, const float *values, const uint64_t *indices, uint64_t length);
+int ellpack_to_hybrid(const ELLPACKMatrix *matrix, HybridMatrix *hybrid, unsigned percentile);
+void free_hybrid(HybridMatrix *hybrid);
+int control_indices_hybrid(const char *filename, const HybridMatrix *hybrid);
+void matr_mult_ellpack_V7(HybridMatrix *matrix_a, HybridMatrix *matrix_b, ELLPACKMatrix *matrix_result, int num_threads);
+
+#endif // HYBRID_H
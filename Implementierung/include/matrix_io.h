@@ -2,12 +2,19 @@
 #define MATRIX_IO_H
 
 #include "ellpack.h"
+#include "hybrid.h"
 
-int read_matrix(const char *filename, ELLPACKMatrix *matrix);
-int write_matrix_V1(const char *filename, const ELLPACKMatrix *matrix, uint64_t num_non_zero);
-int write_matrix_V2(const char *filename, const ELLPACKMatrix *matrix);
+int read_matrix(const char *filename, ELLPACKMatrix *matrix, bool compact_indices, int num_threads);
+int set_index_width(ELLPACKMatrix *matrix, bool compact);
+int read_matrix_hybrid(const char *filename, HybridMatrix *hybrid, unsigned percentile, bool compact_indices);
+int write_matrix_V1(const char *filename, const ELLPACKMatrix *matrix, uint64_t num_non_zero, int num_threads);
+int write_matrix_V2(const char *filename, const ELLPACKMatrix *matrix, int num_threads);
+int write_matrix_V3(const char *filename, const ELLPACKMatrix *matrix, int num_threads);
+int write_matrix_binary(const char *filename, const ELLPACKMatrix *matrix);
+int write_result_matrix(const char *filename, ELLPACKMatrix *result, int version, int num_threads);
+int result_to_input(ELLPACKMatrix *matrix, bool compact_indices);
+int write_matrix_spilled(const char *filename, const ELLPACKMatrix *shape, const uint64_t *row_length, int values_fd, int indices_fd);
 int compute_num_non_zero(ELLPACKMatrix *matrix);
-int count_numbers_in_line(char *restrict line);
-int control_indices(const char *filename, const ELLPACKMatrix *restrict matrix);
+int control_indices(const char *filename, const ELLPACKMatrix *restrict matrix, int num_threads);
 
 #endif // MATRIX_IO_H
\ No newline at end of file
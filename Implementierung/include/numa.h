@@ -0,0 +1,25 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ellpack.h"
+
+/*
+NUMA mode (--numa): Linux puts a page on the node of the thread that touches it first, so the data of a kernel is local
+if the thread that works on a block of rows also touched it first and never moves. Thread i of parallel_for is pinned
+to the i-th allowed core (the calling thread is thread 0), the inputs are copied once into memory that every thread
+first touches with its own block of rows (versions 6 and 8 fill their SELL and CSR copies the same way), and the pool
+only reuses a block on the node that placed it. With huge pages the large arrays are advised to use transparent huge
+pages before they are touched.
+*/
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+int numa_enable(bool huge_pages);
+bool numa_enabled(void);
+void numa_pin_thread(int thread_id);
+int numa_current_node(void);
+void numa_advise(void *memory, size_t size);
+int numa_place_input(ELLPACKMatrix *matrix, int num_threads);
+
+#endif // NUMA_H
@@ -0,0 +1,13 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+
+// task that processes the items [begin, end) on thread thread_id
+typedef void (*parallel_task)(void *context, int thread_id, uint64_t begin, uint64_t end);
+
+int parallel_default_threads(void);
+void parallel_range(int thread_id, int num_threads, uint64_t num_items, uint64_t *begin, uint64_t *end);
+int parallel_for(int num_threads, uint64_t num_items, parallel_task task, void *context);
+
+#endif // PARALLEL_H
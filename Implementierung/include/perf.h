@@ -0,0 +1,47 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "ellpack.h"
+
+// hardware events that are counted around every phase
+typedef enum
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,
+    NUM_PERF_COUNTERS
+} PerfCounter;
+
+// open counters of one thread, fd is -1 for counters that are not available
+typedef struct
+{
+    int fd[NUM_PERF_COUNTERS];
+    uint64_t start[NUM_PERF_COUNTERS][3];
+} PerfCounters;
+
+// summed counts of one phase over all its runs
+typedef struct
+{
+    double count[NUM_PERF_COUNTERS];
+    bool available[NUM_PERF_COUNTERS];
+    int num_runs;
+} PerfSample;
+
+void perf_init(PerfCounters *perf);
+int perf_open(PerfCounters *perf);
+void perf_close(PerfCounters *perf);
+void perf_start(PerfCounters *perf);
+void perf_stop(PerfCounters *perf, PerfSample *sample);
+void perf_thread_start(PerfCounters *perf);
+void perf_thread_stop(PerfCounters *perf);
+
+uint64_t perf_multiply_flops(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b);
+uint64_t perf_multiply_bytes(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, const ELLPACKMatrix *matrix_result);
+void perf_report(FILE *file, const char *phase, const PerfSample *sample, double seconds, uint64_t flops, uint64_t bytes);
+
+#endif // PERF_H
@@ -0,0 +1,24 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include "ellpack.h"
+
+/*
+Renumbering of a product A x B for the reuse of the rows of B: the rows of A in Cuthill-McKee order of the bipartite
+graph of A (rows that share columns end up next to each other) and the rows of B (the columns of A) in the order in
+which that walk reaches them. The product of the renumbered inputs has the same entries, only its rows are in the
+order of A, restore_result_rows puts them back.
+*/
+typedef struct
+{
+    uint64_t num_rows;
+    uint64_t *row_order; // row i of the renumbered A (and of the result) is row row_order[i] of A
+    uint64_t num_inner;
+    uint64_t *inner_order; // row k of the renumbered B is row inner_order[k] of B, column k of A
+} Reordering;
+
+int reorder_inputs(ELLPACKMatrix *matrix_a, ELLPACKMatrix *matrix_b, int num_threads, Reordering *reordering);
+int restore_result_rows(ELLPACKMatrix *result, const Reordering *reordering, int num_threads);
+void free_reordering(Reordering *reordering);
+
+#endif // REORDER_H
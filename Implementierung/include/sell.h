@@ -0,0 +1,37 @@
+#ifndef SELL_H
+#define SELL_H
+
+#include "ellpack.h"
+
+/*
+Sliced ELLPACK (SELL-C-sigma): the rows are sorted by length (longest first) within windows of sigma rows and stored
+in chunks of chunk_size (C) rows. A chunk is only padded to its own longest row and the length of every row is stored,
+so the kernels never touch padding. Within a chunk the entries are stored column by column:
+entry j of the row at position p is at row_start[p] + j * chunk_size.
+*/
+typedef struct
+{
+    uint64_t num_rows;
+    uint64_t num_cols;
+    uint64_t chunk_size;
+    uint64_t sigma;
+    uint64_t num_chunks;
+    uint64_t *chunk_ptr;    // chunk c is values/indices[chunk_ptr[c] .. chunk_ptr[c + 1])
+    uint64_t *row_order;    // position p holds row row_order[p] of the ELLPACK matrix
+    uint64_t *row_position; // inverse of row_order
+    uint64_t *row_length;   // entries of the row at position p
+    uint64_t *row_start;    // first entry of the row at position p
+    float *values;
+    uint64_t *indices;
+    uint32_t *indices32; // indices with 32 bits if the ELLPACK matrix has them, indices is NULL then
+} SELLMatrix;
+
+// chunk size and sorting window of matrix_a in version 6, matrix_b is stored as SELL-1-1 (every row contiguous)
+#define SELL_CHUNK_SIZE 8
+#define SELL_SIGMA 256
+
+int ellpack_to_sell(const ELLPACKMatrix *matrix, SELLMatrix *sell, uint64_t chunk_size, uint64_t sigma, int num_threads);
+void free_sell(SELLMatrix *sell);
+int matr_mult_sell(const SELLMatrix *matrix_a, const SELLMatrix *matrix_b, ELLPACKMatrix *matrix_result, int num_threads);
+
+#endif // SELL_H
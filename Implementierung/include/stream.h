@@ -0,0 +1,8 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "ellpack.h"
+
+int matr_mult_streaming(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, const char *output_file, uint64_t memory_budget, int num_threads, AccumulatorType accumulator);
+
+#endif // STREAM_H
@@ -17,17 +17,23 @@ def plot_performance_results(json_filename, densities, matrix_sizes, implementat
     for i, density in enumerate(densities):
         ax = axes[i]
         for impl in implementations:
-            # Filter out None values for plotting
+            # Filter out failed runs, plot the median multiplication time with the min-max range
             sizes = []
-            times = []
-            for size, time in zip(matrix_sizes, performance_results[str(density)][str(impl)]):
-                if time is not None:
+            medians = []
+            mins = []
+            maxs = []
+            for size, benchmark in zip(matrix_sizes, performance_results[str(density)][str(impl)]):
+                if benchmark is not None:
+                    multiply = benchmark["phases"]["multiply"]
                     sizes.append(size)
-                    times.append(time)
-            if sizes and times:  # Ensure there's data to plot
-                ax.plot(sizes, times, marker='o', label=f"V:{impl}")
-
-        ax.set_ylabel('Execution Time (s)')
+                    medians.append(multiply["median"])
+                    mins.append(multiply["min"])
+                    maxs.append(multiply["max"])
+            if sizes:  # Ensure there's data to plot
+                line, = ax.plot(sizes, medians, marker='o', label=f"V:{impl}")
+                ax.fill_between(sizes, mins, maxs, color=line.get_color(), alpha=0.2)
+
+        ax.set_ylabel('Multiplication Time (s), median')
         ax.set_title(f'Density: {density}')
         ax.grid(True)
         ax.legend()
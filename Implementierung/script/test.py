@@ -17,12 +17,13 @@ def compile_implementations():
     except subprocess.CalledProcessError as e:
         print(e.output)
 
-# Function to parse execution time from the main program output
-def parse_execution_time(output):
-    for line in output.splitlines():
-        if "Average execution time:" in line:
-            return float(line.split(":")[1].strip().split()[0])
-    return None
+# Function to load the phase timings that main writes with -j
+def load_benchmark_json(filename):
+    try:
+        with open(filename, 'r') as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return None
 
 # Function to save matrix to file
 def save_matrix_row_by_row(rows, cols, density, filename):
@@ -167,7 +168,7 @@ def run_isolated_test(command, timeout):
         return -1, stdout, stderr, True
 
 # Function to run the all tests based on specified arguments or default arguments
-def run_tests(num_runs, timeout, densities, results_filename):
+def run_tests(num_runs, num_warmup, timeout, densities, results_filename):
     performance_results = {density: {impl: [] for impl in IMPLEMENTATIONS} for density in densities}
     timed_out_versions = set()
 
@@ -184,37 +185,39 @@ def run_tests(num_runs, timeout, densities, results_filename):
                     continue
 
                 print(f"\nTesting V{impl} with matrix size {size}x{size} and density {density}")
-                execution_times = []
+                benchmark = None
+                json_filename = os.path.join(RESULTS_DIR, f'benchmark_V{impl}_{size}x{size}.json')
 
                 try:
-                    command = [os.path.join(BASE_DIR, "main"), f"-V {impl}", f"-B{num_runs}", f"-a{matrix_a_filename}", f"-b{matrix_b_filename}", f"-o{os.path.join(RESULTS_DIR, f'result_V{impl}_{size}x{size}.txt')}"]
+                    command = [os.path.join(BASE_DIR, "main"), f"-V {impl}", f"-B{num_runs}", f"-W{num_warmup}", f"-j{json_filename}", f"-a{matrix_a_filename}", f"-b{matrix_b_filename}", f"-o{os.path.join(RESULTS_DIR, f'result_V{impl}_{size}x{size}.txt')}"]
                     returncode, stdout, stderr, timed_out = run_isolated_test(command, timeout)
                     if timed_out:
                         print(f"Run V{impl} timed out.")
                         timed_out_versions.add(impl)
-
-                        break  # Skip further runs for this implementation
-                    if returncode == 0:
-                        execution_time = parse_execution_time(stdout.decode())
-                        if execution_time is not None:
-                            execution_times.append(execution_time)
-                        else:
-                            print("Failed to parse execution time from the output.")
+                    elif returncode == 0:
+                        benchmark = load_benchmark_json(json_filename)
+                        if benchmark is None:
+                            print("Failed to read the benchmark JSON of the run.")
                     else:
                         print(f"Error: {stderr.decode().strip()}")
                 except Exception as e:
                     print(f"Execution error: {e}")
 
-                if execution_times:
-                    avg_time = sum(execution_times) / len(execution_times)
-                    performance_results[density][impl].append(avg_time)
-                    print(f"Average Execution Time for V{impl} with matrix size {size}x{size} and density {density}: {avg_time:.6f} seconds")
+                # every size gets an entry (None if the run failed) so that the plotter can match entries to sizes
+                performance_results[density][impl].append(benchmark)
+
+                if benchmark:
+                    phases = benchmark["phases"]
+                    multiply = phases["multiply"]
+                    print(f"Multiplication V{impl} with matrix size {size}x{size} and density {density}: "
+                          f"median {multiply['median']:.6f} s (min {multiply['min']:.6f} s, p95 {multiply['p95']:.6f} s, max {multiply['max']:.6f} s)")
+                    print(f"Parse {phases['parse']['median']:.6f} s, control_indices {phases['control_indices']['median']:.6f} s, write {phases['write']['median']:.6f} s")
 
                     if COMPARE:
                         # Check correctness with matrixmultiplication module of numpy
                         np_matrix_mul = np.matmul(load_matrix_values_from_file(matrix_a_filename), load_matrix_values_from_file(matrix_b_filename), dtype=np.float32)
                         result_path = os.path.join(RESULTS_DIR, f"result_V{impl}_{size}x{size}.txt")
-                        if returncode == 0 and compare_matrices(load_matrix_values_from_file(result_path), np_matrix_mul):
+                        if compare_matrices(load_matrix_values_from_file(result_path), np_matrix_mul):
                             print(f"Output correctness: PASSED")
                         else:
                             print(f"Output correctness: FAILED")
@@ -234,7 +237,7 @@ def run_edge_case_tests(timeout):
             print(f"\nTesting V{impl} with edge case '{case_name}'")
             try:
                 command = [os.path.join(BASE_DIR, "main"), f"-V {impl}", "-B", f"-a{matrix_a_filename}", f"-b{matrix_b_filename}", f"-o{os.path.join(RESULTS_DIR, f'result_edge_case_{case_name}_V{impl}.txt')}"]
-                returncode, stdout, stderr = run_isolated_test(command, timeout)
+                returncode, stdout, stderr, timed_out = run_isolated_test(command, timeout)
                 if returncode == 0:
                     print(f"Edge case '{case_name}' Execution: PASSED")
                 else:
@@ -248,6 +251,7 @@ def print_parameters(args):
     print(f"Densities: {args.density}")
     print(f"Matrix Sizes: {args.matrix_sizes}")
     print(f"Number of Runs: {args.num_runs}")
+    print(f"Warmup Runs: {args.warmup}")
     print(f"Timeout: {args.timeout}")
     print(f"Compile: {args.compile}")
     print(f"Generate New Matrices: {args.generate}")
@@ -259,10 +263,11 @@ def print_parameters(args):
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='Matrix Multiplication Performance Testing')
-    parser.add_argument('-V','--versions', type=int, nargs='+', default=[0, 1, 2], help='List of Versions to test (0-2)')
+    parser.add_argument('-V','--versions', type=int, nargs='+', default=[0, 1, 2], help='List of Versions to test (0-9)')
     parser.add_argument('-d','--density', type=float, nargs='+', default=[0.2, 0.5, 0.8], help='List of density for generated matrices (0.0-1.0)')
     parser.add_argument('-ms','--matrix_sizes', type=int, nargs='+', default=[8, 16, 32, 64, 128, 256, 512,750, 1024, 1265, 1535, 1794 ,2048, 2564, 3064, 3465, 4096, 6045, 8054, 10564, 12354], help='List of matrix sizes (int)')
     parser.add_argument('-n','--num_runs', type=int, default=3, help='Number of runs for each test (int)')
+    parser.add_argument('-w','--warmup', type=int, default=1, help='Number of untimed warmup runs before each test (int)')
     parser.add_argument('-tmo','--timeout', type=int, default=1800, help='Specify Timeout in seconds, to prevent executing long execution times of a algorithm')
 
     parser.add_argument('-c', '--compile', action='store_false', help='Does NOT compile the implementations')
@@ -298,7 +303,7 @@ if __name__ == "__main__":
 
     results_filename = os.path.join(BASE_DIR, f'performance_results_{args.json}.json')
     # Run matrix tests
-    performances = run_tests(args.num_runs, args.timeout, args.density, results_filename)
+    performances = run_tests(args.num_runs, args.warmup, args.timeout, args.density, results_filename)
     # Plot performance results
     if args.plot:
         plot_performance_results(results_filename, args.density, args.matrix_sizes, args.versions, args.timeout, args.num_runs)
@@ -0,0 +1,212 @@
+#include "accumulator.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Allocates the accumulator for rows with num_cols columns (the values are not zeroed, the marker decides what is valid).
+The arrays come from the pool, so the next multiplication (-B) gets them back without new page faults.
+*/
+int accumulator_init(Accumulator *acc, uint64_t num_cols)
+{
+    acc->num_cols = num_cols;
+    acc->values = (float *)pool_alloc(num_cols * sizeof(float));
+    acc->marker = (uint32_t *)pool_alloc(num_cols * sizeof(uint32_t));
+    acc->touched = (uint64_t *)pool_alloc(num_cols * sizeof(uint64_t));
+    acc->generation = 1;
+    acc->num_touched = 0;
+
+    if (!acc->values || !acc->marker || !acc->touched)
+    {
+        accumulator_free(acc);
+        return -1;
+    }
+
+    memset(acc->marker, 0, num_cols * sizeof(uint32_t));
+    return 0;
+}
+
+void accumulator_free(Accumulator *acc)
+{
+    pool_free(acc->values);
+    pool_free(acc->marker);
+    pool_free(acc->touched);
+    acc->values = NULL;
+    acc->marker = NULL;
+    acc->touched = NULL;
+}
+
+// starts a new row in O(1), only when the generation counter wraps around the markers are cleared
+void accumulator_next_row(Accumulator *acc)
+{
+    acc->num_touched = 0;
+    acc->generation++;
+
+    if (acc->generation == 0)
+    {
+        memset(acc->marker, 0, acc->num_cols * sizeof(uint32_t));
+        acc->generation = 1;
+    }
+}
+
+static int compare_columns(const void *first, const void *second)
+{
+    uint64_t col_first = *(const uint64_t *)first;
+    uint64_t col_second = *(const uint64_t *)second;
+    return (col_first > col_second) - (col_first < col_second);
+}
+
+// sorts the columns of one result row (rows are mostly short, so insertion sort is used for them)
+void sort_columns(uint64_t *columns, uint64_t count)
+{
+    if (count > 32)
+    {
+        qsort(columns, count, sizeof(uint64_t), compare_columns);
+        return;
+    }
+
+    for (uint64_t i = 1; i < count; ++i)
+    {
+        uint64_t col = columns[i];
+        uint64_t j = i;
+
+        while (j > 0 && columns[j - 1] > col)
+        {
+            columns[j] = columns[j - 1];
+            j--;
+        }
+
+        columns[j] = col;
+    }
+}
+
+// writes the non-zero entries of the current row in column order, starts the next row and returns the number of entries
+uint64_t accumulator_flush(Accumulator *acc, float *values, uint64_t *indices)
+{
+    uint64_t cnt_non_zero = 0;
+
+    sort_columns(acc->touched, acc->num_touched);
+
+    for (uint64_t i = 0; i < acc->num_touched; ++i)
+    {
+        uint64_t col = acc->touched[i];
+
+        if (acc->values[col] != 0.0f)
+        {
+            values[cnt_non_zero] = acc->values[col];
+            indices[cnt_non_zero] = col;
+            cnt_non_zero++;
+        }
+    }
+
+    accumulator_next_row(acc);
+    return cnt_non_zero;
+}
+
+int hash_accumulator_init(HashAccumulator *hash)
+{
+    *hash = (HashAccumulator){0};
+    return hash_accumulator_start_row(hash, 0);
+}
+
+void hash_accumulator_free(HashAccumulator *hash)
+{
+    free(hash->keys);
+    free(hash->values);
+    free(hash->columns);
+    *hash = (HashAccumulator){0};
+}
+
+// sizes the table for a row with at most max_entries columns (load factor <= 0.5), the table only grows
+int hash_accumulator_start_row(HashAccumulator *hash, uint64_t max_entries)
+{
+    uint64_t capacity = 16;
+    uint32_t shift = 60;
+
+    while (capacity < 2 * max_entries)
+    {
+        capacity <<= 1;
+        shift--;
+    }
+
+    if (capacity > hash->allocated)
+    {
+        uint64_t *keys = (uint64_t *)realloc(hash->keys, capacity * sizeof(uint64_t));
+        if (keys)
+        {
+            hash->keys = keys;
+        }
+
+        float *values = (float *)realloc(hash->values, capacity * sizeof(float));
+        if (values)
+        {
+            hash->values = values;
+        }
+
+        if (!keys || !values)
+        {
+            return -1;
+        }
+
+        // the slots below allocated are already empty
+        memset(hash->keys + hash->allocated, 0xFF, (capacity - hash->allocated) * sizeof(uint64_t));
+        hash->allocated = capacity;
+    }
+
+    if (max_entries > hash->allocated_columns)
+    {
+        uint64_t *columns = (uint64_t *)realloc(hash->columns, capacity / 2 * sizeof(uint64_t));
+        if (!columns)
+        {
+            return -1;
+        }
+
+        hash->columns = columns;
+        hash->allocated_columns = capacity / 2;
+    }
+
+    hash->capacity = capacity;
+    hash->shift = shift;
+    hash->num_entries = 0;
+    return 0;
+}
+
+// writes the non-zero entries of the row in column order and empties the used part of the table
+uint64_t hash_accumulator_flush(HashAccumulator *hash, float *values, uint64_t *indices)
+{
+    uint64_t num_columns = 0;
+
+    for (uint64_t slot = 0; slot < hash->capacity; ++slot)
+    {
+        if (hash->keys[slot] != HASH_EMPTY)
+        {
+            hash->columns[num_columns++] = hash->keys[slot];
+        }
+    }
+
+    sort_columns(hash->columns, num_columns);
+
+    uint64_t cnt_non_zero = 0;
+
+    for (uint64_t i = 0; i < num_columns; ++i)
+    {
+        float value = hash->values[hash_accumulator_slot(hash, hash->columns[i])];
+
+        if (value != 0.0f)
+        {
+            values[cnt_non_zero] = value;
+            indices[cnt_non_zero] = hash->columns[i];
+            cnt_non_zero++;
+        }
+    }
+
+    hash_accumulator_clear(hash);
+    return cnt_non_zero;
+}
+
+// empties the used part of the table without reading it (symbolic phase)
+void hash_accumulator_clear(HashAccumulator *hash)
+{
+    memset(hash->keys, 0xFF, hash->capacity * sizeof(uint64_t));
+    hash->num_entries = 0;
+}
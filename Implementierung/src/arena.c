@@ -0,0 +1,175 @@
+#include "arena.h"
+#include "numa.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// blocks are cache line aligned, the header in front of a block holds its size and the node it was allocated on
+#define POOL_ALIGNMENT 64
+#define POOL_HEADER POOL_ALIGNMENT
+
+// released blocks kept for reuse, a block serves requests of at least half its size
+#define POOL_SLOTS 1024
+
+// arena allocations are aligned for every element type of the kernels
+#define ARENA_ALIGNMENT 16
+
+static void *pool_blocks[POOL_SLOTS];
+static size_t pool_count = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t block_size(const void *block)
+{
+    return *(const size_t *)((const char *)block - POOL_HEADER);
+}
+
+static int block_node(const void *block)
+{
+    return *(const int *)((const char *)block - POOL_HEADER + sizeof(size_t));
+}
+
+/*
+A block of at least size bytes, a released block of a similar size is reused (its contents are undefined). In the NUMA
+mode only blocks allocated on the node of the calling thread are reused, as their pages were placed there.
+*/
+void *pool_alloc(size_t size)
+{
+    size = (size + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1);
+    int node = numa_current_node();
+
+    pthread_mutex_lock(&pool_lock);
+
+    for (size_t i = 0; i < pool_count; ++i)
+    {
+        size_t cached = block_size(pool_blocks[i]);
+
+        if (cached >= size && cached / 2 <= size && block_node(pool_blocks[i]) == node)
+        {
+            void *block = pool_blocks[i];
+            pool_blocks[i] = pool_blocks[--pool_count];
+            pthread_mutex_unlock(&pool_lock);
+            return block;
+        }
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    char *memory = (char *)aligned_alloc(POOL_ALIGNMENT, POOL_HEADER + (size ? size : POOL_ALIGNMENT));
+
+    if (!memory)
+    {
+        return NULL;
+    }
+
+    *(size_t *)memory = size ? size : POOL_ALIGNMENT;
+    *(int *)(memory + sizeof(size_t)) = node;
+    numa_advise(memory + POOL_HEADER, size);
+    return memory + POOL_HEADER;
+}
+
+// hands a block of pool_alloc back to the pool (freed if the pool is full)
+void pool_free(void *block)
+{
+    if (!block)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (pool_count < POOL_SLOTS)
+    {
+        pool_blocks[pool_count++] = block;
+        block = NULL;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    if (block)
+    {
+        free((char *)block - POOL_HEADER);
+    }
+}
+
+// frees all blocks kept by the pool
+void pool_trim(void)
+{
+    pthread_mutex_lock(&pool_lock);
+
+    for (size_t i = 0; i < pool_count; ++i)
+    {
+        free((char *)pool_blocks[i] - POOL_HEADER);
+    }
+
+    pool_count = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+Arena *arena_create(void)
+{
+    Arena *arena = (Arena *)malloc(sizeof(Arena));
+
+    if (!arena)
+    {
+        return NULL;
+    }
+
+    arena->chunks = NULL;
+    pthread_mutex_init(&arena->lock, NULL);
+    return arena;
+}
+
+// releases every allocation of the arena at once, the chunks go back to the pool
+void arena_destroy(Arena *arena)
+{
+    if (!arena)
+    {
+        return;
+    }
+
+    ArenaChunk *chunk = arena->chunks;
+
+    while (chunk)
+    {
+        ArenaChunk *next = chunk->next;
+        pool_free(chunk);
+        chunk = next;
+    }
+
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+}
+
+ArenaCursor arena_cursor(Arena *arena)
+{
+    return (ArenaCursor){arena, NULL, NULL};
+}
+
+// size bytes from the cursor's chunk, a new chunk is only taken (under the lock) when the current one is full
+void *arena_alloc(ArenaCursor *cursor, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if ((size_t)(cursor->end - cursor->pos) < size || !cursor->pos)
+    {
+        size_t header = (sizeof(ArenaChunk) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+        size_t chunk_size = size + header > ARENA_CHUNK_SIZE ? size + header : ARENA_CHUNK_SIZE;
+        ArenaChunk *chunk = (ArenaChunk *)pool_alloc(chunk_size);
+
+        if (!chunk)
+        {
+            return NULL;
+        }
+
+        pthread_mutex_lock(&cursor->arena->lock);
+        chunk->next = cursor->arena->chunks;
+        cursor->arena->chunks = chunk;
+        pthread_mutex_unlock(&cursor->arena->lock);
+
+        cursor->pos = (char *)chunk + header;
+        cursor->end = (char *)chunk + chunk_size;
+    }
+
+    void *memory = cursor->pos;
+    cursor->pos += size;
+    return memory;
+}
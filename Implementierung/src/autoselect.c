@@ -0,0 +1,185 @@
+#include "autoselect.h"
+#include "hybrid.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the CSR kernel pays a row_ptr lookup per entry of A, it has to save a quarter of the work to win
+#define CSR_ADVANTAGE 1.25
+
+// a dense accumulator costs a float, a marker and a touched slot per column
+#define DENSE_BYTES_PER_COL (sizeof(float) + sizeof(uint32_t) + sizeof(uint64_t))
+
+// the hash accumulator only pays off if a result row touches a small part of the columns
+#define HASH_MAX_ROW_SHARE 16
+
+// size of the last level cache (sysconf), 8 MiB if the system does not tell
+static uint64_t last_level_cache(void)
+{
+    long size = -1;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    if (size <= 0)
+    {
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    }
+#endif
+
+    return size > 0 ? (uint64_t)size : 8u << 20;
+}
+
+// size of the L2 cache of a core (sysconf), 1 MiB if the system does not tell
+uint64_t level2_cache(void)
+{
+    long size = -1;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+
+    return size > 0 ? (uint64_t)size : 1u << 20;
+}
+
+// fills the statistics of a matrix from its row lengths
+static void matrix_stats(const ELLPACKMatrix *matrix, const uint64_t *row_length, MatrixStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for (uint64_t row = 0; row < matrix->num_rows; ++row)
+    {
+        stats->non_zero += row_length[row];
+
+        if (row_length[row] > stats->max_length)
+        {
+            stats->max_length = row_length[row];
+        }
+    }
+
+    uint64_t num_slots = matrix->num_rows * matrix->num_non_zero;
+    double num_elements = (double)matrix->num_rows * (double)matrix->num_cols;
+
+    stats->median_length = hybrid_width(row_length, matrix->num_rows, matrix->num_non_zero, 50);
+    stats->p90_length = hybrid_width(row_length, matrix->num_rows, matrix->num_non_zero, 90);
+    stats->fill = num_slots ? (double)stats->non_zero / (double)num_slots : 1.0;
+    stats->density = num_elements > 0 ? (double)stats->non_zero / num_elements : 0.0;
+}
+
+// non-zero values of every row of an ELLPACK matrix
+uint64_t *count_row_lengths(const ELLPACKMatrix *matrix)
+{
+    uint64_t *row_length = (uint64_t *)calloc(matrix->num_rows ? matrix->num_rows : 1, sizeof(uint64_t));
+
+    if (!row_length)
+    {
+        return NULL;
+    }
+
+    for (uint64_t row = 0; row < matrix->num_rows; ++row)
+    {
+        const float *values = matrix->values + row * matrix->num_non_zero;
+
+        for (uint64_t j = 0; j < matrix->num_non_zero; ++j)
+        {
+            row_length[row] += values[j] != 0.0f;
+        }
+    }
+
+    return row_length;
+}
+
+/*
+Picks the kernel and accumulator for -V auto from statistics that cost one pass over the inputs:
+- the work of the padded ELLPACK kernels (every slot of A and, per entry of A, every slot of a row of B) against the
+  work of the CSR kernel (non-zero entries and flops plus the conversions) decides between version 4 and version 8
+- a dense accumulator that does not fit into the thread's share of the last level cache, while the result rows only
+  touch a small part of the columns, selects version 4 with the hash accumulator, with longer rows version 9, which
+  works on column panels of B
+Versions 0 to 2 are never picked (sequential, version 1 searches its result slots linearly), neither is version 7,
+which reads its inputs in another format. Returns -1 if memory is missing.
+*/
+int select_kernel(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, int num_threads, KernelChoice *choice)
+{
+    memset(choice, 0, sizeof(*choice));
+
+    uint64_t *row_length_a = count_row_lengths(matrix_a);
+    uint64_t *row_length_b = count_row_lengths(matrix_b);
+
+    if (!row_length_a || !row_length_b)
+    {
+        free(row_length_a);
+        free(row_length_b);
+        return -1;
+    }
+
+    matrix_stats(matrix_a, row_length_a, &choice->stats_a);
+    matrix_stats(matrix_b, row_length_b, &choice->stats_b);
+
+    // flops: every non-zero entry (row, k) of A meets the non-zero entries of row k of B
+    for (uint64_t i = 0; i < matrix_a->num_rows * matrix_a->num_non_zero; ++i)
+    {
+        uint64_t row_b = ellpack_index(matrix_a, i);
+
+        if (matrix_a->values[i] != 0.0f && row_b < matrix_b->num_rows)
+        {
+            choice->flops += (double)row_length_b[row_b];
+        }
+    }
+
+    free(row_length_a);
+    free(row_length_b);
+
+    double slots_a = (double)matrix_a->num_rows * (double)matrix_a->num_non_zero;
+    double slots_b = (double)matrix_b->num_rows * (double)matrix_b->num_non_zero;
+
+    choice->padded_work = slots_a + (double)choice->stats_a.non_zero * (double)matrix_b->num_non_zero;
+    choice->csr_work = (double)choice->stats_a.non_zero + choice->flops + slots_a + slots_b;
+    choice->dense_bytes = matrix_b->num_cols * DENSE_BYTES_PER_COL;
+    choice->cache_bytes = last_level_cache() / (uint64_t)(num_threads > 0 ? num_threads : 1);
+    choice->accumulator = ACCUMULATOR_DENSE;
+
+    double flops_per_row = matrix_a->num_rows ? choice->flops / (double)matrix_a->num_rows : 0.0;
+
+    if (choice->dense_bytes > choice->cache_bytes && flops_per_row * HASH_MAX_ROW_SHARE < (double)matrix_b->num_cols)
+    {
+        choice->version = 4;
+        choice->accumulator = ACCUMULATOR_HASH;
+        choice->reason = "the dense accumulator does not fit into the cache and the result rows are short";
+    }
+    else if (choice->dense_bytes > choice->cache_bytes)
+    {
+        choice->version = 9;
+        choice->reason = "the dense accumulator does not fit into the cache, column panels of B keep it in L2";
+    }
+    else if (choice->padded_work > CSR_ADVANTAGE * choice->csr_work)
+    {
+        choice->version = 8;
+        choice->reason = "the rows are uneven, most of the padded slots would be visited for nothing";
+    }
+    else
+    {
+        choice->version = 4;
+        choice->reason = "the rows are even, the ELLPACK kernel visits little padding";
+    }
+
+    return 0;
+}
+
+static void print_matrix_stats(FILE *file, const char *name, const MatrixStats *stats)
+{
+    fprintf(file, "  %s: %lu non-zero, fill %.3f, density %.3g, row length median/p90/max %lu / %lu / %lu\n",
+            name, (unsigned long)stats->non_zero, stats->fill, stats->density, (unsigned long)stats->median_length,
+            (unsigned long)stats->p90_length, (unsigned long)stats->max_length);
+}
+
+void print_kernel_choice(FILE *file, const KernelChoice *choice)
+{
+    fprintf(file, "Auto selection: version %d with the %s accumulator\n", choice->version, choice->accumulator == ACCUMULATOR_HASH ? "hash" : "dense");
+    print_matrix_stats(file, "A", &choice->stats_a);
+    print_matrix_stats(file, "B", &choice->stats_b);
+    fprintf(file, "  flops %.3g, padded work %.3g, CSR work %.3g, dense accumulator %lu KiB, cache per thread %lu KiB\n",
+            choice->flops, choice->padded_work, choice->csr_work, (unsigned long)(choice->dense_bytes >> 10), (unsigned long)(choice->cache_bytes >> 10));
+    fprintf(file, "  reason: %s\n", choice->reason);
+}
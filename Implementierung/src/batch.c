@@ -0,0 +1,404 @@
+#include "batch.h"
+#include "matrix_io.h"
+#include "parallel.h"
+#include "benchmark.h"
+#include "autoselect.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+typedef struct
+{
+    const char *output;
+    uint64_t input_a;
+    uint64_t input_b;
+    int version;
+    double seconds;
+    int status;
+} BatchJob;
+
+typedef struct
+{
+    const BatchOptions *options;
+    BatchInput *inputs;
+    BatchJob *jobs;
+    int kernel_threads;
+} BatchContext;
+
+typedef struct
+{
+    BatchInput *inputs;
+    bool compact_indices;
+    int parse_threads; // threads per file, the files are read at the same time
+    atomic_bool failed;
+} LoadContext;
+
+static int compare_names(const void *first, const void *second)
+{
+    return strcmp(*(const char *const *)first, *(const char *const *)second);
+}
+
+// the whole manifest in a string that the names point into
+static char *read_manifest(const char *manifest)
+{
+    FILE *file = fopen(manifest, "r");
+
+    if (!file)
+    {
+        fprintf(stderr, "Error opening file %s\n", manifest);
+        return NULL;
+    }
+
+    size_t size = 0, allocated = 4096;
+    char *text = (char *)malloc(allocated);
+
+    while (text)
+    {
+        size += fread(text + size, 1, allocated - size - 1, file);
+
+        if (size < allocated - 1)
+        {
+            break;
+        }
+
+        allocated *= 2;
+        char *grown = (char *)realloc(text, allocated);
+
+        if (!grown)
+        {
+            free(text);
+        }
+
+        text = grown;
+    }
+
+    if (!text || ferror(file))
+    {
+        fprintf(stderr, "Error reading file %s\n", manifest);
+        free(text);
+        fclose(file);
+        return NULL;
+    }
+
+    text[size] = '\0';
+    fclose(file);
+    return text;
+}
+
+/*
+Splits the manifest into jobs: every line that is not empty and does not start with '#' names input A, input B and
+the output, separated by blanks. names receives the input names of all jobs (two per job).
+*/
+static int parse_manifest(const char *manifest, char *text, BatchJob **jobs, const char ***names, uint64_t *num_jobs)
+{
+    uint64_t allocated = 0, line_number = 0;
+    char *save_line = NULL;
+
+    *jobs = NULL;
+    *names = NULL;
+    *num_jobs = 0;
+
+    for (char *line = strtok_r(text, "\n", &save_line); line; line = strtok_r(NULL, "\n", &save_line))
+    {
+        char *save_field = NULL;
+        char *fields[4];
+        int num_fields = 0;
+
+        line_number++;
+
+        for (char *field = strtok_r(line, " \t\r", &save_field); field && num_fields < 4; field = strtok_r(NULL, " \t\r", &save_field))
+        {
+            fields[num_fields++] = field;
+        }
+
+        if (num_fields == 0 || fields[0][0] == '#')
+        {
+            continue;
+        }
+
+        if (num_fields != 3)
+        {
+            fprintf(stderr, "Error in line %lu of %s: expected <inputA> <inputB> <output>\n", (unsigned long)line_number, manifest);
+            return -1;
+        }
+
+        if (*num_jobs == allocated)
+        {
+            allocated = allocated ? 2 * allocated : 64;
+            BatchJob *grown_jobs = (BatchJob *)realloc(*jobs, allocated * sizeof(BatchJob));
+            if (grown_jobs)
+            {
+                *jobs = grown_jobs;
+            }
+
+            const char **grown_names = (const char **)realloc((void *)*names, 2 * allocated * sizeof(char *));
+            if (grown_names)
+            {
+                *names = grown_names;
+            }
+
+            if (!grown_jobs || !grown_names)
+            {
+                fprintf(stderr, "Memory allocation failed for the batch jobs\n");
+                return -1;
+            }
+        }
+
+        (*jobs)[*num_jobs] = (BatchJob){fields[2], 0, 0, 0, 0.0, -1};
+        (*names)[2 * *num_jobs] = fields[0];
+        (*names)[2 * *num_jobs + 1] = fields[1];
+        (*num_jobs)++;
+    }
+
+    return 0;
+}
+
+// reads and checks the inputs [begin, end)
+static void load_inputs(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    LoadContext *ctx = (LoadContext *)context;
+
+    for (uint64_t i = begin; i < end && !atomic_load_explicit(&ctx->failed, memory_order_relaxed); ++i)
+    {
+        BatchInput *input = &ctx->inputs[i];
+
+        if (read_matrix(input->filename, &input->matrix, ctx->compact_indices, ctx->parse_threads) != 0 ||
+            control_indices(input->filename, &input->matrix, ctx->parse_threads) != 0)
+        {
+            atomic_store(&ctx->failed, true);
+        }
+    }
+}
+
+/*
+Reads and checks the files of inputs, several at the same time. The kernels need one index width for both operands, so
+if one input does not fit into 32 bits all of them use 64 bits. Returns -1 if an input could not be read.
+*/
+int batch_read_inputs(BatchInput *inputs, uint64_t num_inputs, int num_threads, bool compact_indices)
+{
+    uint64_t parse_threads = num_inputs ? (uint64_t)num_threads / num_inputs : 1;
+    LoadContext ctx = {inputs, compact_indices, parse_threads > 1 ? (int)parse_threads : 1, false};
+
+    if (parallel_for(num_threads, num_inputs, load_inputs, &ctx) != 0 || atomic_load(&ctx.failed))
+    {
+        return -1;
+    }
+
+    for (uint64_t i = 0; compact_indices && i < num_inputs; ++i)
+    {
+        if (inputs[i].matrix.num_non_zero != 0 && !inputs[i].matrix.indices32)
+        {
+            for (uint64_t j = 0; j < num_inputs; ++j)
+            {
+                if (set_index_width(&inputs[j].matrix, false) != 0)
+                {
+                    fprintf(stderr, "Memory allocation failed for the 64-bit indices\n");
+                    return -1;
+                }
+            }
+
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// multiplies with one of the versions that work on ELLPACK inputs (all but 7)
+void batch_multiply(int version, const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, ELLPACKMatrix *result, int num_threads, AccumulatorType accumulator)
+{
+    switch (version)
+    {
+    case 0:
+        matr_mult_ellpack(matrix_a, matrix_b, result);
+        break;
+    case 1:
+        matr_mult_ellpack_V1(matrix_a, matrix_b, result);
+        break;
+    case 2:
+        matr_mult_ellpack_V2(matrix_a, matrix_b, result);
+        break;
+    case 3:
+        matr_mult_ellpack_V3(matrix_a, matrix_b, result, num_threads);
+        break;
+    case 4:
+        matr_mult_ellpack_V4(matrix_a, matrix_b, result, num_threads, accumulator);
+        break;
+    case 5:
+        matr_mult_ellpack_V5(matrix_a, matrix_b, result, num_threads);
+        break;
+    case 6:
+        matr_mult_ellpack_V6(matrix_a, matrix_b, result, num_threads);
+        break;
+    case 9:
+        matr_mult_ellpack_V9(matrix_a, matrix_b, result, num_threads);
+        break;
+    default:
+        matr_mult_ellpack_V8(matrix_a, matrix_b, result, num_threads);
+        break;
+    }
+}
+
+// computes and writes the products [begin, end), the result of a product is freed before the next one starts
+static void run_jobs(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    BatchContext *ctx = (BatchContext *)context;
+    const BatchOptions *options = ctx->options;
+
+    for (uint64_t i = begin; i < end; ++i)
+    {
+        BatchJob *job = &ctx->jobs[i];
+        const ELLPACKMatrix *matrix_a = &ctx->inputs[job->input_a].matrix;
+        const ELLPACKMatrix *matrix_b = &ctx->inputs[job->input_b].matrix;
+        AccumulatorType accumulator = options->accumulator;
+        double start = benchmark_now();
+
+        // the kernels end the process on these errors, a batch only skips the product
+        if (matrix_a->num_cols != matrix_b->num_rows)
+        {
+            fprintf(stderr, "Matrix dimensions of %s and %s do not match for multiplication\n", ctx->inputs[job->input_a].filename, ctx->inputs[job->input_b].filename);
+            continue;
+        }
+
+        job->version = options->version;
+
+        if (job->version == VERSION_AUTO)
+        {
+            KernelChoice choice;
+
+            if (select_kernel(matrix_a, matrix_b, ctx->kernel_threads, &choice) != 0)
+            {
+                fprintf(stderr, "Memory allocation failed for the kernel selection\n");
+                continue;
+            }
+
+            job->version = choice.version;
+            accumulator = options->accumulator_set ? options->accumulator : choice.accumulator;
+        }
+
+        ELLPACKMatrix result = {0};
+        batch_multiply(job->version, matrix_a, matrix_b, &result, ctx->kernel_threads, accumulator);
+        job->status = write_result_matrix(job->output, &result, job->version, ctx->kernel_threads);
+        free_matrix(&result);
+        job->seconds = benchmark_now() - start;
+    }
+}
+
+/*
+Runs all products of a manifest in one process. Every distinct input file is read and checked once and stays in memory
+until the end, up to options->num_jobs products run at the same time. Returns the number of failed products, or -1 if
+the manifest or an input could not be read.
+*/
+int run_batch(const char *manifest, const BatchOptions *options)
+{
+    BatchJob *jobs = NULL;
+    const char **names = NULL;
+    BatchInput *inputs = NULL;
+    uint64_t num_jobs = 0, num_inputs = 0;
+    int status = -1;
+    double start = benchmark_now();
+
+    char *text = read_manifest(manifest);
+
+    if (!text || parse_manifest(manifest, text, &jobs, &names, &num_jobs) != 0)
+    {
+        goto free_batch;
+    }
+
+    // the distinct input names, sorted so that every job finds its inputs by binary search
+    const char **distinct = (const char **)malloc((2 * num_jobs + 1) * sizeof(char *));
+
+    if (!distinct)
+    {
+        fprintf(stderr, "Memory allocation failed for the batch jobs\n");
+        goto free_batch;
+    }
+
+    memcpy((void *)distinct, (const void *)names, 2 * num_jobs * sizeof(char *));
+    qsort((void *)distinct, 2 * num_jobs, sizeof(char *), compare_names);
+
+    for (uint64_t i = 0; i < 2 * num_jobs; ++i)
+    {
+        if (num_inputs == 0 || strcmp(distinct[num_inputs - 1], distinct[i]) != 0)
+        {
+            distinct[num_inputs++] = distinct[i];
+        }
+    }
+
+    inputs = (BatchInput *)calloc(num_inputs + 1, sizeof(BatchInput));
+
+    if (!inputs)
+    {
+        free((void *)distinct);
+        fprintf(stderr, "Memory allocation failed for the batch jobs\n");
+        goto free_batch;
+    }
+
+    for (uint64_t i = 0; i < num_inputs; ++i)
+    {
+        inputs[i].filename = distinct[i];
+    }
+
+    for (uint64_t i = 0; i < num_jobs; ++i)
+    {
+        jobs[i].input_a = (uint64_t)((const char **)bsearch(&names[2 * i], (const void *)distinct, num_inputs, sizeof(char *), compare_names) - distinct);
+        jobs[i].input_b = (uint64_t)((const char **)bsearch(&names[2 * i + 1], (const void *)distinct, num_inputs, sizeof(char *), compare_names) - distinct);
+    }
+
+    free((void *)distinct);
+
+    int num_parallel_jobs = options->num_jobs < 1 ? 1 : options->num_jobs;
+    BatchContext ctx = {options, inputs, jobs, options->num_threads / num_parallel_jobs};
+
+    if (ctx.kernel_threads < 1)
+    {
+        ctx.kernel_threads = 1;
+    }
+
+    // every input is parsed once, several files at the same time
+    if (batch_read_inputs(inputs, num_inputs, options->num_threads, options->compact_indices) != 0)
+    {
+        fprintf(stderr, "Error reading the inputs of batch %s\n", manifest);
+        goto free_batch;
+    }
+
+    double parse_seconds = benchmark_now() - start;
+
+    if (parallel_for(num_parallel_jobs, num_jobs, run_jobs, &ctx) != 0)
+    {
+        fprintf(stderr, "Error starting the batch jobs\n");
+        goto free_batch;
+    }
+
+    status = 0;
+
+    for (uint64_t i = 0; i < num_jobs; ++i)
+    {
+        if (jobs[i].status != 0)
+        {
+            fprintf(stderr, "Batch job %lu failed: %s x %s -> %s\n", (unsigned long)i + 1, names[2 * i], names[2 * i + 1], jobs[i].output);
+            status++;
+            continue;
+        }
+
+        fprintf(stdout, "Batch job %lu: %s x %s -> %s (V%d): %f seconds\n", (unsigned long)i + 1, names[2 * i], names[2 * i + 1], jobs[i].output, jobs[i].version, jobs[i].seconds);
+    }
+
+    fprintf(stdout, "Batch: %lu products from %lu input files, parsing %f seconds, total %f seconds\n",
+            (unsigned long)num_jobs, (unsigned long)num_inputs, parse_seconds, benchmark_now() - start);
+
+free_batch:
+    for (uint64_t i = 0; inputs && i < num_inputs; ++i)
+    {
+        free_matrix(&inputs[i].matrix);
+    }
+
+    free(inputs);
+    free((void *)names);
+    free(jobs);
+    free(text);
+    return status;
+}
@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "benchmark.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *phase_names[NUM_PHASES] = {"parse", "control_indices", "reorder", "multiply", "write"};
+
+// monotonic wall clock time in seconds
+double benchmark_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+const char *benchmark_phase_name(BenchmarkPhase phase)
+{
+    return phase_names[phase];
+}
+
+int phase_times_add(PhaseTimes *times, double seconds)
+{
+    if (times->num_samples == times->capacity)
+    {
+        int capacity = times->capacity ? 2 * times->capacity : 8;
+        double *samples = (double *)realloc(times->samples, capacity * sizeof(double));
+
+        if (!samples)
+        {
+            return -1;
+        }
+
+        times->samples = samples;
+        times->capacity = capacity;
+    }
+
+    times->samples[times->num_samples++] = seconds;
+    return 0;
+}
+
+void phase_times_free(PhaseTimes *times)
+{
+    free(times->samples);
+    memset(times, 0, sizeof(*times));
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// min, median, 95th percentile (nearest rank), max and mean of the samples, all zero if there are none
+int phase_times_stats(const PhaseTimes *times, PhaseStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    int n = times->num_samples;
+
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    double *sorted = (double *)malloc(n * sizeof(double));
+
+    if (!sorted)
+    {
+        return -1;
+    }
+
+    memcpy(sorted, times->samples, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), compare_doubles);
+
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        sum += sorted[i];
+    }
+
+    stats->min = sorted[0];
+    stats->median = n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+    stats->p95 = sorted[(95 * n + 99) / 100 - 1];
+    stats->max = sorted[n - 1];
+    stats->mean = sum / n;
+
+    free(sorted);
+    return 0;
+}
+
+// writes str as a JSON string literal
+static void write_json_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+
+    for (; *str; str++)
+    {
+        unsigned char c = (unsigned char)*str;
+
+        if (c == '"' || c == '\\')
+        {
+            fprintf(file, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(file, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+// writes the run description and the statistics and raw samples of every phase as one JSON object
+int benchmark_write_json(FILE *file, const BenchmarkInfo *info, const PhaseTimes times[NUM_PHASES])
+{
+    fprintf(file, "{\n  \"version\": %d,\n  \"threads\": %d,\n  \"accumulator\": ", info->version, info->num_threads);
+    write_json_string(file, info->accumulator);
+    fprintf(file, ",\n  \"input_a\": ");
+    write_json_string(file, info->input_a);
+    fprintf(file, ",\n  \"input_b\": ");
+    write_json_string(file, info->input_b);
+    fprintf(file, ",\n  \"warmup\": %d,\n  \"iterations\": %d,\n  \"phases\": {\n", info->warmup, info->iterations);
+
+    for (int phase = 0; phase < NUM_PHASES; phase++)
+    {
+        PhaseStats stats;
+
+        if (phase_times_stats(&times[phase], &stats) != 0)
+        {
+            return -1;
+        }
+
+        fprintf(file, "    \"%s\": {\"min\": %.9g, \"median\": %.9g, \"p95\": %.9g, \"max\": %.9g, \"mean\": %.9g, \"samples\": [",
+                phase_names[phase], stats.min, stats.median, stats.p95, stats.max, stats.mean);
+
+        for (int i = 0; i < times[phase].num_samples; i++)
+        {
+            fprintf(file, "%s%.9g", i ? ", " : "", times[phase].samples[i]);
+        }
+
+        fprintf(file, "]}%s\n", phase + 1 < NUM_PHASES ? "," : "");
+    }
+
+    fprintf(file, "  }\n}\n");
+    return ferror(file) ? -1 : 0;
+}
@@ -0,0 +1,341 @@
+#include "chain.h"
+#include "batch.h"
+#include "matrix_io.h"
+#include "benchmark.h"
+#include "autoselect.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// estimated shape of the product of a part of the chain
+typedef struct
+{
+    double rows;
+    double cols;
+    double non_zero;
+} ChainShape;
+
+/*
+Order of the products: the product of the inputs i..j is (i..k) x (k+1..j) with k = split[i * num_inputs + j]. cost is
+the estimated work of a part (multiply-adds plus the entries of every product it builds), shape its estimated result.
+*/
+typedef struct
+{
+    const ChainOptions *options;
+    BatchInput *inputs;
+    int num_inputs;
+    int *split;
+    double *cost;
+    ChainShape *shape;
+    double *pair_flops; // exact multiply-adds of inputs i x (i + 1), from the row lengths of i + 1
+    int num_products;
+} ChainPlan;
+
+// every entry of the left factor meets a row of the right one, on average right.non_zero / right.rows entries long
+static double estimate_flops(ChainShape left, ChainShape right)
+{
+    return right.rows > 0.0 ? left.non_zero * right.non_zero / right.rows : 0.0;
+}
+
+// the multiply-adds of a row hit random columns of its result row, the ones that meet in a column add up to one entry
+static ChainShape estimate_product(ChainShape left, ChainShape right, double flops)
+{
+    double cells = left.rows * right.cols;
+    ChainShape product = {left.rows, right.cols, 0.0};
+
+    product.non_zero = cells > 0.0 ? -cells * expm1(-flops / cells) : 0.0;
+    return product;
+}
+
+// shapes of the inputs and the exact multiply-adds of neighbouring inputs
+static int plan_inputs(ChainPlan *plan)
+{
+    for (int i = 0; i < plan->num_inputs; ++i)
+    {
+        const ELLPACKMatrix *matrix = &plan->inputs[i].matrix;
+        uint64_t *row_length = count_row_lengths(matrix);
+
+        if (!row_length)
+        {
+            return -1;
+        }
+
+        ChainShape *shape = &plan->shape[i * plan->num_inputs + i];
+        *shape = (ChainShape){(double)matrix->num_rows, (double)matrix->num_cols, 0.0};
+
+        for (uint64_t row = 0; row < matrix->num_rows; ++row)
+        {
+            shape->non_zero += (double)row_length[row];
+        }
+
+        // every non-zero entry (row, k) of the left neighbour meets the non-zero entries of row k
+        if (i > 0)
+        {
+            const ELLPACKMatrix *left = &plan->inputs[i - 1].matrix;
+
+            for (uint64_t j = 0; j < left->num_rows * left->num_non_zero; ++j)
+            {
+                uint64_t row = ellpack_index(left, j);
+
+                if (left->values[j] != 0.0f && row < matrix->num_rows)
+                {
+                    plan->pair_flops[i - 1] += (double)row_length[row];
+                }
+            }
+        }
+
+        free(row_length);
+    }
+
+    return 0;
+}
+
+/*
+Matrix chain ordering by dynamic programming over the parts i..j of the chain, shortest parts first. The nnz of the
+intermediates are only estimates, so the order is the cheapest one under the model, not necessarily the fastest.
+*/
+static void plan_order(ChainPlan *plan)
+{
+    int n = plan->num_inputs;
+
+    for (int length = 2; length <= n; ++length)
+    {
+        for (int i = 0; i + length - 1 < n; ++i)
+        {
+            int j = i + length - 1;
+            double *best = &plan->cost[i * n + j];
+            *best = INFINITY;
+
+            for (int k = i; k < j; ++k)
+            {
+                ChainShape left = plan->shape[i * n + k];
+                ChainShape right = plan->shape[(k + 1) * n + j];
+                double flops = length == 2 ? plan->pair_flops[i] : estimate_flops(left, right);
+                ChainShape product = estimate_product(left, right, flops);
+                double cost = plan->cost[i * n + k] + plan->cost[(k + 1) * n + j] + flops + product.non_zero;
+
+                if (cost < *best)
+                {
+                    *best = cost;
+                    plan->split[i * n + j] = k;
+                    plan->shape[i * n + j] = product;
+                }
+            }
+        }
+    }
+}
+
+// estimated work of multiplying the chain from left to right, to compare the chosen order with
+static double left_to_right_cost(const ChainPlan *plan)
+{
+    int n = plan->num_inputs;
+    ChainShape product = plan->shape[0];
+    double cost = 0.0;
+
+    for (int j = 1; j < n; ++j)
+    {
+        double flops = j == 1 ? plan->pair_flops[0] : estimate_flops(product, plan->shape[j * n + j]);
+        product = estimate_product(product, plan->shape[j * n + j], flops);
+        cost += flops + product.non_zero;
+    }
+
+    return cost;
+}
+
+// writes the order of the part first..last with parentheses, returns the end of the text
+static char *format_order(const ChainPlan *plan, int first, int last, char *pos)
+{
+    if (first == last)
+    {
+        size_t length = strlen(plan->inputs[first].filename);
+        memcpy(pos, plan->inputs[first].filename, length);
+        return pos + length;
+    }
+
+    int k = plan->split[first * plan->num_inputs + last];
+
+    *pos++ = '(';
+    pos = format_order(plan, first, k, pos);
+    memcpy(pos, " x ", 3);
+    pos = format_order(plan, k + 1, last, pos + 3);
+    *pos++ = ')';
+    return pos;
+}
+
+/*
+Computes the product of the inputs first..last into result, in the order of the plan. The intermediates are turned into
+input matrices in memory and freed as soon as they are multiplied; the product of the whole chain keeps the layout of
+its version, which is returned in version for the writer.
+*/
+static int evaluate(ChainPlan *plan, int first, int last, ELLPACKMatrix *result, int *version)
+{
+    const ChainOptions *options = plan->options;
+
+    if (first == last)
+    {
+        *result = plan->inputs[first].matrix;
+        plan->inputs[first].matrix = (ELLPACKMatrix){0};
+        return 0;
+    }
+
+    int k = plan->split[first * plan->num_inputs + last];
+    ELLPACKMatrix left = {0}, right = {0};
+    AccumulatorType accumulator = options->accumulator;
+
+    if (evaluate(plan, first, k, &left, version) != 0 || evaluate(plan, k + 1, last, &right, version) != 0)
+    {
+        goto free_factors;
+    }
+
+    // an intermediate keeps 32-bit indices whenever its columns fit, the kernels need one width for both factors
+    if ((left.indices32 != NULL) != (right.indices32 != NULL))
+    {
+        if (set_index_width(&left, false) != 0 || set_index_width(&right, false) != 0)
+        {
+            fprintf(stderr, "Memory allocation failed for the 64-bit indices\n");
+            goto free_factors;
+        }
+    }
+
+    *version = options->version;
+
+    if (*version == VERSION_AUTO)
+    {
+        KernelChoice choice;
+
+        if (select_kernel(&left, &right, options->num_threads, &choice) != 0)
+        {
+            fprintf(stderr, "Memory allocation failed for the kernel selection\n");
+            goto free_factors;
+        }
+
+        *version = choice.version;
+        accumulator = options->accumulator_set ? options->accumulator : choice.accumulator;
+    }
+
+    double start = benchmark_now();
+    batch_multiply(*version, &left, &right, result, options->num_threads, accumulator);
+    free_matrix(&left);
+    free_matrix(&right);
+
+    bool whole_chain = first == 0 && last == plan->num_inputs - 1;
+
+    if (!whole_chain && result_to_input(result, options->compact_indices) != 0)
+    {
+        return -1;
+    }
+
+    fprintf(stdout, "Chain product %d: inputs %d..%d (%lu x %lu, V%d): %f seconds\n", ++plan->num_products, first + 1, last + 1,
+            (unsigned long)result->num_rows, (unsigned long)result->num_cols, *version, benchmark_now() - start);
+    return 0;
+
+free_factors:
+    free_matrix(&left);
+    free_matrix(&right);
+    return -1;
+}
+
+/*
+Multiplies a chain of matrices inputs[0] x inputs[1] x ... and writes the product to output. The order of the products
+is chosen by dynamic programming from the estimated non-zero values of the intermediates, which stay in memory instead
+of being written and parsed again. Returns -1 if an input could not be read, the dimensions do not match or memory is
+missing.
+*/
+int run_chain(char *const *filenames, int num_inputs, const char *output, const ChainOptions *options)
+{
+    int n = num_inputs;
+    int status = -1;
+    double start = benchmark_now();
+    ChainPlan plan = {options, NULL, n, NULL, NULL, NULL, NULL, 0};
+    char *order = NULL;
+
+    plan.inputs = (BatchInput *)calloc((size_t)n, sizeof(BatchInput));
+    plan.split = (int *)calloc((size_t)n * (size_t)n, sizeof(int));
+    plan.cost = (double *)calloc((size_t)n * (size_t)n, sizeof(double));
+    plan.shape = (ChainShape *)calloc((size_t)n * (size_t)n, sizeof(ChainShape));
+    plan.pair_flops = (double *)calloc((size_t)n, sizeof(double));
+
+    size_t order_length = 1;
+
+    for (int i = 0; i < n; ++i)
+    {
+        order_length += strlen(filenames[i]) + 5;
+    }
+
+    order = (char *)malloc(order_length);
+
+    if (!plan.inputs || !plan.split || !plan.cost || !plan.shape || !plan.pair_flops || !order)
+    {
+        fprintf(stderr, "Memory allocation failed for the chain\n");
+        goto free_chain;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        plan.inputs[i].filename = filenames[i];
+    }
+
+    if (batch_read_inputs(plan.inputs, (uint64_t)n, options->num_threads, options->compact_indices) != 0)
+    {
+        fprintf(stderr, "Error reading the inputs of the chain\n");
+        goto free_chain;
+    }
+
+    // the kernels end the process on a mismatch, the chain is checked before anything is computed
+    for (int i = 0; i + 1 < n; ++i)
+    {
+        if (plan.inputs[i].matrix.num_cols != plan.inputs[i + 1].matrix.num_rows)
+        {
+            fprintf(stderr, "Matrix dimensions of %s and %s do not match for multiplication\n", filenames[i], filenames[i + 1]);
+            goto free_chain;
+        }
+    }
+
+    if (plan_inputs(&plan) != 0)
+    {
+        fprintf(stderr, "Memory allocation failed for the chain\n");
+        goto free_chain;
+    }
+
+    plan_order(&plan);
+    *format_order(&plan, 0, n - 1, order) = '\0';
+
+    fprintf(stdout, "Chain order: %s\n", order);
+    fprintf(stdout, "Chain estimated work: %.3g (left to right: %.3g), parsing %f seconds\n", plan.cost[n - 1], left_to_right_cost(&plan), benchmark_now() - start);
+
+    ELLPACKMatrix result = {0};
+    int version = 0;
+
+    if (evaluate(&plan, 0, n - 1, &result, &version) != 0)
+    {
+        free_matrix(&result);
+        goto free_chain;
+    }
+
+    double write_start = benchmark_now();
+    status = write_result_matrix(output, &result, version, options->num_threads);
+    free_matrix(&result);
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Error writing output matrix %s\n", output);
+        goto free_chain;
+    }
+
+    fprintf(stdout, "Chain: %d matrices, writing %f seconds, total %f seconds\n", n, benchmark_now() - write_start, benchmark_now() - start);
+
+free_chain:
+    for (int i = 0; plan.inputs && i < n; ++i)
+    {
+        free_matrix(&plan.inputs[i].matrix);
+    }
+
+    free(plan.inputs);
+    free(plan.split);
+    free(plan.cost);
+    free(plan.shape);
+    free(plan.pair_flops);
+    free(order);
+    return status;
+}
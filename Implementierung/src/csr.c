@@ -0,0 +1,175 @@
+#include "csr.h"
+#include "parallel.h"
+#include <stdlib.h>
+#include <string.h>
+
+void free_csr(CSRMatrix *csr)
+{
+    free(csr->row_ptr);
+    free(csr->values);
+    free(csr->indices);
+    free(csr->indices32);
+    memset(csr, 0, sizeof(*csr));
+}
+
+typedef struct
+{
+    const ELLPACKMatrix *matrix;
+    CSRMatrix *csr;
+} ConvertContext;
+
+// counts the non-zero entries of the rows [begin, end) into row_ptr[row + 1]
+static void count_rows(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    ConvertContext *ctx = (ConvertContext *)context;
+    const ELLPACKMatrix *matrix = ctx->matrix;
+
+    for (uint64_t row = begin; row < end; ++row)
+    {
+        const float *row_values = matrix->values + row * matrix->num_non_zero;
+        uint64_t cnt_non_zero = 0;
+
+        for (uint64_t j = 0; j < matrix->num_non_zero; ++j)
+        {
+            cnt_non_zero += row_values[j] != 0.0f;
+        }
+
+        ctx->csr->row_ptr[row + 1] = cnt_non_zero;
+    }
+}
+
+// copies the entries of the rows [begin, end) in the order of the file, the thread touches their pages first
+ALWAYS_INLINE void fill_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    ConvertContext *ctx = (ConvertContext *)context;
+    const ELLPACKMatrix *matrix = ctx->matrix;
+    CSRMatrix *csr = ctx->csr;
+    uint64_t pos = csr->row_ptr[begin];
+
+    for (uint64_t i = begin * matrix->num_non_zero; i < end * matrix->num_non_zero; ++i)
+    {
+        if (matrix->values[i] == 0.0f)
+        {
+            continue;
+        }
+
+        csr->values[pos] = matrix->values[i];
+
+        if (compact)
+        {
+            csr->indices32[pos] = matrix->indices32[i];
+        }
+        else
+        {
+            csr->indices[pos] = matrix->indices[i];
+        }
+
+        pos++;
+    }
+}
+
+INDEX_WIDTH_TASKS(fill_rows)
+
+/*
+Converts an ELLPACK input matrix to CSR. Only the non-zero values are kept, the '*' padding and explicit zeros are
+dropped. The indices keep the width of the ELLPACK matrix. Counting and copying are split by rows like the kernels,
+so in the NUMA mode the rows of the CSR matrix are on the node of the thread that computes them.
+Returns -1 if memory is missing.
+*/
+int ellpack_to_csr(const ELLPACKMatrix *matrix, CSRMatrix *csr, int num_threads)
+{
+    memset(csr, 0, sizeof(*csr));
+    csr->num_rows = matrix->num_rows;
+    csr->num_cols = matrix->num_cols;
+
+    bool compact = matrix->indices32 != NULL;
+    ConvertContext ctx = {matrix, csr};
+    csr->row_ptr = (uint64_t *)malloc((matrix->num_rows + 1) * sizeof(uint64_t));
+
+    if (!csr->row_ptr || parallel_for(num_threads, matrix->num_rows, count_rows, &ctx) != 0)
+    {
+        free_csr(csr);
+        return -1;
+    }
+
+    // the counts become the row offsets
+    csr->row_ptr[0] = 0;
+
+    for (uint64_t row = 0; row < matrix->num_rows; ++row)
+    {
+        csr->row_ptr[row + 1] += csr->row_ptr[row];
+    }
+
+    // at least one element, so that a NULL pointer always means "not allocated"
+    uint64_t total_non_zero = csr->row_ptr[matrix->num_rows];
+    uint64_t allocated = total_non_zero ? total_non_zero : 1;
+
+    csr->values = (float *)malloc(allocated * sizeof(float));
+
+    if (compact)
+    {
+        csr->indices32 = (uint32_t *)malloc(allocated * sizeof(uint32_t));
+    }
+    else
+    {
+        csr->indices = (uint64_t *)malloc(allocated * sizeof(uint64_t));
+    }
+
+    if (!csr->values || (!csr->indices && !csr->indices32) ||
+        parallel_for(num_threads, matrix->num_rows, compact ? fill_rows_32 : fill_rows_64, &ctx) != 0)
+    {
+        free_csr(csr);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+Hands the arrays of a CSR matrix over to an ELLPACK matrix with compressed rows (row_ptr), which write_matrix_V3
+pads while writing. num_non_zero becomes the longest row. 32-bit indices are widened, as the writers expect 64 bits.
+csr is empty afterwards. Returns -1 if memory is missing (csr is unchanged then).
+*/
+int csr_to_ellpack(CSRMatrix *csr, ELLPACKMatrix *matrix)
+{
+    uint64_t total_non_zero = csr->row_ptr[csr->num_rows];
+
+    if (csr->indices32)
+    {
+        csr->indices = (uint64_t *)malloc((total_non_zero ? total_non_zero : 1) * sizeof(uint64_t));
+
+        if (!csr->indices)
+        {
+            return -1;
+        }
+
+        for (uint64_t i = 0; i < total_non_zero; ++i)
+        {
+            csr->indices[i] = csr->indices32[i];
+        }
+
+        free(csr->indices32);
+        csr->indices32 = NULL;
+    }
+
+    memset(matrix, 0, sizeof(*matrix));
+    matrix->num_rows = csr->num_rows;
+    matrix->num_cols = csr->num_cols;
+    matrix->row_ptr = csr->row_ptr;
+    matrix->values = csr->values;
+    matrix->indices = csr->indices;
+
+    for (uint64_t row = 0; row < csr->num_rows; ++row)
+    {
+        uint64_t cnt_non_zero = csr->row_ptr[row + 1] - csr->row_ptr[row];
+
+        if (cnt_non_zero > matrix->num_non_zero)
+        {
+            matrix->num_non_zero = cnt_non_zero;
+        }
+    }
+
+    memset(csr, 0, sizeof(*csr));
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include "format.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// powers of ten that are exact in double precision
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static const uint64_t integer_powers_of_ten[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL};
+
+// value * 10^exponent (only approximate for |exponent| > 22, the candidates are verified anyway)
+static double scale_by_power_of_ten(double value, int exponent)
+{
+    while (exponent > 22)
+    {
+        value *= 1e22;
+        exponent -= 22;
+    }
+
+    while (exponent < -22)
+    {
+        value /= 1e22;
+        exponent += 22;
+    }
+
+    return exponent >= 0 ? value * exact_powers_of_ten[exponent] : value / exact_powers_of_ten[-exponent];
+}
+
+// writes digits * 10^exponent (digits has num_digits digits, no trailing zeros) in plain or scientific notation
+static int write_decimal(char *buffer, uint64_t digits, int num_digits, int exponent)
+{
+    char digit_text[16];
+    int length = 0;
+    int point = num_digits + exponent; // position of the decimal point behind the first digit of digit_text
+
+    for (int i = num_digits - 1; i >= 0; --i)
+    {
+        digit_text[i] = (char)('0' + digits % 10);
+        digits /= 10;
+    }
+
+    if (point > 0 && point <= 9)
+    {
+        // 123.45 or 12300
+        for (int i = 0; i < num_digits || i < point; ++i)
+        {
+            if (i == point)
+            {
+                buffer[length++] = '.';
+            }
+            buffer[length++] = i < num_digits ? digit_text[i] : '0';
+        }
+    }
+    else if (point <= 0 && point > -5)
+    {
+        // 0.00123
+        buffer[length++] = '0';
+        buffer[length++] = '.';
+        for (int i = 0; i < -point; ++i)
+        {
+            buffer[length++] = '0';
+        }
+        memcpy(buffer + length, digit_text, num_digits);
+        length += num_digits;
+    }
+    else
+    {
+        // 1.23e-07
+        buffer[length++] = digit_text[0];
+        if (num_digits > 1)
+        {
+            buffer[length++] = '.';
+            memcpy(buffer + length, digit_text + 1, num_digits - 1);
+            length += num_digits - 1;
+        }
+        length += sprintf(buffer + length, "e%+03d", point - 1);
+    }
+
+    return length;
+}
+
+/*
+True if digits * 10^exponent reads back as value. For |exponent| <= 22 the double result is rounded once,
+so rounding it to float is exact unless it lies on the midpoint of two floats. Everything else uses strtof.
+*/
+static bool round_trips(float value, uint64_t digits, int num_digits, int exponent)
+{
+    if (exponent >= -22 && exponent <= 22)
+    {
+        double result = exponent < 0 ? (double)digits / exact_powers_of_ten[-exponent] : (double)digits * exact_powers_of_ten[exponent];
+        uint64_t bits;
+        memcpy(&bits, &result, sizeof(bits));
+
+        if (result >= 1.17549435e-38 && (bits & 0x1FFFFFFF) != 0x10000000)
+        {
+            return (float)result == value;
+        }
+    }
+
+    char text[FORMAT_MAX_LENGTH + 1];
+    text[write_decimal(text, digits, num_digits, exponent)] = '\0';
+    return strtof(text, NULL) == value;
+}
+
+// writes the shortest decimal text that reads back as exactly the same float and returns its length
+int format_float(char *buffer, float value)
+{
+    int length = 0;
+
+    if (value != value)
+    {
+        memcpy(buffer, "nan", 3);
+        return 3;
+    }
+
+    if (value < 0.0f)
+    {
+        buffer[length++] = '-';
+        value = -value;
+    }
+
+    if (value == 0.0f)
+    {
+        buffer[length++] = '0';
+        return length;
+    }
+
+    if (value > 3.40282347e38f)
+    {
+        memcpy(buffer + length, "inf", 3);
+        return length + 3;
+    }
+
+    // decimal exponent of the first digit, estimated from the binary exponent (log10(2) ~ 1233 / 4096)
+    double exact = value;
+    uint64_t bits;
+    memcpy(&bits, &exact, sizeof(bits));
+    int binary_exponent = (int)((bits >> 52) & 0x7FF) - 1023;
+    int decimal_exponent = (binary_exponent * 1233) >> 12;
+
+    if (scale_by_power_of_ten(exact, -decimal_exponent) >= 10.0)
+    {
+        decimal_exponent++;
+    }
+
+    // try 1 to 9 significant digits, 9 always round-trip for float
+    for (int num_digits = 1; num_digits <= 9; ++num_digits)
+    {
+        int exponent = decimal_exponent - num_digits + 1;
+        double scaled = scale_by_power_of_ten(exact, -exponent);
+        uint64_t digits = (uint64_t)(scaled + 0.5);
+
+        if (digits >= integer_powers_of_ten[num_digits])
+        {
+            digits /= 10;
+            exponent++;
+        }
+
+        if (!round_trips(value, digits, num_digits, exponent))
+        {
+            continue;
+        }
+
+        // drop trailing zeros (1.50 -> 1.5)
+        int used_digits = num_digits;
+        while (used_digits > 1 && digits % 10 == 0)
+        {
+            digits /= 10;
+            exponent++;
+            used_digits--;
+        }
+
+        return length + write_decimal(buffer + length, digits, used_digits, exponent);
+    }
+
+    // rounding in the scaling can miss all candidates in rare cases, %.9g is always exact
+    return length + snprintf(buffer + length, FORMAT_MAX_LENGTH - length, "%.9g", value);
+}
+
+int format_uint64(char *buffer, uint64_t value)
+{
+    char digits[20];
+    int num_digits = 0;
+
+    do
+    {
+        digits[num_digits++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    for (int i = 0; i < num_digits; ++i)
+    {
+        buffer[i] = digits[num_digits - 1 - i];
+    }
+
+    return num_digits;
+}
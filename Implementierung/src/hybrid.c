@@ -0,0 +1,249 @@
+#include "hybrid.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void free_hybrid(HybridMatrix *hybrid)
+{
+    free(hybrid->values);
+    free(hybrid->indices);
+    free(hybrid->indices32);
+    free(hybrid->coo_ptr);
+    free(hybrid->coo_values);
+    free(hybrid->coo_indices);
+    free(hybrid->coo_indices32);
+    memset(hybrid, 0, sizeof(*hybrid));
+}
+
+// the row length at the given percentile (nearest rank) from a histogram of the lengths 0..max_length
+uint64_t hybrid_width(const uint64_t *row_length, uint64_t num_rows, uint64_t max_length, unsigned percentile)
+{
+    uint64_t *histogram = (uint64_t *)calloc(max_length + 1, sizeof(uint64_t));
+
+    // without the histogram the matrix stays a plain ELLPACK matrix
+    if (!histogram || num_rows == 0)
+    {
+        free(histogram);
+        return max_length;
+    }
+
+    for (uint64_t row = 0; row < num_rows; ++row)
+    {
+        histogram[row_length[row]]++;
+    }
+
+    uint64_t rank = (num_rows * percentile + 99) / 100;
+    uint64_t width = 0;
+
+    for (uint64_t count = histogram[0]; count < rank; count += histogram[width])
+    {
+        width++;
+    }
+
+    free(histogram);
+    return width;
+}
+
+/*
+Allocates the ELLPACK part (hybrid->width, num_rows, num_cols must be set) and the tail for the given row lengths,
+the padding is zeroed. Returns -1 if memory is missing.
+*/
+int hybrid_alloc(HybridMatrix *hybrid, const uint64_t *row_length, bool compact)
+{
+    uint64_t num_slots = hybrid->num_rows * hybrid->width;
+    hybrid->coo_ptr = (uint64_t *)malloc((hybrid->num_rows + 1) * sizeof(uint64_t));
+
+    if (!hybrid->coo_ptr)
+    {
+        return -1;
+    }
+
+    hybrid->coo_ptr[0] = 0;
+
+    for (uint64_t row = 0; row < hybrid->num_rows; ++row)
+    {
+        hybrid->coo_ptr[row + 1] = hybrid->coo_ptr[row] + (row_length[row] > hybrid->width ? row_length[row] - hybrid->width : 0);
+    }
+
+    uint64_t num_coo = hybrid->coo_ptr[hybrid->num_rows];
+
+    // at least one element, so that a NULL pointer always means "not allocated"
+    hybrid->values = (float *)calloc(num_slots ? num_slots : 1, sizeof(float));
+    hybrid->coo_values = (float *)malloc((num_coo ? num_coo : 1) * sizeof(float));
+
+    if (compact)
+    {
+        hybrid->indices32 = (uint32_t *)calloc(num_slots ? num_slots : 1, sizeof(uint32_t));
+        hybrid->coo_indices32 = (uint32_t *)malloc((num_coo ? num_coo : 1) * sizeof(uint32_t));
+    }
+    else
+    {
+        hybrid->indices = (uint64_t *)calloc(num_slots ? num_slots : 1, sizeof(uint64_t));
+        hybrid->coo_indices = (uint64_t *)malloc((num_coo ? num_coo : 1) * sizeof(uint64_t));
+    }
+
+    if (!hybrid->values || !hybrid->coo_values || (compact ? !hybrid->indices32 || !hybrid->coo_indices32 : !hybrid->indices || !hybrid->coo_indices))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// stores the length entries of a row: the first width into the ELLPACK part, the rest into the tail
+void hybrid_store_row(HybridMatrix *hybrid, uint64_t row, const float *values, const uint64_t *indices, uint64_t length)
+{
+    uint64_t row_begin = row * hybrid->width;
+    uint64_t coo_begin = hybrid->coo_ptr[row] - hybrid->width;
+
+    for (uint64_t j = 0; j < length; ++j)
+    {
+        if (j < hybrid->width)
+        {
+            hybrid->values[row_begin + j] = values[j];
+
+            if (hybrid->indices32)
+            {
+                hybrid->indices32[row_begin + j] = indices[j] < UINT32_MAX ? (uint32_t)indices[j] : UINT32_MAX;
+            }
+            else
+            {
+                hybrid->indices[row_begin + j] = indices[j];
+            }
+        }
+        else
+        {
+            hybrid->coo_values[coo_begin + j] = values[j];
+
+            if (hybrid->coo_indices32)
+            {
+                hybrid->coo_indices32[coo_begin + j] = indices[j] < UINT32_MAX ? (uint32_t)indices[j] : UINT32_MAX;
+            }
+            else
+            {
+                hybrid->coo_indices[coo_begin + j] = indices[j];
+            }
+        }
+    }
+}
+
+/*
+Converts an ELLPACK input matrix (e.g. a mapped binary file) into the hybrid format. The entries of a row end after its
+last non-zero value. The indices keep the width of the ELLPACK matrix. Returns -1 if memory is missing.
+*/
+int ellpack_to_hybrid(const ELLPACKMatrix *matrix, HybridMatrix *hybrid, unsigned percentile)
+{
+    memset(hybrid, 0, sizeof(*hybrid));
+    hybrid->num_rows = matrix->num_rows;
+    hybrid->num_cols = matrix->num_cols;
+
+    uint64_t *row_length = (uint64_t *)calloc(matrix->num_rows, sizeof(uint64_t));
+    uint64_t *row_indices = (uint64_t *)malloc((matrix->num_non_zero ? matrix->num_non_zero : 1) * sizeof(uint64_t));
+
+    if (!row_length || !row_indices)
+    {
+        free(row_length);
+        free(row_indices);
+        return -1;
+    }
+
+    for (uint64_t row = 0; row < matrix->num_rows; ++row)
+    {
+        uint64_t length = matrix->num_non_zero;
+
+        while (length > 0 && matrix->values[row * matrix->num_non_zero + length - 1] == 0.0f)
+        {
+            length--;
+        }
+
+        row_length[row] = length;
+    }
+
+    hybrid->width = hybrid_width(row_length, matrix->num_rows, matrix->num_non_zero, percentile);
+
+    if (hybrid_alloc(hybrid, row_length, matrix->indices32 != NULL) != 0)
+    {
+        free(row_length);
+        free(row_indices);
+        free_hybrid(hybrid);
+        return -1;
+    }
+
+    for (uint64_t row = 0; row < matrix->num_rows; ++row)
+    {
+        uint64_t row_begin = row * matrix->num_non_zero;
+
+        for (uint64_t j = 0; j < row_length[row]; ++j)
+        {
+            row_indices[j] = ellpack_index(matrix, row_begin + j);
+        }
+
+        hybrid_store_row(hybrid, row, matrix->values + row_begin, row_indices, row_length[row]);
+    }
+
+    free(row_length);
+    free(row_indices);
+    return 0;
+}
+
+/*
+Checks that every index is smaller than num_cols and appears only once in its row (ELLPACK part and tail together).
+The rows are marked with a generation counter, so the check is linear in the number of entries.
+*/
+int control_indices_hybrid(const char *filename, const HybridMatrix *hybrid)
+{
+    uint64_t *marker = (uint64_t *)calloc(hybrid->num_cols, sizeof(uint64_t));
+
+    if (!marker)
+    {
+        fprintf(stderr, "Memory allocation failed in control_indices. Filename: %s\n", filename);
+        return -1;
+    }
+
+    for (uint64_t row = 0; row < hybrid->num_rows; ++row)
+    {
+        uint64_t generation = row + 1;
+        uint64_t num_coo = hybrid->coo_ptr[row + 1] - hybrid->coo_ptr[row];
+
+        for (uint64_t j = 0; j < hybrid->width + num_coo; ++j)
+        {
+            uint64_t slot = j < hybrid->width ? row * hybrid->width + j : hybrid->coo_ptr[row] + j - hybrid->width;
+            float value = j < hybrid->width ? hybrid->values[slot] : hybrid->coo_values[slot];
+            uint64_t index;
+
+            // padding of the ELLPACK part
+            if (j < hybrid->width && value == 0.0f)
+            {
+                continue;
+            }
+
+            if (j < hybrid->width)
+            {
+                index = hybrid->indices32 ? hybrid->indices32[slot] : hybrid->indices[slot];
+            }
+            else
+            {
+                index = hybrid->coo_indices32 ? hybrid->coo_indices32[slot] : hybrid->coo_indices[slot];
+            }
+
+            if (index >= hybrid->num_cols)
+            {
+                free(marker);
+                fprintf(stderr, "Error: Index larger then cols (Index out of bound). Filename: %s\n", filename);
+                return -1;
+            }
+
+            if (marker[index] == generation)
+            {
+                free(marker);
+                fprintf(stderr, "Error: Double indices in row. Filename: %s\n", filename);
+                return -1;
+            }
+
+            marker[index] = generation;
+        }
+    }
+
+    free(marker);
+    return 0;
+}
@@ -1,22 +1,31 @@
-#define _POSIX_C_SOURCE 199309L
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <stdbool.h>
-#include <time.h>
 #include <errno.h>
 #include <string.h>
 
 #include "ellpack.h"
 #include "matrix_io.h"
-#include <unistd.h> // sleep
+#include "parallel.h"
+#include "stream.h"
+#include "benchmark.h"
+#include "perf.h"
+#include "hybrid.h"
+#include "autoselect.h"
+#include "batch.h"
+#include "chain.h"
+#include "reorder.h"
+#include "numa.h"
 
 // help and info messages
 const char *usage_msg =
 
     "Help Message (Usage): "
-    "./main [-h] [-V version] [-B[iterations]] -a inputA -b inputB -o output\n"
+    "./main [-h] [-V version] [-B[iterations]] [-W warmup] [-j json] [--perf] [--reorder] [--numa[=huge]] [-t threads] [-A accumulator] [-S budget] -a inputA -b inputB -o output\n"
+    "       ./main -c text|binary -a input -o output\n"
+    "       ./main --batch manifest [-J jobs] [-V version] [-t threads] [-A accumulator]\n"
+    "       ./main --chain [-V version] [-t threads] [-A accumulator] -o output input1 input2 [input3 ...]\n"
     "\n";
 
 const char *help_msg =
@@ -29,8 +38,28 @@ const char *help_msg =
     "\n"
     "Optional arguments:\n"
     "  -h, --help             Display this help message and exit\n"
-    "  -V, --version VERSION  Specify the version of the multiplication algorithm (default is 0)\n"
-    "  -B, --benchmark[N]     Run benchmark with N iterations (default is 3)\n"
+    "  -V, --version VERSION  Specify the version of the multiplication algorithm (default is 0, 6 is the SELL-C-sigma kernel, 7 the hybrid ELL+COO kernel, 8 the CSR kernel,\n"
+    "                         9 the kernel with column panels of B for wide matrices)\n"
+    "                         auto picks the kernel and accumulator from statistics of the inputs and prints its choice\n"
+    "  -B, --benchmark[N]     Run benchmark with N timed iterations of parsing, control_indices, multiplication and writing (default is 1)\n"
+    "  -W, --warmup N         Untimed runs of these phases before the benchmark (default is 0)\n"
+    "  -j, --json FILE        Write the times of parsing, control_indices, reordering, multiplication and writing as JSON to FILE\n"
+    "      --perf             Count cycles, instructions, LLC, branch and dTLB misses per phase (perf_event_open) and report GFLOP/s and GB/s\n"
+    "      --reorder          Renumber the rows of A and B (Cuthill-McKee order of A) so that rows of A that need the same rows of B\n"
+    "                         are computed together, the output is unchanged; the benchmark also runs in the original order\n"
+    "                         and the cost of the reordering is reported next to the speed-up\n"
+    "      --numa[=huge]      Pin the threads to the cores and place the inputs on the nodes of the threads that compute their rows,\n"
+    "                         versions 6 and 8 place their SELL and CSR copies of the inputs with the partitioning of their kernels\n"
+    "                         (version 7 is only pinned, versions 0 to 2 run on thread 0), huge also advises transparent huge pages for the large arrays\n"
+    "      --wide-indices     Keep 64-bit indices in versions 3 to 9 (they use 32-bit indices if the columns fit)\n"
+    "  -t, --threads N        Number of threads for the parallel versions 3 to 9 (default is the number of cores)\n"
+    "  -A, --accumulator TYPE Accumulator of version 4: dense or hash (hash for very wide, sparse B; default is dense)\n"
+    "  -S, --stream MB        Compute with version 4 in blocks of rows and write each block out at once, using at most about MB MiB\n"
+    "  -c, --convert FORMAT   Convert the matrix in -a to FORMAT (text or binary) and write it to -o\n"
+    "      --batch FILE       Compute all products of FILE (lines: inputA inputB output) in one process, every input is read once\n"
+    "  -J, --jobs N           Products computed at the same time in batch mode, the threads are split between them (default is 1)\n"
+    "      --chain            Multiply the inputs after the options as a chain, in the order with the least estimated work,\n"
+    "                         the intermediates stay in memory\n"
     "\n";
 
 const char *help_input_files_format =
@@ -47,6 +76,8 @@ const char *help_input_files_format =
     "0,*,1,*,0,1,3,*\n"
     "\n"
     "Lines 2 and 3 must contain the correct number of values\n"
+    "\n"
+    "Binary files (written by -c binary) are detected automatically and loaded without parsing.\n"
     "\n";
 
 
@@ -69,50 +100,6 @@ void print_help(const char *progname)
 }
 
 
-// function to free the allocated memory
-void free_matrix(ELLPACKMatrix *matrix)
-{
-    if (matrix)
-    {
-        if (matrix->values)
-        {
-            free(matrix->values);
-        }
-
-        if (matrix->indices)
-        {
-            free(matrix->indices);
-        }
-
-
-        if (matrix->result_values)
-        {
-                for (uint64_t i = 0; i < matrix->num_rows; i++)
-                {
-                    if(matrix->result_values[i])
-                    {
-                        free(matrix->result_values[i]);
-                    }
-                }
-
-                free(matrix->result_values);
-        }
-
-        if (matrix->result_indices)
-        {
-            for (uint64_t i = 0; i < matrix->num_rows; i++)
-            {
-                if(matrix->result_indices[i])
-                {
-                    free(matrix->result_indices[i]);
-                }
-            }
-
-            free(matrix->result_indices);
-        }
-    }
-}
-
 // function to handle the errors central
 void handle_error(const char *message, ELLPACKMatrix *matrix_a, ELLPACKMatrix *matrix_b, ELLPACKMatrix *result)
 {
@@ -132,24 +119,98 @@ void handle_error(const char *message, ELLPACKMatrix *matrix_a, ELLPACKMatrix *m
     exit(EXIT_FAILURE);
 }
 
+// adds the time since start to times
+void record_time(PhaseTimes *times, double start, ELLPACKMatrix *matrix_a, ELLPACKMatrix *matrix_b, ELLPACKMatrix *result)
+{
+    if (phase_times_add(times, benchmark_now() - start) != 0)
+    {
+        handle_error("Memory allocation failed for the benchmark timings", matrix_a, matrix_b, result);
+    }
+}
+
+// the switch-case block starts the entered version (getopt: -V). If nothing has been entered, version 0 is always executed
+void multiply(int version, ELLPACKMatrix *matrix_a, ELLPACKMatrix *matrix_b, HybridMatrix *hybrid_a, HybridMatrix *hybrid_b, ELLPACKMatrix *result, int num_threads, AccumulatorType accumulator)
+{
+    switch (version)
+    {
+    case 0:
+        matr_mult_ellpack(matrix_a, matrix_b, result);
+        break;
+    case 1:
+        matr_mult_ellpack_V1(matrix_a, matrix_b, result);
+        break;
+    case 2:
+        matr_mult_ellpack_V2(matrix_a, matrix_b, result);
+        break;
+    case 3:
+        matr_mult_ellpack_V3(matrix_a, matrix_b, result, num_threads);
+        break;
+    case 4:
+        matr_mult_ellpack_V4(matrix_a, matrix_b, result, num_threads, accumulator);
+        break;
+    case 5:
+        matr_mult_ellpack_V5(matrix_a, matrix_b, result, num_threads);
+        break;
+    case 6:
+        matr_mult_ellpack_V6(matrix_a, matrix_b, result, num_threads);
+        break;
+    case 7:
+        matr_mult_ellpack_V7(hybrid_a, hybrid_b, result, num_threads);
+        break;
+    case 8:
+        matr_mult_ellpack_V8(matrix_a, matrix_b, result, num_threads);
+        break;
+    case 9:
+        matr_mult_ellpack_V9(matrix_a, matrix_b, result, num_threads);
+        break;
+    default:
+        handle_error("Unknown version specified", matrix_a, matrix_b, NULL);
+    }
+}
+
 int main(int argc, char **argv)
 {
     const char *progname = argv[0];
 
     int opt;
     char *input_file_a = NULL, *input_file_b = NULL, *output_file = NULL;
-    int version = 0, benchmark = 1;
+    int version = 0, benchmark = 1, warmup = 0, num_threads = parallel_default_threads();
+    AccumulatorType accumulator = ACCUMULATOR_DENSE;
+    bool accumulator_set = false;
+    const char *convert_format = NULL;
+    uint64_t stream_budget = 0;
+    const char *json_file = NULL;
+    bool perf_mode = false;
+    bool wide_indices = false;
+    const char *batch_file = NULL;
+    int batch_jobs = 1;
+    bool chain = false;
+    bool reorder = false;
+    bool numa = false, huge_pages = false;
 
     static struct option long_options[] = {
         {"help", no_argument, 0, 'h'},
         {"version", required_argument, 0, 'V'},
         {"benchmark", optional_argument, 0, 'B'},
+        {"warmup", required_argument, 0, 'W'},
+        {"json", required_argument, 0, 'j'},
+        {"perf", no_argument, 0, 'P'},
+        {"reorder", no_argument, 0, 'R'},
+        {"numa", optional_argument, 0, 'N'},
+        {"wide-indices", no_argument, 0, 'I'},
+        {"threads", required_argument, 0, 't'},
+        {"accumulator", required_argument, 0, 'A'},
+        {"stream", required_argument, 0, 'S'},
+        {"convert", required_argument, 0, 'c'},
+        {"batch", required_argument, 0, 'M'},
+        {"jobs", required_argument, 0, 'J'},
+        {"chain", no_argument, 0, 'C'},
         {"input_a", required_argument, 0, 'a'},
         {"input_b", required_argument, 0, 'b'},
         {"output", required_argument, 0, 'o'},
         {0, 0, 0, 0}};
 
-    while ((opt = getopt_long(argc, argv, "hV:B::a:b:o:", long_options, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, "hV:B::W:j:t:A:S:c:J:a:b:o:", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -160,11 +221,17 @@ int main(int argc, char **argv)
             {
                  char *endptr;
                  errno = 0;
+
+                 if (strcmp(optarg, "auto") == 0) {
+                     version = VERSION_AUTO;
+                     break;
+                 }
+
                  version = strtol(optarg, &endptr, 10);
 
-                 if (errno != 0 || *endptr != '\0' || version < 0 || version > 2) {
+                 if (errno != 0 || *endptr != '\0' || version < 0 || version > 9) {
                      print_help(progname);
-                     handle_error("Invalid value for -V. It must be 0, 1, or 2.", NULL, NULL, NULL);
+                     handle_error("Invalid value for -V. It must be an integer from 0 to 9 or auto.", NULL, NULL, NULL);
                  }
             }
             break;
@@ -184,6 +251,108 @@ int main(int argc, char **argv)
                 }
             }
             break;
+        case 'W':
+            {
+                char *endptr;
+                errno = 0;
+                warmup = strtol(optarg, &endptr, 10);
+
+                if (errno != 0 || *endptr != '\0' || warmup < 0) {
+                    print_help(progname);
+                    handle_error("Invalid value for -W. It must be an integer greater than or equal to 0.", NULL, NULL, NULL);
+                }
+            }
+            break;
+        case 'j':
+            json_file = optarg;
+            break;
+        case 'P':
+            perf_mode = true;
+            break;
+        case 'R':
+            reorder = true;
+            break;
+        case 'N':
+            if (optarg && strcmp(optarg, "huge") != 0)
+            {
+                print_help(progname);
+                handle_error("Invalid value for --numa. It can only be huge.", NULL, NULL, NULL);
+            }
+            numa = true;
+            huge_pages = optarg != NULL;
+            break;
+        case 'I':
+            wide_indices = true;
+            break;
+        case 't':
+            {
+                char *endptr;
+                errno = 0;
+                num_threads = strtol(optarg, &endptr, 10);
+
+                if (errno != 0 || *endptr != '\0' || num_threads < 1) {
+                    print_help(progname);
+                    handle_error("Invalid value for -t. It must be an integer greater than or equal to 1.", NULL, NULL, NULL);
+                }
+            }
+            break;
+        case 'A':
+            if (strcmp(optarg, "dense") == 0)
+            {
+                accumulator = ACCUMULATOR_DENSE;
+                accumulator_set = true;
+            }
+            else if (strcmp(optarg, "hash") == 0)
+            {
+                accumulator = ACCUMULATOR_HASH;
+                accumulator_set = true;
+            }
+            else
+            {
+                print_help(progname);
+                handle_error("Invalid value for -A. It must be dense or hash.", NULL, NULL, NULL);
+            }
+            break;
+        case 'S':
+            {
+                char *endptr;
+                errno = 0;
+                unsigned long long budget = strtoull(optarg, &endptr, 10);
+
+                if (errno != 0 || *endptr != '\0' || optarg[0] == '-' || budget < 1 || budget > (UINT64_MAX >> 20)) {
+                    print_help(progname);
+                    handle_error("Invalid value for -S. It must be a memory budget in MiB greater than or equal to 1.", NULL, NULL, NULL);
+                }
+
+                stream_budget = (uint64_t)budget << 20;
+            }
+            break;
+        case 'c':
+            if (strcmp(optarg, "text") != 0 && strcmp(optarg, "binary") != 0)
+            {
+                print_help(progname);
+                handle_error("Invalid value for -c. It must be text or binary.", NULL, NULL, NULL);
+            }
+            convert_format = optarg;
+            break;
+        case 'M':
+            batch_file = optarg;
+            break;
+        case 'J':
+            {
+                char *endptr;
+                errno = 0;
+                batch_jobs = strtol(optarg, &endptr, 10);
+
+                if (errno != 0 || *endptr != '\0' || batch_jobs < 1) {
+                    print_help(progname);
+                    handle_error("Invalid value for -J. It must be an integer greater than or equal to 1.", NULL, NULL, NULL);
+                }
+            }
+            break;
+        case 'C':
+            chain = true;
+            break;
         case 'a':
             input_file_a = optarg;
             break;
@@ -199,105 +368,442 @@ int main(int argc, char **argv)
         }
     }
 
+    // convert mode: read the matrix in -a (text or binary) and write it to -o in the other format
+    if (convert_format)
+    {
+        if (!input_file_a || !output_file)
+        {
+            print_usage(progname);
+            handle_error("Error: Input (-a) and output (-o) files must be specified for -c", NULL, NULL, NULL);
+        }
+
+        ELLPACKMatrix matrix = {0};
+
+        // binary files keep 32-bit indices if the columns fit, text output is written from 64-bit indices
+        if (read_matrix(input_file_a, &matrix, strcmp(convert_format, "binary") == 0, num_threads) != 0)
+        {
+            handle_error("Error reading input matrix", &matrix, NULL, NULL);
+        }
+
+        int status = strcmp(convert_format, "binary") == 0 ? write_matrix_binary(output_file, &matrix) : write_matrix_V1(output_file, &matrix, matrix.num_non_zero, num_threads);
+
+        if (status != 0)
+        {
+            handle_error("Error writing converted matrix", &matrix, NULL, NULL);
+        }
+
+        free_matrix(&matrix);
+        return EXIT_SUCCESS;
+    }
+
+    // the reordering renumbers the inputs of one product in memory and puts the rows of its result back before writing
+    if (reorder && (batch_file || chain || stream_budget > 0 || version == 7))
+    {
+        handle_error("--reorder is only available for a single product without -S and with versions other than 7", NULL, NULL, NULL);
+    }
+
+    // the NUMA mode pins the threads of parallel_for, the jobs of batch mode would share the same cores
+    if (numa)
+    {
+        if (batch_file)
+        {
+            handle_error("--numa is not available in batch mode", NULL, NULL, NULL);
+        }
+
+        if (numa_enable(huge_pages) != 0)
+        {
+            handle_error("Error pinning the threads for --numa", NULL, NULL, NULL);
+        }
+    }
+
+    // batch mode: many products from a manifest, the inputs are shared between them
+    if (batch_file)
+    {
+        if (version == 7)
+        {
+            handle_error("Version 7 reads its own input format and is not available in batch mode", NULL, NULL, NULL);
+        }
+
+        BatchOptions options = {version, num_threads, batch_jobs, accumulator, accumulator_set, !wide_indices && (version >= 3 || version == VERSION_AUTO)};
+        int failed = run_batch(batch_file, &options);
+        pool_trim();
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // chain mode: the inputs are the arguments after the options, multiplied in the order with the least estimated work
+    if (chain)
+    {
+        if (argc - optind < 2 || !output_file)
+        {
+            print_usage(progname);
+            handle_error("Error: At least two inputs and the output file (-o) must be specified for --chain", NULL, NULL, NULL);
+        }
+
+        if (version == 7)
+        {
+            handle_error("Version 7 reads its own input format and is not available in chain mode", NULL, NULL, NULL);
+        }
+
+        ChainOptions options = {version, num_threads, accumulator, accumulator_set, !wide_indices && (version >= 3 || version == VERSION_AUTO)};
+        int status = run_chain(argv + optind, argc - optind, output_file, &options);
+        pool_trim();
+        return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     if (!input_file_a || !input_file_b || !output_file)
     {
         print_usage(progname);
         handle_error("Error: Input and output files must be specified", NULL, NULL, NULL);
     }
 
-    // reading the ELLPACK input files into the ELLPACKMatrix struct and after that control_indices check the correctness of the input indices
+    // every phase is timed on its own, the multiplication once per benchmark iteration
+    PhaseTimes times[NUM_PHASES] = {0};
+
+    // with --perf the hardware counters are read around every phase as well, without counters the run goes on
+    PerfCounters perf;
+    PerfSample perf_samples[NUM_PHASES] = {0};
+    perf_init(&perf);
+
+    if (perf_mode && perf_open(&perf) == 0)
+    {
+        fprintf(stderr, "Hardware performance counters are not available (perf_event_open: %s), continuing without them\n", strerror(errno));
+    }
+
     ELLPACKMatrix matrix_a = {0}, matrix_b = {0}, result = {0};
+    double start;
+
+    // versions 3 to 9 (and the streaming mode) have kernels for 32-bit indices, which halve the index traffic
+    bool compact_indices = !wide_indices && (version >= 3 || version == VERSION_AUTO || stream_budget > 0);
+
+    // version 7 reads the inputs straight into the hybrid ELL+COO format, the padded ELLPACK arrays are never built
+    HybridMatrix hybrid_a = {0}, hybrid_b = {0};
+    bool hybrid = version == 7 && stream_budget == 0;
+
+    // reading the ELLPACK input files into the ELLPACKMatrix struct and after that control_indices check the correctness of the input indices,
+    // both run warmup + benchmark times like the multiplication and every run but the last frees its inputs again
+    for (int i = 0; i < warmup + benchmark; i++)
+    {
+        if (i > 0)
+        {
+            free_matrix(&matrix_a);
+            free_matrix(&matrix_b);
+            free_hybrid(&hybrid_a);
+            free_hybrid(&hybrid_b);
+            matrix_a = matrix_b = (ELLPACKMatrix){0};
+        }
+
+        start = benchmark_now();
+        perf_start(&perf);
+
+        if (hybrid)
+        {
+            if (read_matrix_hybrid(input_file_a, &hybrid_a, HYBRID_PERCENTILE, compact_indices) != 0 ||
+                read_matrix_hybrid(input_file_b, &hybrid_b, HYBRID_PERCENTILE, compact_indices) != 0)
+            {
+                free_hybrid(&hybrid_a);
+                handle_error("Error reading input matrix", NULL, NULL, NULL);
+            }
+
+            // if only one of them fits into 32 bits both are read again with 64-bit indices
+            if ((hybrid_a.indices32 != NULL) != (hybrid_b.indices32 != NULL))
+            {
+                free_hybrid(&hybrid_a);
+                free_hybrid(&hybrid_b);
+
+                if (read_matrix_hybrid(input_file_a, &hybrid_a, HYBRID_PERCENTILE, false) != 0 ||
+                    read_matrix_hybrid(input_file_b, &hybrid_b, HYBRID_PERCENTILE, false) != 0)
+                {
+                    free_hybrid(&hybrid_a);
+                    handle_error("Error reading input matrix", NULL, NULL, NULL);
+                }
+            }
+        }
+        else if (read_matrix(input_file_a, &matrix_a, compact_indices, num_threads) != 0)
+        {
+            handle_error("Error reading input matrix A", &matrix_a, NULL, NULL);
+        }
+
+        if (!hybrid && read_matrix(input_file_b, &matrix_b, compact_indices, num_threads) != 0)
+        {
+            handle_error("Error reading input matrix B", &matrix_a, &matrix_b, NULL);
+        }
+
+        // the kernels need one index width for both matrices, if only one of them fits into 32 bits both use 64 bits
+        if ((matrix_a.indices32 != NULL) != (matrix_b.indices32 != NULL))
+        {
+            if (set_index_width(&matrix_a, false) != 0 || set_index_width(&matrix_b, false) != 0)
+            {
+                handle_error("Memory allocation failed for the 64-bit indices", &matrix_a, &matrix_b, NULL);
+            }
+        }
+
+        if (i >= warmup)
+        {
+            perf_stop(&perf, &perf_samples[PHASE_PARSE]);
+            record_time(&times[PHASE_PARSE], start, &matrix_a, &matrix_b, NULL);
+        }
 
-    if (read_matrix(input_file_a, &matrix_a) != 0)
+        start = benchmark_now();
+        perf_start(&perf);
+
+        if (hybrid)
+        {
+            if (control_indices_hybrid(input_file_a, &hybrid_a) != 0 || control_indices_hybrid(input_file_b, &hybrid_b) != 0)
+            {
+                free_hybrid(&hybrid_a);
+                free_hybrid(&hybrid_b);
+                handle_error("in control_indices_hybrid", NULL, NULL, NULL);
+            }
+        }
+        else if (control_indices(input_file_a, &matrix_a, num_threads) != 0)
+        {
+            handle_error("in control_indices_inputs (A)", &matrix_a, &matrix_b, NULL);
+        }
+
+        if (!hybrid && control_indices(input_file_b, &matrix_b, num_threads) != 0)
+        {
+            handle_error("in control_indices (B)", &matrix_a, &matrix_b, NULL);
+        }
+
+        if (i >= warmup)
+        {
+            perf_stop(&perf, &perf_samples[PHASE_CONTROL_INDICES]);
+            record_time(&times[PHASE_CONTROL_INDICES], start, &matrix_a, &matrix_b, NULL);
+        }
+    }
+
+    // --numa: the rows of the inputs move to the nodes of the threads that work on them
+    if (numa && !hybrid)
     {
-        handle_error("Error reading input matrix A", &matrix_a, NULL, NULL);
+        start = benchmark_now();
+
+        if (numa_place_input(&matrix_a, num_threads) != 0 || numa_place_input(&matrix_b, num_threads) != 0)
+        {
+            handle_error("Memory allocation failed for the NUMA placement of the inputs", &matrix_a, &matrix_b, NULL);
+        }
+
+        fprintf(stdout, "NUMA placement of the inputs: %f seconds\n", benchmark_now() - start);
     }
 
-    if (read_matrix(input_file_b, &matrix_b) != 0)
+    // streaming mode: the result never exists in memory as a whole, it is written block by block while computing
+    if (stream_budget > 0)
     {
-        handle_error("Error reading input matrix B", &matrix_a, &matrix_b, NULL);
+        start = benchmark_now();
+
+        if (matr_mult_streaming(&matrix_a, &matrix_b, output_file, stream_budget, num_threads, accumulator) != 0)
+        {
+            errno = 0;
+            handle_error("Error in streaming multiplication", &matrix_a, &matrix_b, NULL);
+        }
+
+        fprintf(stdout, "Streaming execution time (including output): %f seconds\n", benchmark_now() - start);
+
+        perf_close(&perf);
+        phase_times_free(&times[PHASE_PARSE]);
+        phase_times_free(&times[PHASE_CONTROL_INDICES]);
+        free_matrix(&matrix_a);
+        free_matrix(&matrix_b);
+        return EXIT_SUCCESS;
     }
 
-    if (control_indices(input_file_a, &matrix_a) != 0)
+    // -V auto: the statistics of the inputs decide, an accumulator given with -A is kept
+    if (version == VERSION_AUTO)
     {
-        handle_error("in control_indices_inputs (A)", &matrix_a, &matrix_b, NULL);
+        KernelChoice choice;
+
+        if (select_kernel(&matrix_a, &matrix_b, num_threads, &choice) != 0)
+        {
+            handle_error("Memory allocation failed for the kernel selection", &matrix_a, &matrix_b, NULL);
+        }
+
+        if (accumulator_set)
+        {
+            choice.accumulator = accumulator;
+        }
+
+        version = choice.version;
+        accumulator = choice.accumulator;
+        print_kernel_choice(stdout, &choice);
     }
 
-    if (control_indices(input_file_b, &matrix_b) != 0)
+    // version 5 picks its instruction set at runtime
+    if (version == 5)
     {
-        handle_error("in control_indices (B)", &matrix_a, &matrix_b, NULL);
+        fprintf(stdout, "SIMD level: %s\n", simd_level_name());
     }
 
-    // variable to calculate the average execution time of the matrix multiplication
-    double time = 0;
+    // with --reorder the benchmark runs twice: in the original order as the reference, then on the renumbered inputs
+    Reordering reordering = {0};
+    PhaseTimes reference_times = {0};
+    PerfSample reference_sample = {0};
+    double reorder_time = 0.0;
 
-    for (int i = 0; i < benchmark; i++)
+    for (int pass = reorder ? 0 : 1; pass < 2; pass++)
     {
-        // takes the start time for the time measurement
-        struct timespec clock_start_time;
-        if (clock_gettime(CLOCK_MONOTONIC, &clock_start_time) != 0)
+        PhaseTimes *pass_times = pass == 0 ? &reference_times : &times[PHASE_MULTIPLY];
+        PerfSample *pass_sample = pass == 0 ? &reference_sample : &perf_samples[PHASE_MULTIPLY];
+
+        if (pass == 1 && reorder)
         {
-            handle_error("Error getting clock time", &matrix_a, &matrix_b, NULL);
+            free_matrix(&result);
+            result = (ELLPACKMatrix){0};
+            start = benchmark_now();
+            perf_start(&perf);
+
+            if (reorder_inputs(&matrix_a, &matrix_b, num_threads, &reordering) != 0)
+            {
+                phase_times_free(&reference_times);
+                handle_error("Error reordering the inputs", &matrix_a, &matrix_b, NULL);
+            }
+
+            perf_stop(&perf, &perf_samples[PHASE_REORDER]);
+            reorder_time = benchmark_now() - start;
         }
 
-        // sleep(1) makes sure there is one second between the timing
-        sleep(1);
+        // the warmup runs are not timed, every run but the last frees its result again so that no iteration leaks
+        for (int i = 0; i < warmup + benchmark; i++)
+        {
+            if (i > 0)
+            {
+                free_matrix(&result);
+                result = (ELLPACKMatrix){0};
+            }
+
+            start = benchmark_now();
+            perf_start(&perf);
+
+            multiply(version, &matrix_a, &matrix_b, &hybrid_a, &hybrid_b, &result, num_threads, accumulator);
 
-        // the switch-case block starts the entered version (getopt: -V). If nothing has been entered, version 0 is always executed
-        switch (version)
+            if (i >= warmup)
+            {
+                perf_stop(&perf, pass_sample);
+                record_time(pass_times, start, &matrix_a, &matrix_b, &result);
+            }
+        }
+    }
+
+    // the rows of the result go back into the order of A, the reordering is timed as one phase with the renumbering
+    if (reorder)
+    {
+        start = benchmark_now();
+
+        if (restore_result_rows(&result, &reordering, num_threads) != 0)
         {
-        case 0:
-            matr_mult_ellpack(&matrix_a, &matrix_b, &result);
-            break;
-        case 1:
-            matr_mult_ellpack_V1(&matrix_a, &matrix_b, &result);
-            break;
-        case 2:
-            matr_mult_ellpack_V2(&matrix_a, &matrix_b, &result);
-            break;
-        default:
-            handle_error("Unknown version specified", &matrix_a, &matrix_b, NULL);
+            free_reordering(&reordering);
+            handle_error("Error restoring the order of the result rows", &matrix_a, &matrix_b, &result);
+        }
+
+        free_reordering(&reordering);
+        reorder_time += benchmark_now() - start;
+
+        if (phase_times_add(&times[PHASE_REORDER], reorder_time) != 0)
+        {
+            handle_error("Memory allocation failed for the benchmark timings", &matrix_a, &matrix_b, &result);
+        }
+    }
+
+    // creates the output file, write_result_matrix picks the writer for the layout of the result; every run rewrites it
+    for (int i = 0; i < warmup + benchmark; i++)
+    {
+        start = benchmark_now();
+        perf_start(&perf);
+
+        if (write_result_matrix(output_file, &result, version, num_threads) != 0)
+        {
+            handle_error("Error writing output matrix", &matrix_a, &matrix_b, &result);
         }
 
-        // takes the end time for the time measurement
-        struct timespec clock_end_time;
-        if (clock_gettime(CLOCK_MONOTONIC, &clock_end_time) != 0)
+        if (i >= warmup)
         {
-            handle_error("Error getting end time", &matrix_a, &matrix_b, &result);
+            perf_stop(&perf, &perf_samples[PHASE_WRITE]);
+            record_time(&times[PHASE_WRITE], start, &matrix_a, &matrix_b, &result);
         }
+    }
 
-        // calculates the running time of the matrix multiplication
-        time += clock_end_time.tv_sec - clock_start_time.tv_sec + 1e-9 * (clock_end_time.tv_nsec - clock_start_time.tv_nsec);
+    // print the multiplication times, with the full statistics for more than one iteration
+    PhaseStats stats;
+    if (phase_times_stats(&times[PHASE_MULTIPLY], &stats) != 0)
+    {
+        handle_error("Memory allocation failed for the benchmark statistics", &matrix_a, &matrix_b, &result);
     }
 
-    // calculate the average time and print it
-    time /= benchmark;
-    fprintf(stdout, "Average execution time: %f seconds\n", time);
+    fprintf(stdout, "Average execution time: %f seconds\n", stats.mean);
 
-    /*
-    Calls the functions that create the output file.
-    There are 2 Versions to create the output file. This is because the result arrays of the Versions are different.
-    */
-    if (version == 1)
+    if (benchmark > 1)
     {
-        uint64_t num_non_zero = compute_num_non_zero(&result);
-        if (write_matrix_V1(output_file, &result, num_non_zero) != 0)
+        fprintf(stdout, "Execution time min/median/p95/max: %f / %f / %f / %f seconds\n", stats.min, stats.median, stats.p95, stats.max);
+    }
+
+    // the reordering pays off once the time it saves per multiplication has added up to its own cost
+    if (reorder)
+    {
+        PhaseStats reference;
+
+        if (phase_times_stats(&reference_times, &reference) != 0)
         {
-            handle_error("Error writing output matrix", &matrix_a, &matrix_b, &result);
+            handle_error("Memory allocation failed for the benchmark statistics", &matrix_a, &matrix_b, &result);
+        }
+
+        phase_times_free(&reference_times);
+        double saved = reference.mean - stats.mean;
+
+        fprintf(stdout, "Reordering: %f seconds, average execution time %f seconds in the original order, %f seconds reordered", reorder_time, reference.mean, stats.mean);
+
+        if (saved > 0.0)
+        {
+            fprintf(stdout, " (speed-up %.2f), pays off after %.1f multiplications\n", reference.mean / stats.mean, reorder_time / saved);
+        }
+        else
+        {
+            fprintf(stdout, ", no speed-up\n");
         }
     }
-    else
+
+    if (json_file)
     {
-        if (write_matrix_V2(output_file, &result) != 0)
+        BenchmarkInfo info = {version, num_threads, accumulator == ACCUMULATOR_HASH ? "hash" : "dense", input_file_a, input_file_b, warmup, benchmark};
+        FILE *file = fopen(json_file, "w");
+
+        if (!file || benchmark_write_json(file, &info, times) != 0 || fclose(file) != 0)
         {
-            handle_error("Error writing output matrix", &matrix_a, &matrix_b, &result);
+            handle_error("Error writing benchmark JSON", &matrix_a, &matrix_b, &result);
+        }
+    }
+
+    // counters per run of every phase, the multiplication also with its rate of useful flops and of the bytes it has to move
+    if (perf_mode)
+    {
+        for (int phase = 0; phase < NUM_PHASES; phase++)
+        {
+            if (times[phase].num_samples == 0)
+            {
+                continue;
+            }
+
+            PhaseStats phase_stats;
+            phase_times_stats(&times[phase], &phase_stats);
+
+            bool multiply = phase == PHASE_MULTIPLY;
+            perf_report(stdout, benchmark_phase_name(phase), &perf_samples[phase], phase_stats.mean,
+                        multiply ? perf_multiply_flops(&matrix_a, &matrix_b) : 0,
+                        multiply ? perf_multiply_bytes(&matrix_a, &matrix_b, &result) : 0);
         }
     }
 
+    perf_close(&perf);
+
+    for (int phase = 0; phase < NUM_PHASES; phase++)
+    {
+        phase_times_free(&times[phase]);
+    }
+
     // calls the function to free the allocated memory
     free_matrix(&matrix_a);
     free_matrix(&matrix_b);
     free_matrix(&result);
+    free_hybrid(&hybrid_a);
+    free_hybrid(&hybrid_b);
+    pool_trim();
 
     return EXIT_SUCCESS;
 }
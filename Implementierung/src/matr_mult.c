@@ -1,4 +1,5 @@
 #include "ellpack.h"
+#include "accumulator.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -20,49 +21,34 @@ void matr_mult_ellpack(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatr
     matrix_result->num_rows = matrix_a->num_rows;
     matrix_result->num_cols = matrix_b->num_cols;
 
-    matrix_result->result_values = (float **)calloc(matrix_result->num_rows, sizeof(float *));
-    matrix_result->result_indices = (uint64_t **)calloc(matrix_result->num_rows, sizeof(uint64_t *));
-
-    if (!matrix_result->result_values || !matrix_result->result_indices)
+    if (result_rows_init(matrix_result) != 0)
     {
-        free(matrix_result->result_values);
-        free(matrix_result->result_indices);
-        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V3 (V3))\n");
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack (V0))\n");
         free_input_matrix = true;
         goto free_input_matrix;
     }
-    
+
     // Check if zero matrix
     if (matrix_a->num_non_zero == 0 || matrix_b->num_non_zero == 0)
     {
-        matrix_result->num_non_zero = 0;
         return;
     }
 
-    uint64_t max_non_zero = 0;
+    // Allocate the accumulator for the result rows, the rows are carved out of the arena of the result
+    Accumulator acc;
+    ArenaCursor cursor = arena_cursor(matrix_result->arena);
+
+    if (accumulator_init(&acc, matrix_result->num_cols) != 0)
+    {
+        free_result_rows(matrix_result);
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack (V0))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
 
     // Iterate over rows of matrix_a
     for (uint64_t curr_row_a = 0; curr_row_a < matrix_a->num_rows; ++curr_row_a)
     {
-        // Allocate memory for current row in result_matrix
-        matrix_result->result_values[curr_row_a] = (float *)calloc(matrix_result->num_cols, sizeof(float));
-        matrix_result->result_indices[curr_row_a] = (uint64_t *)calloc(matrix_result->num_cols, sizeof(uint64_t));
-
-        if (!matrix_result->result_values[curr_row_a] || !matrix_result->result_indices[curr_row_a])
-        {
-            for (uint64_t i = 0; i <= curr_row_a; ++i)
-            {
-                free(matrix_result->result_values[i]);
-                free(matrix_result->result_indices[i]);
-            }
-
-            free(matrix_result->result_values);
-            free(matrix_result->result_indices);
-            fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V3)\n");
-            free_input_matrix = true;
-            goto free_input_matrix;
-        }
-
         // Iterate over non-zero elements of current row of matrix_a
         for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
         {
@@ -87,43 +73,35 @@ void matr_mult_ellpack(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatr
                     continue;
                 }
 
-                uint64_t col_b = matrix_b->indices[index_b];
-
-                // Perform multiplication and add it to result
-                matrix_result->result_values[curr_row_a][col_b] += value_a * value_b;
-                matrix_result->result_indices[curr_row_a][col_b] = col_b;
+                // Perform multiplication and add it to the accumulator
+                accumulator_add(&acc, matrix_b->indices[index_b], value_a * value_b);
             }
         }
 
-        // Remove zero entries in result row
-        uint64_t cnt_non_zero = 0;
-        for (uint64_t i = 0; i < matrix_result->num_cols; ++i)
+        // Allocate memory for the touched columns of the current row in result_matrix
+        if (acc.num_touched > 0 && result_row_alloc(matrix_result, &cursor, curr_row_a, acc.num_touched) != 0)
         {
-            if (matrix_result->result_values[curr_row_a][i] != 0.0f)
-            {
-                matrix_result->result_values[curr_row_a][cnt_non_zero] = matrix_result->result_values[curr_row_a][i];
-                matrix_result->result_indices[curr_row_a][cnt_non_zero] = matrix_result->result_indices[curr_row_a][i];
-                cnt_non_zero++;
-            }
+            accumulator_free(&acc);
+            free_result_rows(matrix_result);
+            fprintf(stderr, "Memory allocation failed (matr_mult_ellpack (V0))\n");
+            free_input_matrix = true;
+            goto free_input_matrix;
         }
 
-        // Update max_non_zero
-        if (cnt_non_zero > max_non_zero)
-        {
-            max_non_zero = cnt_non_zero;
-        }
+        // Transfer the non-zero entries to the result row (only the touched columns are visited)
+        matrix_result->row_length[curr_row_a] = accumulator_flush(&acc, matrix_result->result_values[curr_row_a], matrix_result->result_indices[curr_row_a]);
     }
 
-    // Set number of non_zero elements in result_matrix
-    matrix_result->num_non_zero = max_non_zero;
+    accumulator_free(&acc);
+
+    // Set number of non_zero elements in result_matrix (the longest row)
+    result_rows_finish(matrix_result);
 
 free_input_matrix:
     if (free_input_matrix)
     {
-        free(matrix_a->values);
-        free(matrix_a->indices);
-        free(matrix_b->values);
-        free(matrix_b->indices);
+        free_input_arrays(matrix_a);
+        free_input_arrays(matrix_b);
         exit(EXIT_FAILURE);
     }
 }
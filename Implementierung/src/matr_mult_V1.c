@@ -78,10 +78,8 @@ void matr_mult_ellpack_V1(const ELLPACKMatrix *restrict matrix_a, const ELLPACKM
 free_input_matrix:
     if (free_input_matrix)
     {
-        free(matrix_a->values);
-        free(matrix_a->indices);
-        free(matrix_b->values);
-        free(matrix_b->indices);
+        free_input_arrays(matrix_a);
+        free_input_arrays(matrix_b);
         exit(EXIT_FAILURE);
     }
 }
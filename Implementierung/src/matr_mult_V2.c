@@ -1,4 +1,5 @@
 #include "ellpack.h"
+#include "accumulator.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <immintrin.h>
@@ -20,134 +21,111 @@ void matr_mult_ellpack_V2(const ELLPACKMatrix *restrict matrix_a, const ELLPACKM
     matrix_result->num_rows = matrix_a->num_rows;
     matrix_result->num_cols = matrix_b->num_cols;
 
-    matrix_result->result_values = (float **)calloc(matrix_result->num_rows, sizeof(float *));
-    matrix_result->result_indices = (uint64_t **)calloc(matrix_result->num_rows, sizeof(uint64_t *));
-
-    if (!matrix_result->result_values || !matrix_result->result_indices)
+    if (result_rows_init(matrix_result) != 0)
     {
-        free(matrix_result->result_values);
-        free(matrix_result->result_indices);
         fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V2 (V2))\n");
         free_input_matrix = true;
         goto free_input_matrix;
     }
 
-    // Allocate temporary array to store values b
-    float *temp_values_row_b = (float *)calloc(matrix_b->num_cols, sizeof(float));
-    
-    if (!temp_values_row_b)
-        {
-            free(matrix_result->result_values);
-            free(matrix_result->result_indices);
-            fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V2 (V2))\n");
-            free_input_matrix = true;
-            goto free_input_matrix;
-        }
+    // Check if zero matrix
+    if (matrix_a->num_non_zero == 0 || matrix_b->num_non_zero == 0)
+    {
+        return;
+    }
 
-    uint64_t max_non_zero = 0;
+    // The products go into the accumulator, so only the touched columns of a row are cleared and compacted
+    Accumulator acc;
+    ArenaCursor cursor = arena_cursor(matrix_result->arena);
 
-    // Iterate over rows of matrix_a
-    for (uint64_t curr_row_a = 0; curr_row_a < matrix_a->num_rows; ++curr_row_a)
+    if (accumulator_init(&acc, matrix_result->num_cols) != 0)
     {
-        // Allocate memory for current row in result_matrix
-        matrix_result->result_values[curr_row_a] = (float *)calloc(matrix_result->num_cols, sizeof(float));
-        matrix_result->result_indices[curr_row_a] = (uint64_t *)calloc(matrix_result->num_cols, sizeof(uint64_t));
-
-        if (!matrix_result->result_values[curr_row_a] || !matrix_result->result_indices[curr_row_a])
-        {
-            for (uint64_t i = 0; i <= curr_row_a; ++i)
-            {
-                free(matrix_result->result_values[i]);
-                free(matrix_result->result_indices[i]);
-            }
+        free_result_rows(matrix_result);
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V2 (V2))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
 
-            free(temp_values_row_b);
-            free(matrix_result->result_values);
-            free(matrix_result->result_indices);
-            fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V3)\n");
-            free_input_matrix = true;
-            goto free_input_matrix;
-        }
+    uint64_t num_simd_b = matrix_b->num_non_zero - (matrix_b->num_non_zero % 4);
+    const __m128 simd_zero = _mm_setzero_ps();
 
+    // Iterate over rows of matrix_a
+    for (uint64_t curr_row_a = 0; curr_row_a < matrix_a->num_rows; ++curr_row_a)
+    {
         // Iterate over non-zero elements of current row of matrix_a
         for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
-
         {
-            // Load value a into SIMD register
             uint64_t index_a = curr_row_a * matrix_a->num_non_zero + curr_non_zero_a;
-            __m128 simd_value_a = _mm_set1_ps(matrix_a->values[index_a]);
+            float value_a = matrix_a->values[index_a];
 
-            uint64_t col_a = matrix_a->indices[index_a];
+            if (value_a == 0.0f)
+            {
+                continue;
+            }
 
-            uint64_t base_index_b = col_a * matrix_b->num_non_zero;
+            // Load value a into SIMD register
+            __m128 simd_value_a = _mm_set1_ps(value_a);
+            uint64_t base_index_b = matrix_a->indices[index_a] * matrix_b->num_non_zero;
+            float products[4];
 
-            // Iterate over non-zero elements of row in matrix_b and store result in temp array
-            for (uint64_t num_non_zero_b = 0; num_non_zero_b < matrix_b->num_non_zero; ++num_non_zero_b)
+            // Multiply the slots of the row in b in chunks of 4 elements, a vector compare gives the mask of the
+            // non-zero slots: chunks of padding are skipped at once and only the set lanes go into the accumulator
+            for (uint64_t num_non_zero_b = 0; num_non_zero_b < num_simd_b; num_non_zero_b += 4)
             {
                 uint64_t index_b = base_index_b + num_non_zero_b;
-                uint64_t col_b = matrix_b->indices[index_b];
-                temp_values_row_b[col_b] += matrix_b->values[index_b];
-                matrix_result->result_indices[curr_row_a][col_b] = col_b;
-            }
+                __m128 simd_values_b = _mm_loadu_ps(&matrix_b->values[index_b]);
+                int mask = _mm_movemask_ps(_mm_cmpneq_ps(simd_values_b, simd_zero));
 
-            // Iterate over row in b in chunks of 4 elements
-            for (uint64_t col_b = 0; col_b < (matrix_b->num_cols - (matrix_b->num_cols % 4)); col_b += 4)
-            {
-                // Compute and store result in temporary b array
-                __m128 simd_values_b = _mm_load_ps(&temp_values_row_b[col_b]);
-                __m128 simd_temp_values = _mm_load_ps(&matrix_result->result_values[curr_row_a][col_b]);
-                simd_temp_values = _mm_add_ps(simd_temp_values, _mm_mul_ps(simd_value_a, simd_values_b));
-                _mm_store_ps(&matrix_result->result_values[curr_row_a][col_b], simd_temp_values);
+                if (mask == 0)
+                {
+                    continue;
+                }
+
+                _mm_storeu_ps(products, _mm_mul_ps(simd_value_a, simd_values_b));
+
+                for (; mask != 0; mask &= mask - 1)
+                {
+                    int lane = __builtin_ctz((unsigned)mask);
+                    accumulator_add(&acc, matrix_b->indices[index_b + lane], products[lane]);
+                }
             }
 
             // Compute single elements
-            float value_a = matrix_a->values[index_a];
-            base_index_b = (matrix_b->num_cols - (matrix_b->num_cols % 4));
-            for (uint64_t index_remain_b = 0; index_remain_b < matrix_b->num_cols % 4; index_remain_b++)
+            for (uint64_t num_non_zero_b = num_simd_b; num_non_zero_b < matrix_b->num_non_zero; ++num_non_zero_b)
             {
-                float calc_temp = temp_values_row_b[base_index_b + index_remain_b] * value_a;
-                matrix_result->result_values[curr_row_a][base_index_b + index_remain_b] += calc_temp;
-            }
+                uint64_t index_b = base_index_b + num_non_zero_b;
 
-            // Reset temporary b array for next iteration
-            for (uint64_t col_b = 0; col_b < matrix_b->num_cols; ++col_b)
-            {
-                temp_values_row_b[col_b] = 0.0f;
+                if (matrix_b->values[index_b] != 0.0f)
+                {
+                    accumulator_add(&acc, matrix_b->indices[index_b], value_a * matrix_b->values[index_b]);
+                }
             }
         }
 
-        // Transfer non-zero values from the temporary b array to matrix_result
-        uint64_t cnt_non_zero = 0;
-        for (uint64_t index_col_result = 0; index_col_result < matrix_result->num_cols; ++index_col_result)
+        // Allocate memory for the touched columns of the current row in result_matrix
+        if (acc.num_touched > 0 && result_row_alloc(matrix_result, &cursor, curr_row_a, acc.num_touched) != 0)
         {
-            if (matrix_result->result_values[curr_row_a][index_col_result] != 0.0f)
-            {
-                matrix_result->result_values[curr_row_a][cnt_non_zero] = matrix_result->result_values[curr_row_a][index_col_result];
-                matrix_result->result_indices[curr_row_a][cnt_non_zero] = matrix_result->result_indices[curr_row_a][index_col_result];
-                cnt_non_zero++;
-            }
+            accumulator_free(&acc);
+            free_result_rows(matrix_result);
+            fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V2 (V2))\n");
+            free_input_matrix = true;
+            goto free_input_matrix;
         }
 
-        // Update max_non_zero
-        if (cnt_non_zero > max_non_zero)
-        {
-            max_non_zero = cnt_non_zero;
-        }
+        // Transfer the non-zero entries to the result row (only the touched columns are visited)
+        matrix_result->row_length[curr_row_a] = accumulator_flush(&acc, matrix_result->result_values[curr_row_a], matrix_result->result_indices[curr_row_a]);
     }
 
-    // Set number of non-zero elements in result_matrix
-    matrix_result->num_non_zero = max_non_zero;
+    accumulator_free(&acc);
 
-    // Free the allocated memory for the temporary arrays
-    free(temp_values_row_b);
+    // Set number of non-zero elements in result_matrix (the longest row)
+    result_rows_finish(matrix_result);
 
 free_input_matrix:
     if (free_input_matrix)
     {
-        free(matrix_a->values);
-        free(matrix_a->indices);
-        free(matrix_b->values);
-        free(matrix_b->indices);
+        free_input_arrays(matrix_a);
+        free_input_arrays(matrix_b);
         exit(EXIT_FAILURE);
     }
 }
@@ -0,0 +1,210 @@
+#include "ellpack.h"
+#include "parallel.h"
+#include "accumulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct
+{
+    const ELLPACKMatrix *matrix_a;
+    const ELLPACKMatrix *matrix_b;
+    ELLPACKMatrix *matrix_result;
+    atomic_bool failed;
+} V3Context;
+
+// computes the rows [begin, end) of the result with an accumulator that belongs to this thread only
+ALWAYS_INLINE void compute_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V3Context *ctx = (V3Context *)context;
+    const ELLPACKMatrix *matrix_a = ctx->matrix_a;
+    const ELLPACKMatrix *matrix_b = ctx->matrix_b;
+    ELLPACKMatrix *matrix_result = ctx->matrix_result;
+
+    // Allocate the accumulator of this thread, the result rows are carved out of the arena with its own cursor
+    Accumulator acc;
+    ArenaCursor cursor = arena_cursor(matrix_result->arena);
+
+    if (accumulator_init(&acc, matrix_result->num_cols) != 0)
+    {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    // Iterate over the rows of matrix_a that belong to this thread
+    for (uint64_t curr_row_a = begin; curr_row_a < end && !atomic_load_explicit(&ctx->failed, memory_order_relaxed); ++curr_row_a)
+    {
+        // Iterate over non-zero elements of current row of matrix_a
+        for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
+        {
+            uint64_t index_a = curr_row_a * matrix_a->num_non_zero + curr_non_zero_a;
+            float value_a = matrix_a->values[index_a];
+
+            if (value_a == 0.0f)
+            {
+                continue;
+            }
+
+            uint64_t base_index_b = load_index(matrix_a, index_a, compact) * matrix_b->num_non_zero;
+
+            // Iterate over non-zero elements of row in matrix_b and accumulate them
+            for (uint64_t curr_non_zero_b = 0; curr_non_zero_b < matrix_b->num_non_zero; ++curr_non_zero_b)
+            {
+                float value_b = matrix_b->values[base_index_b + curr_non_zero_b];
+
+                if (value_b == 0.0f)
+                {
+                    continue;
+                }
+
+                accumulator_add(&acc, load_index(matrix_b, base_index_b + curr_non_zero_b, compact), value_a * value_b);
+            }
+        }
+
+        // Allocate memory for the touched columns of the current row in result_matrix (an upper bound of its non-zero entries)
+        if (acc.num_touched > 0 && result_row_alloc(matrix_result, &cursor, curr_row_a, acc.num_touched) != 0)
+        {
+            atomic_store(&ctx->failed, true);
+            break;
+        }
+
+        // Transfer the non-zero values to the result row, only the touched columns are visited
+        matrix_result->row_length[curr_row_a] = accumulator_flush(&acc, matrix_result->result_values[curr_row_a], matrix_result->result_indices[curr_row_a]);
+    }
+
+    accumulator_free(&acc);
+}
+
+INDEX_WIDTH_TASKS(compute_rows)
+
+/*
+Allocates the row pointers, the row lengths and the arena of a ragged result (num_rows must be set).
+The rows are not padded: the writer pads every row from its length. Returns -1 if memory is missing.
+*/
+int result_rows_init(ELLPACKMatrix *matrix_result)
+{
+    matrix_result->num_non_zero = 0;
+    matrix_result->result_values = (float **)calloc(matrix_result->num_rows, sizeof(float *));
+    matrix_result->result_indices = (uint64_t **)calloc(matrix_result->num_rows, sizeof(uint64_t *));
+    matrix_result->row_length = (uint64_t *)calloc(matrix_result->num_rows ? matrix_result->num_rows : 1, sizeof(uint64_t));
+    matrix_result->arena = arena_create();
+
+    if (!matrix_result->result_values || !matrix_result->result_indices || !matrix_result->row_length || !matrix_result->arena)
+    {
+        free_result_rows(matrix_result);
+        return -1;
+    }
+
+    return 0;
+}
+
+// carves the arrays of a row with length entries out of the arena with the cursor of the calling thread
+int result_row_alloc(ELLPACKMatrix *matrix_result, ArenaCursor *cursor, uint64_t row, uint64_t length)
+{
+    matrix_result->result_values[row] = (float *)arena_alloc(cursor, length * sizeof(float));
+    matrix_result->result_indices[row] = (uint64_t *)arena_alloc(cursor, length * sizeof(uint64_t));
+
+    return matrix_result->result_values[row] && matrix_result->result_indices[row] ? 0 : -1;
+}
+
+// sets num_non_zero to the longest row, as the ELLPACK format of the output needs it
+void result_rows_finish(ELLPACKMatrix *matrix_result)
+{
+    matrix_result->num_non_zero = 0;
+
+    for (uint64_t row = 0; row < matrix_result->num_rows; ++row)
+    {
+        if (matrix_result->row_length[row] > matrix_result->num_non_zero)
+        {
+            matrix_result->num_non_zero = matrix_result->row_length[row];
+        }
+    }
+}
+
+// frees ragged result rows: all at once with their arena, or one by one if they were allocated on their own
+void free_result_rows(ELLPACKMatrix *matrix_result)
+{
+    if (matrix_result->arena)
+    {
+        arena_destroy(matrix_result->arena);
+    }
+    else if (matrix_result->result_values && matrix_result->result_indices)
+    {
+        for (uint64_t i = 0; i < matrix_result->num_rows; ++i)
+        {
+            free(matrix_result->result_values[i]);
+            free(matrix_result->result_indices[i]);
+        }
+    }
+
+    free(matrix_result->result_values);
+    free(matrix_result->result_indices);
+    free(matrix_result->row_length);
+    matrix_result->result_values = NULL;
+    matrix_result->result_indices = NULL;
+    matrix_result->row_length = NULL;
+    matrix_result->arena = NULL;
+}
+
+void matr_mult_ellpack_V3(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatrix *restrict matrix_b, ELLPACKMatrix *restrict matrix_result, int num_threads)
+{
+    bool free_input_matrix = false;
+
+    // Check if dimensions match
+    if (matrix_a->num_cols != matrix_b->num_rows)
+    {
+        fprintf(stderr, "Matrix dimensions do not match for multiplication (matr_mult_ellpack_V3 (V3))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Initialize dimensions and allocate the row pointers of result_matrix
+    matrix_result->num_rows = matrix_a->num_rows;
+    matrix_result->num_cols = matrix_b->num_cols;
+
+    if (result_rows_init(matrix_result) != 0)
+    {
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V3 (V3))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Check if zero matrix
+    if (matrix_a->num_non_zero == 0 || matrix_b->num_non_zero == 0)
+    {
+        return;
+    }
+
+    // Check if both matrices store their indices with the same width
+    if ((matrix_a->indices32 != NULL) != (matrix_b->indices32 != NULL))
+    {
+        free_result_rows(matrix_result);
+        fprintf(stderr, "Index widths of the matrices do not match (matr_mult_ellpack_V3 (V3))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    V3Context ctx = {matrix_a, matrix_b, matrix_result, false};
+
+    // Compute the result rows in parallel
+    if (parallel_for(num_threads, matrix_result->num_rows, matrix_a->indices32 ? compute_rows_32 : compute_rows_64, &ctx) != 0 || atomic_load(&ctx.failed))
+    {
+        free_result_rows(matrix_result);
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V3 (V3))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Set number of non-zero elements in result_matrix (the longest row)
+    result_rows_finish(matrix_result);
+
+free_input_matrix:
+    if (free_input_matrix)
+    {
+        free_input_arrays(matrix_a);
+        free_input_arrays(matrix_b);
+        exit(EXIT_FAILURE);
+    }
+}
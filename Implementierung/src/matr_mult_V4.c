@@ -0,0 +1,498 @@
+#include "ellpack.h"
+#include "parallel.h"
+#include "accumulator.h"
+#include "numa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct
+{
+    const ELLPACKMatrix *matrix_a;
+    const ELLPACKMatrix *matrix_b;
+    ELLPACKMatrix *matrix_result;
+    uint64_t first_row_a; // result row i is row first_row_a + i of matrix_a
+    uint64_t *row_non_zero;
+    uint64_t *row_length_b;
+    atomic_bool cancelled;
+    atomic_bool failed;
+} V4Context;
+
+// symbolic phase: counts the distinct columns of the result rows [begin, end) without computing any value
+ALWAYS_INLINE void count_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V4Context *ctx = (V4Context *)context;
+    const ELLPACKMatrix *matrix_a = ctx->matrix_a;
+    const ELLPACKMatrix *matrix_b = ctx->matrix_b;
+
+    Accumulator acc;
+
+    if (accumulator_init(&acc, matrix_b->num_cols) != 0)
+    {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (uint64_t curr_row_a = begin; curr_row_a < end; ++curr_row_a)
+    {
+        for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
+        {
+            uint64_t index_a = (ctx->first_row_a + curr_row_a) * matrix_a->num_non_zero + curr_non_zero_a;
+
+            if (matrix_a->values[index_a] == 0.0f)
+            {
+                continue;
+            }
+
+            uint64_t base_index_b = load_index(matrix_a, index_a, compact) * matrix_b->num_non_zero;
+
+            for (uint64_t curr_non_zero_b = 0; curr_non_zero_b < matrix_b->num_non_zero; ++curr_non_zero_b)
+            {
+                if (matrix_b->values[base_index_b + curr_non_zero_b] == 0.0f)
+                {
+                    continue;
+                }
+
+                accumulator_touch(&acc, load_index(matrix_b, base_index_b + curr_non_zero_b, compact));
+            }
+        }
+
+        ctx->row_non_zero[curr_row_a] = acc.num_touched;
+        accumulator_next_row(&acc);
+    }
+
+    accumulator_free(&acc);
+}
+
+INDEX_WIDTH_TASKS(count_rows)
+
+// numeric phase: computes the result rows [begin, end) straight into their exact-sized slots
+ALWAYS_INLINE void compute_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V4Context *ctx = (V4Context *)context;
+    const ELLPACKMatrix *matrix_a = ctx->matrix_a;
+    const ELLPACKMatrix *matrix_b = ctx->matrix_b;
+    ELLPACKMatrix *matrix_result = ctx->matrix_result;
+
+    // Allocate the accumulator of this thread
+    Accumulator acc;
+
+    if (accumulator_init(&acc, matrix_result->num_cols) != 0)
+    {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (uint64_t curr_row_a = begin; curr_row_a < end; ++curr_row_a)
+    {
+        uint64_t row_begin = matrix_result->row_ptr[curr_row_a];
+        uint64_t row_length = matrix_result->row_ptr[curr_row_a + 1] - row_begin;
+
+        // Accumulate the products of the row
+        for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
+        {
+            uint64_t index_a = (ctx->first_row_a + curr_row_a) * matrix_a->num_non_zero + curr_non_zero_a;
+            float value_a = matrix_a->values[index_a];
+
+            if (value_a == 0.0f)
+            {
+                continue;
+            }
+
+            uint64_t base_index_b = load_index(matrix_a, index_a, compact) * matrix_b->num_non_zero;
+
+            for (uint64_t curr_non_zero_b = 0; curr_non_zero_b < matrix_b->num_non_zero; ++curr_non_zero_b)
+            {
+                float value_b = matrix_b->values[base_index_b + curr_non_zero_b];
+
+                if (value_b == 0.0f)
+                {
+                    continue;
+                }
+
+                accumulator_add(&acc, load_index(matrix_b, base_index_b + curr_non_zero_b, compact), value_a * value_b);
+            }
+        }
+
+        // Write the row into its slots, entries that cancelled to zero leave zero slots at the end of the row
+        uint64_t cnt_non_zero = accumulator_flush(&acc, matrix_result->values + row_begin, matrix_result->indices + row_begin);
+
+        if (cnt_non_zero < row_length)
+        {
+            memset(matrix_result->values + row_begin + cnt_non_zero, 0, (row_length - cnt_non_zero) * sizeof(float));
+            atomic_store_explicit(&ctx->cancelled, true, memory_order_relaxed);
+        }
+    }
+
+    accumulator_free(&acc);
+}
+
+INDEX_WIDTH_TASKS(compute_rows)
+
+// number of non-zero entries of the rows [begin, end) of matrix_b (used to bound the flops of a result row)
+static void count_rows_b(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    V4Context *ctx = (V4Context *)context;
+    const ELLPACKMatrix *matrix_b = ctx->matrix_b;
+
+    for (uint64_t row_b = begin; row_b < end; ++row_b)
+    {
+        uint64_t cnt_non_zero = 0;
+
+        for (uint64_t curr_non_zero_b = 0; curr_non_zero_b < matrix_b->num_non_zero; ++curr_non_zero_b)
+        {
+            if (matrix_b->values[row_b * matrix_b->num_non_zero + curr_non_zero_b] != 0.0f)
+            {
+                cnt_non_zero++;
+            }
+        }
+
+        ctx->row_length_b[row_b] = cnt_non_zero;
+    }
+}
+
+// upper bound of the non-zero entries of result row curr_row_a: its flop count, at most the width of the result
+ALWAYS_INLINE uint64_t row_flops(const V4Context *ctx, uint64_t curr_row_a, bool compact)
+{
+    const ELLPACKMatrix *matrix_a = ctx->matrix_a;
+    uint64_t flops = 0;
+
+    for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
+    {
+        uint64_t index_a = (ctx->first_row_a + curr_row_a) * matrix_a->num_non_zero + curr_non_zero_a;
+
+        if (matrix_a->values[index_a] != 0.0f)
+        {
+            flops += ctx->row_length_b[load_index(matrix_a, index_a, compact)];
+        }
+    }
+
+    return flops < ctx->matrix_b->num_cols ? flops : ctx->matrix_b->num_cols;
+}
+
+// symbolic phase with a hash table per row instead of a dense marker row
+ALWAYS_INLINE void count_rows_hash_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V4Context *ctx = (V4Context *)context;
+    const ELLPACKMatrix *matrix_a = ctx->matrix_a;
+    const ELLPACKMatrix *matrix_b = ctx->matrix_b;
+
+    HashAccumulator hash;
+
+    if (hash_accumulator_init(&hash) != 0)
+    {
+        hash_accumulator_free(&hash);
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (uint64_t curr_row_a = begin; curr_row_a < end; ++curr_row_a)
+    {
+        if (hash_accumulator_start_row(&hash, row_flops(ctx, curr_row_a, compact)) != 0)
+        {
+            atomic_store(&ctx->failed, true);
+            break;
+        }
+
+        for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
+        {
+            uint64_t index_a = (ctx->first_row_a + curr_row_a) * matrix_a->num_non_zero + curr_non_zero_a;
+
+            if (matrix_a->values[index_a] == 0.0f)
+            {
+                continue;
+            }
+
+            uint64_t base_index_b = load_index(matrix_a, index_a, compact) * matrix_b->num_non_zero;
+
+            for (uint64_t curr_non_zero_b = 0; curr_non_zero_b < matrix_b->num_non_zero; ++curr_non_zero_b)
+            {
+                if (matrix_b->values[base_index_b + curr_non_zero_b] == 0.0f)
+                {
+                    continue;
+                }
+
+                hash_accumulator_touch(&hash, load_index(matrix_b, base_index_b + curr_non_zero_b, compact));
+            }
+        }
+
+        ctx->row_non_zero[curr_row_a] = hash.num_entries;
+        hash_accumulator_clear(&hash);
+    }
+
+    hash_accumulator_free(&hash);
+}
+
+INDEX_WIDTH_TASKS(count_rows_hash)
+
+// numeric phase with a hash table per row, sized from the exact row length of the symbolic phase
+ALWAYS_INLINE void compute_rows_hash_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V4Context *ctx = (V4Context *)context;
+    const ELLPACKMatrix *matrix_a = ctx->matrix_a;
+    const ELLPACKMatrix *matrix_b = ctx->matrix_b;
+    ELLPACKMatrix *matrix_result = ctx->matrix_result;
+
+    HashAccumulator hash;
+
+    if (hash_accumulator_init(&hash) != 0)
+    {
+        hash_accumulator_free(&hash);
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (uint64_t curr_row_a = begin; curr_row_a < end; ++curr_row_a)
+    {
+        uint64_t row_begin = matrix_result->row_ptr[curr_row_a];
+        uint64_t row_length = matrix_result->row_ptr[curr_row_a + 1] - row_begin;
+
+        if (hash_accumulator_start_row(&hash, row_length) != 0)
+        {
+            atomic_store(&ctx->failed, true);
+            break;
+        }
+
+        for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
+        {
+            uint64_t index_a = (ctx->first_row_a + curr_row_a) * matrix_a->num_non_zero + curr_non_zero_a;
+            float value_a = matrix_a->values[index_a];
+
+            if (value_a == 0.0f)
+            {
+                continue;
+            }
+
+            uint64_t base_index_b = load_index(matrix_a, index_a, compact) * matrix_b->num_non_zero;
+
+            for (uint64_t curr_non_zero_b = 0; curr_non_zero_b < matrix_b->num_non_zero; ++curr_non_zero_b)
+            {
+                float value_b = matrix_b->values[base_index_b + curr_non_zero_b];
+
+                if (value_b == 0.0f)
+                {
+                    continue;
+                }
+
+                hash_accumulator_add(&hash, load_index(matrix_b, base_index_b + curr_non_zero_b, compact), value_a * value_b);
+            }
+        }
+
+        // Write the row into its slots in column order
+        uint64_t cnt_non_zero = hash_accumulator_flush(&hash, matrix_result->values + row_begin, matrix_result->indices + row_begin);
+
+        if (cnt_non_zero < row_length)
+        {
+            memset(matrix_result->values + row_begin + cnt_non_zero, 0, (row_length - cnt_non_zero) * sizeof(float));
+            atomic_store_explicit(&ctx->cancelled, true, memory_order_relaxed);
+        }
+    }
+
+    hash_accumulator_free(&hash);
+}
+
+INDEX_WIDTH_TASKS(compute_rows_hash)
+
+// removes entries whose products cancelled to exactly zero (the writer would print them as padding)
+static void remove_cancelled_entries(ELLPACKMatrix *matrix_result)
+{
+    uint64_t pos = 0;
+    uint64_t row_begin = 0;
+
+    for (uint64_t row = 0; row < matrix_result->num_rows; ++row)
+    {
+        uint64_t row_end = matrix_result->row_ptr[row + 1];
+
+        for (uint64_t i = row_begin; i < row_end; ++i)
+        {
+            if (matrix_result->values[i] != 0.0f)
+            {
+                matrix_result->values[pos] = matrix_result->values[i];
+                matrix_result->indices[pos] = matrix_result->indices[i];
+                pos++;
+            }
+        }
+
+        row_begin = row_end;
+        matrix_result->row_ptr[row + 1] = pos;
+    }
+}
+
+// the task of the symbolic phase for the accumulator and the index width
+static parallel_task symbolic_task(AccumulatorType accumulator, bool compact)
+{
+    if (accumulator == ACCUMULATOR_HASH)
+    {
+        return compact ? count_rows_hash_32 : count_rows_hash_64;
+    }
+
+    return compact ? count_rows_32 : count_rows_64;
+}
+
+// the task of the numeric phase for the accumulator and the index width
+static parallel_task numeric_task(AccumulatorType accumulator, bool compact)
+{
+    if (accumulator == ACCUMULATOR_HASH)
+    {
+        return compact ? compute_rows_hash_32 : compute_rows_hash_64;
+    }
+
+    return compact ? compute_rows_32 : compute_rows_64;
+}
+
+void matr_mult_ellpack_V4(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatrix *restrict matrix_b, ELLPACKMatrix *restrict matrix_result, int num_threads, AccumulatorType accumulator)
+{
+    matr_mult_ellpack_V4_rows(matrix_a, matrix_b, matrix_result, 0, matrix_a->num_rows, num_threads, accumulator);
+}
+
+// multiplies the rows [first_row_a, first_row_a + num_rows_a) of matrix_a with matrix_b (used for row blocks in the streaming mode)
+void matr_mult_ellpack_V4_rows(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatrix *restrict matrix_b, ELLPACKMatrix *restrict matrix_result, uint64_t first_row_a, uint64_t num_rows_a, int num_threads, AccumulatorType accumulator)
+{
+    bool free_input_matrix = false;
+
+    // Check if dimensions match
+    if (matrix_a->num_cols != matrix_b->num_rows)
+    {
+        fprintf(stderr, "Matrix dimensions do not match for multiplication (matr_mult_ellpack_V4 (V4))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Initialize dimensions and allocate the row pointers of result_matrix
+    matrix_result->num_rows = num_rows_a;
+    matrix_result->num_cols = matrix_b->num_cols;
+    matrix_result->num_non_zero = 0;
+
+    matrix_result->row_ptr = (uint64_t *)calloc(matrix_result->num_rows + 1, sizeof(uint64_t));
+
+    if (!matrix_result->row_ptr)
+    {
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V4 (V4))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Check if zero matrix
+    if (matrix_a->num_non_zero == 0 || matrix_b->num_non_zero == 0)
+    {
+        return;
+    }
+
+    // Check if both matrices store their indices with the same width
+    if ((matrix_a->indices32 != NULL) != (matrix_b->indices32 != NULL))
+    {
+        free(matrix_result->row_ptr);
+        matrix_result->row_ptr = NULL;
+        fprintf(stderr, "Index widths of the matrices do not match (matr_mult_ellpack_V4 (V4))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    bool compact = matrix_a->indices32 != NULL;
+    V4Context ctx = {matrix_a, matrix_b, matrix_result, first_row_a, NULL, NULL, false, false};
+    ctx.row_non_zero = matrix_result->row_ptr + 1;
+
+    // The hash tables are sized from the flop count of a row, which needs the row lengths of matrix_b
+    if (accumulator == ACCUMULATOR_HASH)
+    {
+        ctx.row_length_b = (uint64_t *)malloc(matrix_b->num_rows * sizeof(uint64_t));
+
+        if (!ctx.row_length_b || parallel_for(num_threads, matrix_b->num_rows, count_rows_b, &ctx) != 0)
+        {
+            free(ctx.row_length_b);
+            free(matrix_result->row_ptr);
+            matrix_result->row_ptr = NULL;
+            fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V4 (V4))\n");
+            free_input_matrix = true;
+            goto free_input_matrix;
+        }
+    }
+
+    // Symbolic phase: count the non-zero entries of every result row
+    int status = parallel_for(num_threads, matrix_result->num_rows, symbolic_task(accumulator, compact), &ctx);
+    free(ctx.row_length_b);
+
+    if (status != 0 || atomic_load(&ctx.failed))
+    {
+        free(matrix_result->row_ptr);
+        matrix_result->row_ptr = NULL;
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V4 (V4))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Turn the row counts into row offsets
+    for (uint64_t row = 0; row < matrix_result->num_rows; ++row)
+    {
+        matrix_result->row_ptr[row + 1] += matrix_result->row_ptr[row];
+    }
+
+    // Allocate exactly the memory needed for all non-zero entries of the result
+    uint64_t total_non_zero = matrix_result->row_ptr[matrix_result->num_rows];
+
+    if (total_non_zero == 0)
+    {
+        return;
+    }
+
+    matrix_result->values = (float *)malloc(total_non_zero * sizeof(float));
+    matrix_result->indices = (uint64_t *)malloc(total_non_zero * sizeof(uint64_t));
+
+    // the numeric phase touches the rows of every thread first, the pages end up on its node
+    numa_advise(matrix_result->values, total_non_zero * sizeof(float));
+    numa_advise(matrix_result->indices, total_non_zero * sizeof(uint64_t));
+
+    if (!matrix_result->values || !matrix_result->indices)
+    {
+        free(matrix_result->values);
+        free(matrix_result->indices);
+        free(matrix_result->row_ptr);
+        matrix_result->values = NULL;
+        matrix_result->indices = NULL;
+        matrix_result->row_ptr = NULL;
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V4 (V4))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Numeric phase: compute the values into the exact-sized buffers
+    if (parallel_for(num_threads, matrix_result->num_rows, numeric_task(accumulator, compact), &ctx) != 0 || atomic_load(&ctx.failed))
+    {
+        free(matrix_result->values);
+        free(matrix_result->indices);
+        free(matrix_result->row_ptr);
+        matrix_result->values = NULL;
+        matrix_result->indices = NULL;
+        matrix_result->row_ptr = NULL;
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V4 (V4))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    if (atomic_load(&ctx.cancelled))
+    {
+        remove_cancelled_entries(matrix_result);
+    }
+
+    // Set number of non-zero elements in result_matrix (the longest row, as in the ELLPACK format)
+    for (uint64_t row = 0; row < matrix_result->num_rows; ++row)
+    {
+        uint64_t cnt_non_zero = matrix_result->row_ptr[row + 1] - matrix_result->row_ptr[row];
+
+        if (cnt_non_zero > matrix_result->num_non_zero)
+        {
+            matrix_result->num_non_zero = cnt_non_zero;
+        }
+    }
+
+free_input_matrix:
+    if (free_input_matrix)
+    {
+        free_input_arrays(matrix_a);
+        free_input_arrays(matrix_b);
+        exit(EXIT_FAILURE);
+    }
+}
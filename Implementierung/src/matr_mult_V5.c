@@ -0,0 +1,413 @@
+#include "ellpack.h"
+#include "parallel.h"
+#include "accumulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <immintrin.h>
+
+// adds value_a * one ELLPACK row of matrix_b (num_non_zero_b slots, padding included) to the accumulator
+typedef void (*row_scatter)(Accumulator *acc, const float *values_b, const uint64_t *indices_b, uint64_t num_non_zero_b, float value_a);
+typedef void (*row_scatter32)(Accumulator *acc, const float *values_b, const uint32_t *indices_b, uint64_t num_non_zero_b, float value_a);
+
+// the routines of one instruction set, for 64-bit and for 32-bit indices
+typedef struct
+{
+    const char *name;
+    row_scatter scatter;
+    row_scatter32 scatter32;
+} ScatterLevel;
+
+typedef struct
+{
+    const ELLPACKMatrix *matrix_a;
+    const ELLPACKMatrix *matrix_b;
+    ELLPACKMatrix *matrix_result;
+    const ScatterLevel *level;
+    atomic_bool failed;
+} V5Context;
+
+// SSE level: x86-64 has no gather/scatter below AVX2, so the slots are added one by one (scalar SSE code)
+static void scatter_sse(Accumulator *acc, const float *values_b, const uint64_t *indices_b, uint64_t num_non_zero_b, float value_a)
+{
+    for (uint64_t k = 0; k < num_non_zero_b; ++k)
+    {
+        if (values_b[k] != 0.0f)
+        {
+            accumulator_add(acc, indices_b[k], value_a * values_b[k]);
+        }
+    }
+}
+
+static void scatter32_sse(Accumulator *acc, const float *values_b, const uint32_t *indices_b, uint64_t num_non_zero_b, float value_a)
+{
+    for (uint64_t k = 0; k < num_non_zero_b; ++k)
+    {
+        if (values_b[k] != 0.0f)
+        {
+            accumulator_add(acc, indices_b[k], value_a * values_b[k]);
+        }
+    }
+}
+
+// AVX2 level: 4 slots per step, the accumulator values are gathered and updated with one FMA, the stores stay scalar (AVX2 has no scatter)
+__attribute__((target("avx2,fma")))
+static void scatter_avx2(Accumulator *acc, const float *values_b, const uint64_t *indices_b, uint64_t num_non_zero_b, float value_a)
+{
+    const __m128 simd_value_a = _mm_set1_ps(value_a);
+    const __m128i simd_generation = _mm_set1_epi32((int)acc->generation);
+    uint64_t k = 0;
+
+    for (; k + 4 <= num_non_zero_b; k += 4)
+    {
+        __m128 simd_values_b = _mm_loadu_ps(values_b + k);
+        __m256i simd_indices_b = _mm256_loadu_si256((const __m256i *)(indices_b + k));
+
+        // padding slots (value 0) are inactive
+        __m128 active = _mm_cmpneq_ps(simd_values_b, _mm_setzero_ps());
+        int active_bits = _mm_movemask_ps(active);
+
+        if (active_bits == 0)
+        {
+            continue;
+        }
+
+        // columns that already belong to the current row keep their value, new columns start at 0
+        __m128i simd_marker = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), (const int *)acc->marker, simd_indices_b, _mm_castps_si128(active), 4);
+        __m128 existing = _mm_and_ps(active, _mm_castsi128_ps(_mm_cmpeq_epi32(simd_marker, simd_generation)));
+        __m128 simd_old = _mm256_mask_i64gather_ps(_mm_setzero_ps(), acc->values, simd_indices_b, existing, 4);
+        __m128 simd_sum = _mm_fmadd_ps(simd_value_a, simd_values_b, simd_old);
+
+        float sum[4];
+        uint64_t col[4];
+        _mm_storeu_ps(sum, simd_sum);
+        _mm256_storeu_si256((__m256i *)col, simd_indices_b);
+
+        int new_bits = active_bits & ~_mm_movemask_ps(existing);
+
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            if (new_bits & (1 << lane))
+            {
+                acc->marker[col[lane]] = acc->generation;
+                acc->touched[acc->num_touched++] = col[lane];
+            }
+
+            if (active_bits & (1 << lane))
+            {
+                acc->values[col[lane]] = sum[lane];
+            }
+        }
+    }
+
+    scatter_sse(acc, values_b + k, indices_b + k, num_non_zero_b - k, value_a);
+}
+
+// AVX2 level with 32-bit indices: a register holds 8 indices, so 8 slots per step
+__attribute__((target("avx2,fma")))
+static void scatter32_avx2(Accumulator *acc, const float *values_b, const uint32_t *indices_b, uint64_t num_non_zero_b, float value_a)
+{
+    const __m256 simd_value_a = _mm256_set1_ps(value_a);
+    const __m256i simd_generation = _mm256_set1_epi32((int)acc->generation);
+    uint64_t k = 0;
+
+    for (; k + 8 <= num_non_zero_b; k += 8)
+    {
+        __m256 simd_values_b = _mm256_loadu_ps(values_b + k);
+        __m256i simd_indices_b = _mm256_loadu_si256((const __m256i *)(indices_b + k));
+
+        // padding slots (value 0) are inactive
+        __m256 active = _mm256_cmp_ps(simd_values_b, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+        int active_bits = _mm256_movemask_ps(active);
+
+        if (active_bits == 0)
+        {
+            continue;
+        }
+
+        // columns that already belong to the current row keep their value, new columns start at 0
+        __m256i simd_marker = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)acc->marker, simd_indices_b, _mm256_castps_si256(active), 4);
+        __m256 existing = _mm256_and_ps(active, _mm256_castsi256_ps(_mm256_cmpeq_epi32(simd_marker, simd_generation)));
+        __m256 simd_old = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), acc->values, simd_indices_b, existing, 4);
+        __m256 simd_sum = _mm256_fmadd_ps(simd_value_a, simd_values_b, simd_old);
+
+        float sum[8];
+        uint32_t col[8];
+        _mm256_storeu_ps(sum, simd_sum);
+        _mm256_storeu_si256((__m256i *)col, simd_indices_b);
+
+        int new_bits = active_bits & ~_mm256_movemask_ps(existing);
+
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            if (new_bits & (1 << lane))
+            {
+                acc->marker[col[lane]] = acc->generation;
+                acc->touched[acc->num_touched++] = col[lane];
+            }
+
+            if (active_bits & (1 << lane))
+            {
+                acc->values[col[lane]] = sum[lane];
+            }
+        }
+    }
+
+    scatter32_sse(acc, values_b + k, indices_b + k, num_non_zero_b - k, value_a);
+}
+
+// AVX-512 level: 8 slots per step with masked gathers, scatters and compress-stores for the touched list
+__attribute__((target("avx512f,avx512cd,avx512vl,fma")))
+static void scatter_avx512(Accumulator *acc, const float *values_b, const uint64_t *indices_b, uint64_t num_non_zero_b, float value_a)
+{
+    const __m256 simd_value_a = _mm256_set1_ps(value_a);
+    const __m256i simd_generation = _mm256_set1_epi32((int)acc->generation);
+
+    for (uint64_t k = 0; k < num_non_zero_b; k += 8)
+    {
+        __mmask8 in_row = num_non_zero_b - k >= 8 ? 0xFF : (__mmask8)((1u << (num_non_zero_b - k)) - 1);
+        __m256 simd_values_b = _mm256_maskz_loadu_ps(in_row, values_b + k);
+
+        // padding slots (value 0) are inactive
+        __mmask8 active = _mm256_mask_cmp_ps_mask(in_row, simd_values_b, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+
+        if (active == 0)
+        {
+            continue;
+        }
+
+        __m512i simd_indices_b = _mm512_maskz_loadu_epi64(active, indices_b + k);
+
+        // the columns of a valid row are distinct, a conflict between active lanes is handled slot by slot
+        __m512i conflicts = _mm512_maskz_conflict_epi64(active, simd_indices_b);
+        if (_mm512_mask_test_epi64_mask(active, conflicts, _mm512_set1_epi64(active)) != 0)
+        {
+            scatter_sse(acc, values_b + k, indices_b + k, num_non_zero_b - k < 8 ? num_non_zero_b - k : 8, value_a);
+            continue;
+        }
+
+        // columns that already belong to the current row keep their value, new columns start at 0
+        __m256i simd_marker = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), active, simd_indices_b, acc->marker, 4);
+        __mmask8 existing = _mm256_mask_cmpeq_epi32_mask(active, simd_marker, simd_generation);
+        __mmask8 new_columns = active & ~existing;
+
+        __m256 simd_old = _mm512_mask_i64gather_ps(_mm256_setzero_ps(), existing, simd_indices_b, acc->values, 4);
+        __m256 simd_sum = _mm256_fmadd_ps(simd_value_a, simd_values_b, simd_old);
+        _mm512_mask_i64scatter_ps(acc->values, active, simd_indices_b, simd_sum, 4);
+
+        if (new_columns != 0)
+        {
+            _mm512_mask_i64scatter_epi32(acc->marker, new_columns, simd_indices_b, simd_generation, 4);
+            _mm512_mask_compressstoreu_epi64(acc->touched + acc->num_touched, new_columns, simd_indices_b);
+            acc->num_touched += __builtin_popcount(new_columns);
+        }
+    }
+}
+
+// AVX-512 level with 32-bit indices: a register holds 16 indices, so 16 slots per step
+__attribute__((target("avx512f,avx512cd,avx512vl,fma")))
+static void scatter32_avx512(Accumulator *acc, const float *values_b, const uint32_t *indices_b, uint64_t num_non_zero_b, float value_a)
+{
+    const __m512 simd_value_a = _mm512_set1_ps(value_a);
+    const __m512i simd_generation = _mm512_set1_epi32((int)acc->generation);
+
+    for (uint64_t k = 0; k < num_non_zero_b; k += 16)
+    {
+        __mmask16 in_row = num_non_zero_b - k >= 16 ? 0xFFFF : (__mmask16)((1u << (num_non_zero_b - k)) - 1);
+        __m512 simd_values_b = _mm512_maskz_loadu_ps(in_row, values_b + k);
+
+        // padding slots (value 0) are inactive
+        __mmask16 active = _mm512_mask_cmp_ps_mask(in_row, simd_values_b, _mm512_setzero_ps(), _CMP_NEQ_UQ);
+
+        if (active == 0)
+        {
+            continue;
+        }
+
+        __m512i simd_indices_b = _mm512_maskz_loadu_epi32(active, indices_b + k);
+
+        // the columns of a valid row are distinct, a conflict between active lanes is handled slot by slot
+        __m512i conflicts = _mm512_maskz_conflict_epi32(active, simd_indices_b);
+        if (_mm512_mask_test_epi32_mask(active, conflicts, _mm512_set1_epi32(active)) != 0)
+        {
+            scatter32_sse(acc, values_b + k, indices_b + k, num_non_zero_b - k < 16 ? num_non_zero_b - k : 16, value_a);
+            continue;
+        }
+
+        // columns that already belong to the current row keep their value, new columns start at 0
+        __m512i simd_marker = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, simd_indices_b, acc->marker, 4);
+        __mmask16 existing = _mm512_mask_cmpeq_epi32_mask(active, simd_marker, simd_generation);
+        __mmask16 new_columns = active & ~existing;
+
+        __m512 simd_old = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), existing, simd_indices_b, acc->values, 4);
+        __m512 simd_sum = _mm512_fmadd_ps(simd_value_a, simd_values_b, simd_old);
+        _mm512_mask_i32scatter_ps(acc->values, active, simd_indices_b, simd_sum, 4);
+
+        if (new_columns != 0)
+        {
+            // the touched list holds 64-bit columns, the two halves are widened and compressed one after the other
+            _mm512_mask_i32scatter_epi32(acc->marker, new_columns, simd_indices_b, simd_generation, 4);
+
+            __mmask8 new_low = (__mmask8)new_columns;
+            __mmask8 new_high = (__mmask8)(new_columns >> 8);
+            _mm512_mask_compressstoreu_epi64(acc->touched + acc->num_touched, new_low, _mm512_cvtepu32_epi64(_mm512_castsi512_si256(simd_indices_b)));
+            acc->num_touched += __builtin_popcount(new_low);
+            _mm512_mask_compressstoreu_epi64(acc->touched + acc->num_touched, new_high, _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(simd_indices_b, 1)));
+            acc->num_touched += __builtin_popcount(new_high);
+        }
+    }
+}
+
+static const ScatterLevel scatter_sse_level = {"SSE", scatter_sse, scatter32_sse};
+static const ScatterLevel scatter_avx2_level = {"AVX2", scatter_avx2, scatter32_avx2};
+static const ScatterLevel scatter_avx512_level = {"AVX-512", scatter_avx512, scatter32_avx512};
+
+// picks the widest instruction set the CPU supports (cpuid), so one binary runs on every x86-64 machine
+static const ScatterLevel *select_scatter(void)
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd") && __builtin_cpu_supports("avx512vl"))
+    {
+        return &scatter_avx512_level;
+    }
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return &scatter_avx2_level;
+    }
+
+    return &scatter_sse_level;
+}
+
+// name of the instruction set that version 5 uses on this CPU
+const char *simd_level_name(void)
+{
+    return select_scatter()->name;
+}
+
+// computes the rows [begin, end) of the result, the slots of matrix_b are processed by the selected SIMD routine
+ALWAYS_INLINE void compute_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V5Context *ctx = (V5Context *)context;
+    const ELLPACKMatrix *matrix_a = ctx->matrix_a;
+    const ELLPACKMatrix *matrix_b = ctx->matrix_b;
+    ELLPACKMatrix *matrix_result = ctx->matrix_result;
+
+    // Allocate the accumulator of this thread, the result rows are carved out of the arena with its own cursor
+    Accumulator acc;
+    ArenaCursor cursor = arena_cursor(matrix_result->arena);
+
+    if (accumulator_init(&acc, matrix_result->num_cols) != 0)
+    {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (uint64_t curr_row_a = begin; curr_row_a < end && !atomic_load_explicit(&ctx->failed, memory_order_relaxed); ++curr_row_a)
+    {
+        // Iterate over non-zero elements of current row of matrix_a
+        for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
+        {
+            uint64_t index_a = curr_row_a * matrix_a->num_non_zero + curr_non_zero_a;
+            float value_a = matrix_a->values[index_a];
+
+            if (value_a == 0.0f)
+            {
+                continue;
+            }
+
+            uint64_t base_index_b = load_index(matrix_a, index_a, compact) * matrix_b->num_non_zero;
+
+            if (compact)
+            {
+                ctx->level->scatter32(&acc, matrix_b->values + base_index_b, matrix_b->indices32 + base_index_b, matrix_b->num_non_zero, value_a);
+            }
+            else
+            {
+                ctx->level->scatter(&acc, matrix_b->values + base_index_b, matrix_b->indices + base_index_b, matrix_b->num_non_zero, value_a);
+            }
+        }
+
+        // Allocate memory for the touched columns of the current row in result_matrix
+        if (acc.num_touched > 0 && result_row_alloc(matrix_result, &cursor, curr_row_a, acc.num_touched) != 0)
+        {
+            atomic_store(&ctx->failed, true);
+            break;
+        }
+
+        matrix_result->row_length[curr_row_a] = accumulator_flush(&acc, matrix_result->result_values[curr_row_a], matrix_result->result_indices[curr_row_a]);
+    }
+
+    accumulator_free(&acc);
+}
+
+INDEX_WIDTH_TASKS(compute_rows)
+
+void matr_mult_ellpack_V5(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatrix *restrict matrix_b, ELLPACKMatrix *restrict matrix_result, int num_threads)
+{
+    bool free_input_matrix = false;
+
+    // Check if dimensions match
+    if (matrix_a->num_cols != matrix_b->num_rows)
+    {
+        fprintf(stderr, "Matrix dimensions do not match for multiplication (matr_mult_ellpack_V5 (V5))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Initialize dimensions and allocate the row pointers of result_matrix
+    matrix_result->num_rows = matrix_a->num_rows;
+    matrix_result->num_cols = matrix_b->num_cols;
+
+    if (result_rows_init(matrix_result) != 0)
+    {
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V5 (V5))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Check if zero matrix
+    if (matrix_a->num_non_zero == 0 || matrix_b->num_non_zero == 0)
+    {
+        return;
+    }
+
+    // Check if both matrices store their indices with the same width
+    if ((matrix_a->indices32 != NULL) != (matrix_b->indices32 != NULL))
+    {
+        free_result_rows(matrix_result);
+        fprintf(stderr, "Index widths of the matrices do not match (matr_mult_ellpack_V5 (V5))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    V5Context ctx = {matrix_a, matrix_b, matrix_result, select_scatter(), false};
+
+    // the gathers and scatters treat 32-bit indices as signed, wider results keep to the scalar routine
+    if (matrix_a->indices32 && matrix_b->num_cols > INT32_MAX)
+    {
+        ctx.level = &scatter_sse_level;
+    }
+
+    // Compute the result rows in parallel
+    if (parallel_for(num_threads, matrix_result->num_rows, matrix_a->indices32 ? compute_rows_32 : compute_rows_64, &ctx) != 0 || atomic_load(&ctx.failed))
+    {
+        free_result_rows(matrix_result);
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V5 (V5))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Set number of non-zero elements in result_matrix (the longest row)
+    result_rows_finish(matrix_result);
+
+free_input_matrix:
+    if (free_input_matrix)
+    {
+        free_input_arrays(matrix_a);
+        free_input_arrays(matrix_b);
+        exit(EXIT_FAILURE);
+    }
+}
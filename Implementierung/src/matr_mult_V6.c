@@ -0,0 +1,161 @@
+#include "ellpack.h"
+#include "sell.h"
+#include "parallel.h"
+#include "accumulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct
+{
+    const SELLMatrix *matrix_a;
+    const SELLMatrix *matrix_b;
+    ELLPACKMatrix *matrix_result;
+    atomic_bool failed;
+} V6Context;
+
+ALWAYS_INLINE uint64_t load_sell_index(const SELLMatrix *matrix, uint64_t slot, bool compact)
+{
+    return compact ? matrix->indices32[slot] : matrix->indices[slot];
+}
+
+// computes the result rows of the chunks [begin, end) of matrix_a, only the stored length of every row is visited
+ALWAYS_INLINE void compute_chunks_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V6Context *ctx = (V6Context *)context;
+    const SELLMatrix *matrix_a = ctx->matrix_a;
+    const SELLMatrix *matrix_b = ctx->matrix_b;
+    ELLPACKMatrix *matrix_result = ctx->matrix_result;
+
+    // Allocate the accumulator of this thread, the result rows are carved out of the arena with its own cursor
+    Accumulator acc;
+    ArenaCursor cursor = arena_cursor(matrix_result->arena);
+
+    if (accumulator_init(&acc, matrix_result->num_cols) != 0)
+    {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    uint64_t last_pos = end * matrix_a->chunk_size < matrix_a->num_rows ? end * matrix_a->chunk_size : matrix_a->num_rows;
+
+    for (uint64_t pos_a = begin * matrix_a->chunk_size; pos_a < last_pos && !atomic_load_explicit(&ctx->failed, memory_order_relaxed); ++pos_a)
+    {
+        uint64_t row_a = matrix_a->row_order[pos_a];
+
+        // Iterate over the entries of the row of matrix_a, the slots of a row are chunk_size apart
+        for (uint64_t j = 0; j < matrix_a->row_length[pos_a]; ++j)
+        {
+            uint64_t slot_a = matrix_a->row_start[pos_a] + j * matrix_a->chunk_size;
+            float value_a = matrix_a->values[slot_a];
+
+            uint64_t pos_b = matrix_b->row_position[load_sell_index(matrix_a, slot_a, compact)];
+            uint64_t row_start_b = matrix_b->row_start[pos_b];
+            uint64_t row_length_b = matrix_b->row_length[pos_b];
+
+            // Accumulate the products with the entries of the row of matrix_b
+            for (uint64_t k = 0; k < row_length_b; ++k)
+            {
+                uint64_t slot_b = row_start_b + k * matrix_b->chunk_size;
+                accumulator_add(&acc, load_sell_index(matrix_b, slot_b, compact), value_a * matrix_b->values[slot_b]);
+            }
+        }
+
+        // Allocate memory for the touched columns of the result row (an upper bound of its non-zero entries)
+        if (acc.num_touched > 0 && result_row_alloc(matrix_result, &cursor, row_a, acc.num_touched) != 0)
+        {
+            atomic_store(&ctx->failed, true);
+            break;
+        }
+
+        // Explicit zeros and cancelled sums are dropped here
+        matrix_result->row_length[row_a] = accumulator_flush(&acc, matrix_result->result_values[row_a], matrix_result->result_indices[row_a]);
+    }
+
+    accumulator_free(&acc);
+}
+
+INDEX_WIDTH_TASKS(compute_chunks)
+
+/*
+Multiplies two SELL-C-sigma matrices into ragged result rows (result_values/result_indices/row_length in the original
+row order, see result_rows_init). Returns -1 if memory is missing, the result arrays are freed then.
+*/
+int matr_mult_sell(const SELLMatrix *restrict matrix_a, const SELLMatrix *restrict matrix_b, ELLPACKMatrix *restrict matrix_result, int num_threads)
+{
+    matrix_result->num_rows = matrix_a->num_rows;
+    matrix_result->num_cols = matrix_b->num_cols;
+
+    if (result_rows_init(matrix_result) != 0)
+    {
+        return -1;
+    }
+
+    V6Context ctx = {matrix_a, matrix_b, matrix_result, false};
+
+    if (parallel_for(num_threads, matrix_a->num_chunks, matrix_a->indices32 ? compute_chunks_32 : compute_chunks_64, &ctx) != 0 || atomic_load(&ctx.failed))
+    {
+        free_result_rows(matrix_result);
+        return -1;
+    }
+
+    result_rows_finish(matrix_result);
+    return 0;
+}
+
+// converts matrix_a to SELL-C-sigma and matrix_b to SELL-1-1 (contiguous rows for the row gathers) and multiplies them
+void matr_mult_ellpack_V6(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatrix *restrict matrix_b, ELLPACKMatrix *restrict matrix_result, int num_threads)
+{
+    bool free_input_matrix = false;
+    SELLMatrix sell_a, sell_b;
+
+    // Check if dimensions match
+    if (matrix_a->num_cols != matrix_b->num_rows)
+    {
+        fprintf(stderr, "Matrix dimensions do not match for multiplication (matr_mult_ellpack_V6 (V6))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Check if both matrices store their indices with the same width (an empty matrix has none, its rows have length 0)
+    if (matrix_a->num_non_zero != 0 && matrix_b->num_non_zero != 0 && (matrix_a->indices32 != NULL) != (matrix_b->indices32 != NULL))
+    {
+        fprintf(stderr, "Index widths of the matrices do not match (matr_mult_ellpack_V6 (V6))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    if (ellpack_to_sell(matrix_a, &sell_a, SELL_CHUNK_SIZE, SELL_SIGMA, num_threads) != 0)
+    {
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V6 (V6))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    if (ellpack_to_sell(matrix_b, &sell_b, 1, 1, num_threads) != 0)
+    {
+        free_sell(&sell_a);
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V6 (V6))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    int status = matr_mult_sell(&sell_a, &sell_b, matrix_result, num_threads);
+    free_sell(&sell_a);
+    free_sell(&sell_b);
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V6 (V6))\n");
+        free_input_matrix = true;
+    }
+
+free_input_matrix:
+    if (free_input_matrix)
+    {
+        free_input_arrays(matrix_a);
+        free_input_arrays(matrix_b);
+        exit(EXIT_FAILURE);
+    }
+}
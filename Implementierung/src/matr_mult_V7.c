@@ -0,0 +1,152 @@
+#include "hybrid.h"
+#include "parallel.h"
+#include "accumulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct
+{
+    const HybridMatrix *matrix_a;
+    const HybridMatrix *matrix_b;
+    ELLPACKMatrix *matrix_result;
+    atomic_bool failed;
+} V7Context;
+
+ALWAYS_INLINE uint64_t ell_index(const HybridMatrix *matrix, uint64_t i, bool compact)
+{
+    return compact ? matrix->indices32[i] : matrix->indices[i];
+}
+
+ALWAYS_INLINE uint64_t coo_index(const HybridMatrix *matrix, uint64_t i, bool compact)
+{
+    return compact ? matrix->coo_indices32[i] : matrix->coo_indices[i];
+}
+
+// adds value_a * row row_b of matrix_b (ELLPACK part and tail) to the accumulator
+ALWAYS_INLINE void add_row_b(Accumulator *acc, const HybridMatrix *matrix_b, uint64_t row_b, float value_a, bool compact)
+{
+    uint64_t base_index_b = row_b * matrix_b->width;
+
+    for (uint64_t curr_non_zero_b = 0; curr_non_zero_b < matrix_b->width; ++curr_non_zero_b)
+    {
+        float value_b = matrix_b->values[base_index_b + curr_non_zero_b];
+
+        if (value_b == 0.0f)
+        {
+            continue;
+        }
+
+        accumulator_add(acc, ell_index(matrix_b, base_index_b + curr_non_zero_b, compact), value_a * value_b);
+    }
+
+    for (uint64_t i = matrix_b->coo_ptr[row_b]; i < matrix_b->coo_ptr[row_b + 1]; ++i)
+    {
+        accumulator_add(acc, coo_index(matrix_b, i, compact), value_a * matrix_b->coo_values[i]);
+    }
+}
+
+// computes the rows [begin, end) of the result, a row of matrix_a is its ELLPACK slots followed by its tail
+ALWAYS_INLINE void compute_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V7Context *ctx = (V7Context *)context;
+    const HybridMatrix *matrix_a = ctx->matrix_a;
+    const HybridMatrix *matrix_b = ctx->matrix_b;
+    ELLPACKMatrix *matrix_result = ctx->matrix_result;
+
+    Accumulator acc;
+    ArenaCursor cursor = arena_cursor(matrix_result->arena);
+
+    if (accumulator_init(&acc, matrix_result->num_cols) != 0)
+    {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (uint64_t curr_row_a = begin; curr_row_a < end && !atomic_load_explicit(&ctx->failed, memory_order_relaxed); ++curr_row_a)
+    {
+        uint64_t base_index_a = curr_row_a * matrix_a->width;
+
+        for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->width; ++curr_non_zero_a)
+        {
+            float value_a = matrix_a->values[base_index_a + curr_non_zero_a];
+
+            if (value_a == 0.0f)
+            {
+                continue;
+            }
+
+            add_row_b(&acc, matrix_b, ell_index(matrix_a, base_index_a + curr_non_zero_a, compact), value_a, compact);
+        }
+
+        for (uint64_t i = matrix_a->coo_ptr[curr_row_a]; i < matrix_a->coo_ptr[curr_row_a + 1]; ++i)
+        {
+            add_row_b(&acc, matrix_b, coo_index(matrix_a, i, compact), matrix_a->coo_values[i], compact);
+        }
+
+        if (acc.num_touched > 0 && result_row_alloc(matrix_result, &cursor, curr_row_a, acc.num_touched) != 0)
+        {
+            atomic_store(&ctx->failed, true);
+            break;
+        }
+
+        matrix_result->row_length[curr_row_a] = accumulator_flush(&acc, matrix_result->result_values[curr_row_a], matrix_result->result_indices[curr_row_a]);
+    }
+
+    accumulator_free(&acc);
+}
+
+INDEX_WIDTH_TASKS(compute_rows)
+
+void matr_mult_ellpack_V7(HybridMatrix *restrict matrix_a, HybridMatrix *restrict matrix_b, ELLPACKMatrix *restrict matrix_result, int num_threads)
+{
+    bool free_input_matrix = false;
+
+    // Check if dimensions match
+    if (matrix_a->num_cols != matrix_b->num_rows)
+    {
+        fprintf(stderr, "Matrix dimensions do not match for multiplication (matr_mult_ellpack_V7 (V7))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Check if both matrices store their indices with the same width
+    if ((matrix_a->indices32 != NULL) != (matrix_b->indices32 != NULL))
+    {
+        fprintf(stderr, "Index widths of the matrices do not match (matr_mult_ellpack_V7 (V7))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    matrix_result->num_rows = matrix_a->num_rows;
+    matrix_result->num_cols = matrix_b->num_cols;
+
+    if (result_rows_init(matrix_result) != 0)
+    {
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V7 (V7))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    V7Context ctx = {matrix_a, matrix_b, matrix_result, false};
+
+    // Compute the result rows in parallel
+    if (parallel_for(num_threads, matrix_result->num_rows, matrix_a->indices32 ? compute_rows_32 : compute_rows_64, &ctx) != 0 || atomic_load(&ctx.failed))
+    {
+        free_result_rows(matrix_result);
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V7 (V7))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    result_rows_finish(matrix_result);
+
+free_input_matrix:
+    if (free_input_matrix)
+    {
+        free_hybrid(matrix_a);
+        free_hybrid(matrix_b);
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,247 @@
+#include "ellpack.h"
+#include "csr.h"
+#include "parallel.h"
+#include "accumulator.h"
+#include "numa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct
+{
+    const CSRMatrix *matrix_a;
+    const CSRMatrix *matrix_b;
+    CSRMatrix *matrix_result;
+    atomic_bool cancelled;
+    atomic_bool failed;
+} V8Context;
+
+ALWAYS_INLINE uint64_t load_csr_index(const CSRMatrix *matrix, uint64_t i, bool compact)
+{
+    return compact ? matrix->indices32[i] : matrix->indices[i];
+}
+
+// symbolic phase: counts the distinct columns of the result rows [begin, end) into row_ptr[row + 1]
+ALWAYS_INLINE void count_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V8Context *ctx = (V8Context *)context;
+    const CSRMatrix *matrix_a = ctx->matrix_a;
+    const CSRMatrix *matrix_b = ctx->matrix_b;
+
+    Accumulator acc;
+
+    if (accumulator_init(&acc, matrix_b->num_cols) != 0)
+    {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (uint64_t row_a = begin; row_a < end; ++row_a)
+    {
+        uint64_t end_a = matrix_a->row_ptr[row_a + 1];
+
+        for (uint64_t i = matrix_a->row_ptr[row_a]; i < end_a; ++i)
+        {
+            uint64_t row_b = load_csr_index(matrix_a, i, compact);
+            uint64_t end_b = matrix_b->row_ptr[row_b + 1];
+
+            for (uint64_t j = matrix_b->row_ptr[row_b]; j < end_b; ++j)
+            {
+                accumulator_touch(&acc, load_csr_index(matrix_b, j, compact));
+            }
+        }
+
+        ctx->matrix_result->row_ptr[row_a + 1] = acc.num_touched;
+        accumulator_next_row(&acc);
+    }
+
+    accumulator_free(&acc);
+}
+
+INDEX_WIDTH_TASKS(count_rows)
+
+// numeric phase: Gustavson's row-by-row product, every row is written straight into its exact-sized slots
+ALWAYS_INLINE void compute_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V8Context *ctx = (V8Context *)context;
+    const CSRMatrix *matrix_a = ctx->matrix_a;
+    const CSRMatrix *matrix_b = ctx->matrix_b;
+    CSRMatrix *matrix_result = ctx->matrix_result;
+
+    Accumulator acc;
+
+    if (accumulator_init(&acc, matrix_result->num_cols) != 0)
+    {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (uint64_t row_a = begin; row_a < end; ++row_a)
+    {
+        uint64_t row_begin = matrix_result->row_ptr[row_a];
+        uint64_t row_length = matrix_result->row_ptr[row_a + 1] - row_begin;
+
+        // the row bounds are kept in locals, the stores of the accumulator could alias row_ptr otherwise
+        uint64_t end_a = matrix_a->row_ptr[row_a + 1];
+
+        for (uint64_t i = matrix_a->row_ptr[row_a]; i < end_a; ++i)
+        {
+            float value_a = matrix_a->values[i];
+            uint64_t row_b = load_csr_index(matrix_a, i, compact);
+            uint64_t end_b = matrix_b->row_ptr[row_b + 1];
+
+            for (uint64_t j = matrix_b->row_ptr[row_b]; j < end_b; ++j)
+            {
+                accumulator_add(&acc, load_csr_index(matrix_b, j, compact), value_a * matrix_b->values[j]);
+            }
+        }
+
+        // entries that cancelled to zero leave zero slots at the end of the row
+        uint64_t cnt_non_zero = accumulator_flush(&acc, matrix_result->values + row_begin, matrix_result->indices + row_begin);
+
+        if (cnt_non_zero < row_length)
+        {
+            memset(matrix_result->values + row_begin + cnt_non_zero, 0, (row_length - cnt_non_zero) * sizeof(float));
+            atomic_store_explicit(&ctx->cancelled, true, memory_order_relaxed);
+        }
+    }
+
+    accumulator_free(&acc);
+}
+
+INDEX_WIDTH_TASKS(compute_rows)
+
+// removes entries whose products cancelled to exactly zero, so that the result holds non-zero entries only
+static void remove_cancelled_entries(CSRMatrix *matrix_result)
+{
+    uint64_t pos = 0;
+    uint64_t row_begin = 0;
+
+    for (uint64_t row = 0; row < matrix_result->num_rows; ++row)
+    {
+        uint64_t row_end = matrix_result->row_ptr[row + 1];
+
+        for (uint64_t i = row_begin; i < row_end; ++i)
+        {
+            if (matrix_result->values[i] != 0.0f)
+            {
+                matrix_result->values[pos] = matrix_result->values[i];
+                matrix_result->indices[pos] = matrix_result->indices[i];
+                pos++;
+            }
+        }
+
+        row_begin = row_end;
+        matrix_result->row_ptr[row + 1] = pos;
+    }
+}
+
+/*
+Multiplies two CSR matrices with the same index width into a CSR result with 64-bit indices, in a symbolic and a
+numeric phase like version 4. Returns -1 if memory is missing (the result is empty then).
+*/
+int matr_mult_csr(const CSRMatrix *restrict matrix_a, const CSRMatrix *restrict matrix_b, CSRMatrix *restrict matrix_result, int num_threads)
+{
+    memset(matrix_result, 0, sizeof(*matrix_result));
+    matrix_result->num_rows = matrix_a->num_rows;
+    matrix_result->num_cols = matrix_b->num_cols;
+    matrix_result->row_ptr = (uint64_t *)calloc(matrix_result->num_rows + 1, sizeof(uint64_t));
+
+    if (!matrix_result->row_ptr)
+    {
+        return -1;
+    }
+
+    bool compact = matrix_a->indices32 != NULL;
+    V8Context ctx = {matrix_a, matrix_b, matrix_result, false, false};
+
+    // Symbolic phase: count the non-zero entries of every result row and turn the counts into row offsets
+    if (parallel_for(num_threads, matrix_result->num_rows, compact ? count_rows_32 : count_rows_64, &ctx) != 0 || atomic_load(&ctx.failed))
+    {
+        free_csr(matrix_result);
+        return -1;
+    }
+
+    for (uint64_t row = 0; row < matrix_result->num_rows; ++row)
+    {
+        matrix_result->row_ptr[row + 1] += matrix_result->row_ptr[row];
+    }
+
+    uint64_t total_non_zero = matrix_result->row_ptr[matrix_result->num_rows];
+
+    if (total_non_zero == 0)
+    {
+        return 0;
+    }
+
+    matrix_result->values = (float *)malloc(total_non_zero * sizeof(float));
+    matrix_result->indices = (uint64_t *)malloc(total_non_zero * sizeof(uint64_t));
+
+    // the numeric phase touches the rows of every thread first, the pages end up on its node
+    numa_advise(matrix_result->values, total_non_zero * sizeof(float));
+    numa_advise(matrix_result->indices, total_non_zero * sizeof(uint64_t));
+
+    if (!matrix_result->values || !matrix_result->indices)
+    {
+        free_csr(matrix_result);
+        return -1;
+    }
+
+    // Numeric phase: compute the values into the exact-sized buffers
+    if (parallel_for(num_threads, matrix_result->num_rows, compact ? compute_rows_32 : compute_rows_64, &ctx) != 0 || atomic_load(&ctx.failed))
+    {
+        free_csr(matrix_result);
+        return -1;
+    }
+
+    if (atomic_load(&ctx.cancelled))
+    {
+        remove_cancelled_entries(matrix_result);
+    }
+
+    return 0;
+}
+
+void matr_mult_ellpack_V8(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatrix *restrict matrix_b, ELLPACKMatrix *restrict matrix_result, int num_threads)
+{
+    bool free_input_matrix = false;
+    CSRMatrix csr_a = {0}, csr_b = {0}, csr_result = {0};
+
+    // Check if dimensions match
+    if (matrix_a->num_cols != matrix_b->num_rows)
+    {
+        fprintf(stderr, "Matrix dimensions do not match for multiplication (matr_mult_ellpack_V8 (V8))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Check if both matrices store their indices with the same width (an empty matrix has none, its rows have length 0)
+    if (matrix_a->num_non_zero != 0 && matrix_b->num_non_zero != 0 && (matrix_a->indices32 != NULL) != (matrix_b->indices32 != NULL))
+    {
+        fprintf(stderr, "Index widths of the matrices do not match (matr_mult_ellpack_V8 (V8))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Convert the inputs to CSR, multiply without padding and hand the result over as compressed rows
+    if (ellpack_to_csr(matrix_a, &csr_a, num_threads) != 0 || ellpack_to_csr(matrix_b, &csr_b, num_threads) != 0 ||
+        matr_mult_csr(&csr_a, &csr_b, &csr_result, num_threads) != 0 || csr_to_ellpack(&csr_result, matrix_result) != 0)
+    {
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V8 (V8))\n");
+        free_input_matrix = true;
+    }
+
+    free_csr(&csr_a);
+    free_csr(&csr_b);
+    free_csr(&csr_result);
+
+free_input_matrix:
+    if (free_input_matrix)
+    {
+        free_input_arrays(matrix_a);
+        free_input_arrays(matrix_b);
+        exit(EXIT_FAILURE);
+    }
+}
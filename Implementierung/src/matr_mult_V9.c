@@ -0,0 +1,371 @@
+#include "ellpack.h"
+#include "parallel.h"
+#include "accumulator.h"
+#include "autoselect.h"
+#include "csr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// the accumulator of a panel (value, marker and touched slot per column) takes at most half of the L2 cache
+#define PANEL_BYTES_PER_COL (sizeof(float) + sizeof(uint32_t) + sizeof(uint64_t))
+#define PANEL_MIN_WIDTH 1024
+
+/*
+Version 9 splits the columns of B into panels whose dense accumulator fits into the L2 cache and computes every row of
+A panel by panel. The rows of B are sorted by column once (as CSR), so the entries of a row of B that fall into a panel
+are contiguous: every entry of the row of A keeps a cursor into its row of B that only moves forward.
+*/
+typedef struct
+{
+    const ELLPACKMatrix *matrix_a;
+    CSRMatrix *matrix_b; // sorted by the pre-pass
+    ELLPACKMatrix *matrix_result;
+    uint64_t panel_width; // a power of two
+    uint32_t panel_shift;
+    atomic_bool failed;
+} V9Context;
+
+// an entry of the current row of A with its cursor into the sorted row of B
+typedef struct
+{
+    float value;
+    uint64_t next;
+    uint64_t end;
+} PanelEntry;
+
+typedef struct
+{
+    uint64_t col;
+    float value;
+} SortEntry;
+
+static int compare_sort_entries(const void *first, const void *second)
+{
+    uint64_t col_first = ((const SortEntry *)first)->col;
+    uint64_t col_second = ((const SortEntry *)second)->col;
+    return (col_first > col_second) - (col_first < col_second);
+}
+
+// sorts the rows [begin, end) of B by column, rows that are already sorted (the usual case) are only checked
+ALWAYS_INLINE void sort_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V9Context *ctx = (V9Context *)context;
+    CSRMatrix *csr = ctx->matrix_b;
+    SortEntry *entries = NULL;
+    uint64_t allocated = 0;
+
+    for (uint64_t row = begin; row < end; ++row)
+    {
+        uint64_t row_begin = csr->row_ptr[row];
+        uint64_t length = csr->row_ptr[row + 1] - row_begin;
+        bool sorted = true;
+
+        for (uint64_t j = 1; j < length && sorted; ++j)
+        {
+            sorted = (compact ? csr->indices32[row_begin + j - 1] : csr->indices[row_begin + j - 1]) <
+                     (compact ? csr->indices32[row_begin + j] : csr->indices[row_begin + j]);
+        }
+
+        if (sorted)
+        {
+            continue;
+        }
+
+        if (length > allocated)
+        {
+            free(entries);
+            allocated = length;
+            entries = (SortEntry *)malloc(allocated * sizeof(SortEntry));
+
+            if (!entries)
+            {
+                atomic_store(&ctx->failed, true);
+                return;
+            }
+        }
+
+        for (uint64_t j = 0; j < length; ++j)
+        {
+            entries[j].col = compact ? csr->indices32[row_begin + j] : csr->indices[row_begin + j];
+            entries[j].value = csr->values[row_begin + j];
+        }
+
+        qsort(entries, length, sizeof(SortEntry), compare_sort_entries);
+
+        for (uint64_t j = 0; j < length; ++j)
+        {
+            csr->values[row_begin + j] = entries[j].value;
+
+            if (compact)
+            {
+                csr->indices32[row_begin + j] = (uint32_t)entries[j].col;
+            }
+            else
+            {
+                csr->indices[row_begin + j] = entries[j].col;
+            }
+        }
+    }
+
+    free(entries);
+}
+
+INDEX_WIDTH_TASKS(sort_rows)
+
+// makes room for length entries in the row buffer of a thread
+static int reserve_row(float **values, uint64_t **indices, uint64_t *allocated, uint64_t length)
+{
+    if (length <= *allocated)
+    {
+        return 0;
+    }
+
+    uint64_t grown = *allocated ? *allocated : 64;
+
+    while (grown < length)
+    {
+        grown *= 2;
+    }
+
+    float *grown_values = (float *)realloc(*values, grown * sizeof(float));
+
+    if (grown_values)
+    {
+        *values = grown_values;
+    }
+
+    uint64_t *grown_indices = (uint64_t *)realloc(*indices, grown * sizeof(uint64_t));
+
+    if (grown_indices)
+    {
+        *indices = grown_indices;
+    }
+
+    if (!grown_values || !grown_indices)
+    {
+        return -1;
+    }
+
+    *allocated = grown;
+    return 0;
+}
+
+// computes the rows [begin, end) of the result panel by panel, the accumulator only spans one panel
+ALWAYS_INLINE void compute_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    V9Context *ctx = (V9Context *)context;
+    const ELLPACKMatrix *matrix_a = ctx->matrix_a;
+    const CSRMatrix *matrix_b = ctx->matrix_b;
+    ELLPACKMatrix *matrix_result = ctx->matrix_result;
+
+    Accumulator acc;
+    ArenaCursor cursor = arena_cursor(matrix_result->arena);
+    PanelEntry *entries = (PanelEntry *)pool_alloc((matrix_a->num_non_zero + 1) * sizeof(PanelEntry));
+    float *row_values = NULL;
+    uint64_t *row_indices = NULL;
+    uint64_t allocated = 0;
+
+    if (!entries || accumulator_init(&acc, ctx->panel_width) != 0)
+    {
+        pool_free(entries);
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (uint64_t curr_row_a = begin; curr_row_a < end && !atomic_load_explicit(&ctx->failed, memory_order_relaxed); ++curr_row_a)
+    {
+        uint64_t num_entries = 0;
+
+        // the rows of B that the non-zero entries of the row of A meet, empty rows of B are left out
+        for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
+        {
+            uint64_t index_a = curr_row_a * matrix_a->num_non_zero + curr_non_zero_a;
+            float value_a = matrix_a->values[index_a];
+
+            if (value_a == 0.0f)
+            {
+                continue;
+            }
+
+            uint64_t row_b = load_index(matrix_a, index_a, compact);
+            PanelEntry entry = {value_a, matrix_b->row_ptr[row_b], matrix_b->row_ptr[row_b + 1]};
+
+            if (entry.next < entry.end)
+            {
+                entries[num_entries++] = entry;
+            }
+        }
+
+        uint64_t row_length = 0;
+
+        while (num_entries > 0)
+        {
+            // the next panel is the one of the smallest column that is still left, panels without entries are skipped
+            uint64_t first_col = UINT64_MAX;
+
+            for (uint64_t e = 0; e < num_entries; ++e)
+            {
+                uint64_t col = compact ? matrix_b->indices32[entries[e].next] : matrix_b->indices[entries[e].next];
+                first_col = col < first_col ? col : first_col;
+            }
+
+            uint64_t panel_begin = first_col >> ctx->panel_shift << ctx->panel_shift;
+            uint64_t panel_end = panel_begin + ctx->panel_width;
+
+            for (uint64_t e = 0; e < num_entries;)
+            {
+                PanelEntry *entry = &entries[e];
+
+                for (; entry->next < entry->end; ++entry->next)
+                {
+                    uint64_t col = compact ? matrix_b->indices32[entry->next] : matrix_b->indices[entry->next];
+
+                    if (col >= panel_end)
+                    {
+                        break;
+                    }
+
+                    accumulator_add(&acc, col - panel_begin, entry->value * matrix_b->values[entry->next]);
+                }
+
+                // an entry whose row of B is done is replaced by the last one
+                if (entry->next == entry->end)
+                {
+                    *entry = entries[--num_entries];
+                }
+                else
+                {
+                    e++;
+                }
+            }
+
+            if (reserve_row(&row_values, &row_indices, &allocated, row_length + acc.num_touched) != 0)
+            {
+                atomic_store(&ctx->failed, true);
+                break;
+            }
+
+            // the panel is flushed in column order behind the panels before it, so the row stays sorted
+            uint64_t cnt_non_zero = accumulator_flush(&acc, row_values + row_length, row_indices + row_length);
+
+            for (uint64_t j = row_length; j < row_length + cnt_non_zero; ++j)
+            {
+                row_indices[j] += panel_begin;
+            }
+
+            row_length += cnt_non_zero;
+        }
+
+        if (row_length > 0)
+        {
+            if (result_row_alloc(matrix_result, &cursor, curr_row_a, row_length) != 0)
+            {
+                atomic_store(&ctx->failed, true);
+                break;
+            }
+
+            memcpy(matrix_result->result_values[curr_row_a], row_values, row_length * sizeof(float));
+            memcpy(matrix_result->result_indices[curr_row_a], row_indices, row_length * sizeof(uint64_t));
+        }
+
+        matrix_result->row_length[curr_row_a] = row_length;
+    }
+
+    accumulator_free(&acc);
+    pool_free(entries);
+    free(row_values);
+    free(row_indices);
+}
+
+INDEX_WIDTH_TASKS(compute_rows)
+
+// panel width from the L2 cache: a power of two, at least PANEL_MIN_WIDTH and not wider than needed for num_cols
+static uint32_t panel_shift(uint64_t num_cols)
+{
+    uint64_t width = level2_cache() / 2 / PANEL_BYTES_PER_COL;
+    uint32_t shift = 0;
+
+    while ((2ULL << shift) <= width || (1ULL << shift) < PANEL_MIN_WIDTH)
+    {
+        shift++;
+    }
+
+    while (shift > 0 && (1ULL << (shift - 1)) >= num_cols)
+    {
+        shift--;
+    }
+
+    return shift;
+}
+
+void matr_mult_ellpack_V9(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatrix *restrict matrix_b, ELLPACKMatrix *restrict matrix_result, int num_threads)
+{
+    bool free_input_matrix = false;
+    CSRMatrix csr_b = {0};
+
+    // Check if dimensions match
+    if (matrix_a->num_cols != matrix_b->num_rows)
+    {
+        fprintf(stderr, "Matrix dimensions do not match for multiplication (matr_mult_ellpack_V9 (V9))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Initialize dimensions and allocate the row pointers of result_matrix
+    matrix_result->num_rows = matrix_a->num_rows;
+    matrix_result->num_cols = matrix_b->num_cols;
+
+    if (result_rows_init(matrix_result) != 0)
+    {
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V9 (V9))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    // Check if zero matrix
+    if (matrix_a->num_non_zero == 0 || matrix_b->num_non_zero == 0)
+    {
+        return;
+    }
+
+    // Check if both matrices store their indices with the same width
+    if ((matrix_a->indices32 != NULL) != (matrix_b->indices32 != NULL))
+    {
+        free_result_rows(matrix_result);
+        fprintf(stderr, "Index widths of the matrices do not match (matr_mult_ellpack_V9 (V9))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    bool compact = matrix_a->indices32 != NULL;
+    uint32_t shift = panel_shift(matrix_b->num_cols);
+    V9Context ctx = {matrix_a, &csr_b, matrix_result, 1ULL << shift, shift, false};
+
+    // Pre-pass: B as CSR with its rows sorted by column, then the result rows in parallel
+    if (ellpack_to_csr(matrix_b, &csr_b, num_threads) != 0 ||
+        parallel_for(num_threads, csr_b.num_rows, compact ? sort_rows_32 : sort_rows_64, &ctx) != 0 || atomic_load(&ctx.failed) ||
+        parallel_for(num_threads, matrix_result->num_rows, compact ? compute_rows_32 : compute_rows_64, &ctx) != 0 || atomic_load(&ctx.failed))
+    {
+        free_csr(&csr_b);
+        free_result_rows(matrix_result);
+        fprintf(stderr, "Memory allocation failed (matr_mult_ellpack_V9 (V9))\n");
+        free_input_matrix = true;
+        goto free_input_matrix;
+    }
+
+    free_csr(&csr_b);
+
+    // Set number of non-zero elements in result_matrix (the longest row)
+    result_rows_finish(matrix_result);
+
+free_input_matrix:
+    if (free_input_matrix)
+    {
+        free_input_arrays(matrix_a);
+        free_input_arrays(matrix_b);
+        exit(EXIT_FAILURE);
+    }
+}
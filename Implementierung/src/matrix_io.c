@@ -2,332 +2,1897 @@
 
 #include "ellpack.h"
 #include "matrix_io.h"
+#include "format.h"
+#include "hybrid.h"
+#include "parallel.h"
 #include <stdlib.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
-int read_matrix(const char *restrict filename, ELLPACKMatrix *restrict matrix)
+// powers of ten that are exact in double precision
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline bool is_blank(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+// scans an unsigned integer, returns -1 if there is no digit or the value does not fit in 64 bits
+static int scan_uint64(const char **pos, const char *end, uint64_t *value)
+{
+    const char *curr = *pos;
+    uint64_t result = 0;
+
+    if (curr == end || *curr < '0' || *curr > '9')
+    {
+        return -1;
+    }
+
+    while (curr < end && *curr >= '0' && *curr <= '9')
+    {
+        uint64_t digit = (uint64_t)(*curr - '0');
+
+        if (result > (UINT64_MAX - digit) / 10)
+        {
+            return -1;
+        }
+
+        result = result * 10 + digit;
+        curr++;
+    }
+
+    *value = result;
+    *pos = curr;
+    return 0;
+}
+
+// converts the token [*pos, token_end) with strtof on a terminated copy, long tokens get a heap buffer
+static int scan_float_strtof(const char **pos, const char *token_end, float *value)
+{
+    char small[128];
+    size_t length = (size_t)(token_end - *pos);
+    char *token = length < sizeof(small) ? small : (char *)malloc(length + 1);
+
+    if (length == 0 || !token)
+    {
+        return -1;
+    }
+
+    memcpy(token, *pos, length);
+    token[length] = '\0';
+
+    char *parsed_end;
+    *value = strtof(token, &parsed_end);
+    bool complete = parsed_end == token + length;
+
+    if (token != small)
+    {
+        free(token);
+    }
+
+    if (!complete)
+    {
+        return -1;
+    }
+
+    *pos = token_end;
+    return 0;
+}
+
+/*
+Scans a float token that ends at the next comma, blank or end. Decimal tokens ([sign] digits [. digits] [e [sign]
+digits]) are converted here if that is exact; everything else, like long expansions, inf, nan and hex floats, goes
+through strtof like the old fscanf("%f") parser. Returns -1 if the token is no number.
+*/
+static int scan_float(const char **pos, const char *end, float *value)
+{
+    const char *curr = *pos;
+    const char *token_end = curr;
+
+    while (token_end < end && *token_end != ',' && !is_blank(*token_end))
+    {
+        token_end++;
+    }
+
+    bool negative = false;
+    uint64_t mantissa = 0;
+    int num_digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+
+    if (curr < end && (*curr == '-' || *curr == '+'))
+    {
+        negative = *curr == '-';
+        curr++;
+    }
+
+    // digits before and after the decimal point, only the first 19 significant digits fit in the mantissa
+    for (; curr < end && *curr >= '0' && *curr <= '9'; curr++, any_digit = true)
+    {
+        if (num_digits < 19)
+        {
+            mantissa = mantissa * 10 + (uint64_t)(*curr - '0');
+            num_digits += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+
+    if (curr < end && *curr == '.')
+    {
+        curr++;
+
+        for (; curr < end && *curr >= '0' && *curr <= '9'; curr++, any_digit = true)
+        {
+            if (num_digits < 19)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*curr - '0');
+                num_digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+
+    if (!any_digit)
+    {
+        return scan_float_strtof(pos, token_end, value);
+    }
+
+    if (curr < end && (*curr == 'e' || *curr == 'E'))
+    {
+        const char *exp_pos = curr + 1;
+        bool exp_negative = false;
+        int exp_value = 0;
+
+        if (exp_pos < end && (*exp_pos == '-' || *exp_pos == '+'))
+        {
+            exp_negative = *exp_pos == '-';
+            exp_pos++;
+        }
+
+        if (exp_pos == end || *exp_pos < '0' || *exp_pos > '9')
+        {
+            return scan_float_strtof(pos, token_end, value);
+        }
+
+        for (; exp_pos < end && *exp_pos >= '0' && *exp_pos <= '9'; exp_pos++)
+        {
+            if (exp_value < 10000)
+            {
+                exp_value = exp_value * 10 + (*exp_pos - '0');
+            }
+        }
+
+        exponent += exp_negative ? -exp_value : exp_value;
+        curr = exp_pos;
+    }
+
+    /*
+    Fast path: mantissa and power of ten are exact doubles, so the double result is rounded once.
+    Rounding it to float is then correct unless it lies exactly on the midpoint of two floats.
+    */
+    if (curr != token_end)
+    {
+        return scan_float_strtof(pos, token_end, value);
+    }
+
+    if (mantissa == 0)
+    {
+        *value = negative ? -0.0f : 0.0f;
+        *pos = curr;
+        return 0;
+    }
+
+    if (mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22)
+    {
+        double result = exponent < 0 ? (double)mantissa / exact_powers_of_ten[-exponent] : (double)mantissa * exact_powers_of_ten[exponent];
+        uint64_t bits;
+        memcpy(&bits, &result, sizeof(bits));
+
+        if (result >= 1.17549435e-38 && result <= 3.40282347e38 && (bits & 0x1FFFFFFF) != 0x10000000)
+        {
+            *value = (float)(negative ? -result : result);
+            *pos = curr;
+            return 0;
+        }
+    }
+
+    // Slow path: strtof on a terminated copy of the token
+    return scan_float_strtof(pos, token_end, value);
+}
+
+/*
+Parses one line of comma-separated tokens ('*' or a number) into values (if values != NULL), indices32 (if indices32 != NULL) or indices.
+Indices that do not fit into 32 bits are stored as UINT32_MAX in indices32, which is out of range for every matrix with 32-bit indices.
+At most max_tokens tokens are stored, the return value is the number of tokens in the line or -1 for a malformed token.
+*/
+static int64_t parse_line(const char *pos, const char *end, float *values, uint64_t *indices, uint32_t *indices32, uint64_t max_tokens)
+{
+    uint64_t count = 0;
+
+    while (pos < end && is_blank(*pos))
+    {
+        pos++;
+    }
+
+    if (pos == end)
+    {
+        return 0;
+    }
+
+    while (true)
+    {
+        while (pos < end && is_blank(*pos))
+        {
+            pos++;
+        }
+
+        if (pos < end && *pos == '*')
+        {
+            pos++;
+
+            if (count < max_tokens)
+            {
+                if (values)
+                {
+                    values[count] = 0.0f;
+                }
+                else if (indices32)
+                {
+                    indices32[count] = 0;
+                }
+                else
+                {
+                    indices[count] = 0;
+                }
+            }
+        }
+        else if (count < max_tokens)
+        {
+            if (values)
+            {
+                if (scan_float(&pos, end, &values[count]) != 0)
+                {
+                    return -1;
+                }
+            }
+            else if (indices32)
+            {
+                uint64_t index;
+                if (scan_uint64(&pos, end, &index) != 0)
+                {
+                    return -1;
+                }
+                indices32[count] = index < UINT32_MAX ? (uint32_t)index : UINT32_MAX;
+            }
+            else if (scan_uint64(&pos, end, &indices[count]) != 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            // the line has too many tokens, they are only counted
+            while (pos < end && *pos != ',')
+            {
+                pos++;
+            }
+        }
+
+        count++;
+
+        while (pos < end && is_blank(*pos))
+        {
+            pos++;
+        }
+
+        if (pos == end)
+        {
+            return (int64_t)count;
+        }
+
+        if (*pos != ',')
+        {
+            return -1;
+        }
+
+        pos++;
+    }
+}
+
+// a thread parses at least this many bytes of a line, shorter lines are parsed by the calling thread alone
+#define PARSE_CHUNK_MIN_BYTES (1u << 20)
+#define PARSE_MAX_CHUNKS 256
+
+/*
+A line split into chunks that start at a token: chunk i is [bounds[i], bounds[i + 1]), every chunk but the one at the
+end of the line ends with the ',' after its last token. tokens[i] is first the number of tokens of chunk i and then,
+after the prefix sum, the position of its first token in the output arrays.
+*/
+typedef struct
+{
+    const char *end;
+    float *values;
+    uint64_t *indices;
+    uint32_t *indices32;
+    uint64_t max_tokens;
+    const char *bounds[PARSE_MAX_CHUNKS + 1];
+    uint64_t tokens[PARSE_MAX_CHUNKS + 1];
+    bool failed[PARSE_MAX_CHUNKS];
+} LineChunks;
+
+static void count_chunk_tokens(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    LineChunks *chunks = (LineChunks *)context;
+
+    for (uint64_t i = begin; i < end; ++i)
+    {
+        const char *pos = chunks->bounds[i];
+        const char *chunk_end = chunks->bounds[i + 1];
+        uint64_t commas = 0;
+
+        for (; pos < chunk_end; pos++)
+        {
+            commas += *pos == ',';
+        }
+
+        // the token after the last ',' of the line belongs to the chunk that reaches the end
+        chunks->tokens[i] = commas + (chunk_end == chunks->end && chunks->bounds[i] < chunk_end);
+    }
+}
+
+// parses every chunk straight into its slice of the output arrays, the tokens beyond max_tokens are only counted
+static void parse_chunk(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    LineChunks *chunks = (LineChunks *)context;
+
+    for (uint64_t i = begin; i < end; ++i)
+    {
+        const char *chunk_end = chunks->bounds[i + 1];
+        uint64_t first = chunks->tokens[i];
+        uint64_t expected = chunks->tokens[i + 1] - first;
+
+        if (expected == 0)
+        {
+            continue;
+        }
+
+        if (chunk_end != chunks->end)
+        {
+            chunk_end--;
+        }
+
+        uint64_t offset = first < chunks->max_tokens ? first : chunks->max_tokens;
+        int64_t count = parse_line(chunks->bounds[i], chunk_end,
+                                   chunks->values ? chunks->values + offset : NULL,
+                                   chunks->indices ? chunks->indices + offset : NULL,
+                                   chunks->indices32 ? chunks->indices32 + offset : NULL,
+                                   chunks->max_tokens - offset);
+
+        // a token that is missing (",,") or malformed makes the counts differ
+        chunks->failed[i] = count < 0 || (uint64_t)count != expected;
+    }
+}
+
+/*
+parse_line on num_threads threads: the line is cut into byte ranges at the ',' after each nominal boundary, a first pass
+counts the tokens of every range and a second one parses each range into its slice of the arrays. The result is the
+same as that of parse_line, except that a malformed line is always reported as -1.
+*/
+static int64_t parse_line_parallel(const char *pos, const char *end, float *values, uint64_t *indices, uint32_t *indices32, uint64_t max_tokens, int num_threads)
+{
+    uint64_t length = (uint64_t)(end - pos);
+    uint64_t num_chunks = length / PARSE_CHUNK_MIN_BYTES;
+
+    if (num_chunks > (uint64_t)num_threads)
+    {
+        num_chunks = (uint64_t)num_threads;
+    }
+
+    if (num_chunks > PARSE_MAX_CHUNKS)
+    {
+        num_chunks = PARSE_MAX_CHUNKS;
+    }
+
+    if (num_chunks < 2)
+    {
+        return parse_line(pos, end, values, indices, indices32, max_tokens);
+    }
+
+    LineChunks *chunks = (LineChunks *)malloc(sizeof(LineChunks));
+
+    if (!chunks)
+    {
+        return parse_line(pos, end, values, indices, indices32, max_tokens);
+    }
+
+    chunks->end = end;
+    chunks->values = values;
+    chunks->indices = indices;
+    chunks->indices32 = indices32;
+    chunks->max_tokens = max_tokens;
+    chunks->bounds[0] = pos;
+    chunks->bounds[num_chunks] = end;
+
+    for (uint64_t i = 1; i < num_chunks; ++i)
+    {
+        const char *nominal = pos + length / num_chunks * i;
+
+        if (nominal < chunks->bounds[i - 1])
+        {
+            nominal = chunks->bounds[i - 1];
+        }
+
+        const char *comma = memchr(nominal, ',', (size_t)(end - nominal));
+        chunks->bounds[i] = comma ? comma + 1 : end;
+    }
+
+    int64_t count = -1;
+
+    if (parallel_for((int)num_chunks, num_chunks, count_chunk_tokens, chunks) == 0)
+    {
+        uint64_t total = 0;
+
+        for (uint64_t i = 0; i < num_chunks; ++i)
+        {
+            uint64_t tokens = chunks->tokens[i];
+            chunks->tokens[i] = total;
+            total += tokens;
+        }
+
+        // one more entry so that every chunk finds its end in tokens[i + 1]
+        chunks->tokens[num_chunks] = total;
+
+        if (parallel_for((int)num_chunks, num_chunks, parse_chunk, chunks) == 0)
+        {
+            count = (int64_t)total;
+
+            for (uint64_t i = 0; i < num_chunks; ++i)
+            {
+                if (chunks->failed[i])
+                {
+                    count = -1;
+                }
+            }
+        }
+    }
+
+    free(chunks);
+    return count;
+}
+
+// returns the end of the line that starts at pos (the '\n' or the end of the file)
+static const char *find_line_end(const char *pos, const char *end)
+{
+    const char *newline = memchr(pos, '\n', (size_t)(end - pos));
+    return newline ? newline : end;
+}
+
+// true if [pos, end) only contains blanks
+static bool is_blank_line(const char *pos, const char *end)
+{
+    while (pos < end && is_blank(*pos))
+    {
+        pos++;
+    }
+
+    return pos == end;
+}
+
+// header of the binary ELLPACK format, followed by the values (float) and the indices (index_bytes wide) at 64-byte aligned offsets
+typedef struct
+{
+    char magic[8];
+    uint32_t format_version;
+    uint32_t index_bytes;
+    uint64_t num_rows;
+    uint64_t num_cols;
+    uint64_t num_non_zero;
+    uint64_t values_offset;
+    uint64_t indices_offset;
+    uint64_t file_size;
+} BinaryHeader;
+
+static const char binary_magic[8] = {'E', 'L', 'L', 'P', 'A', 'C', 'K', 'B'};
+
+#define BINARY_FORMAT_VERSION 1
+#define BINARY_ALIGNMENT 64
+
+static uint64_t align_binary_offset(uint64_t offset)
+{
+    return (offset + BINARY_ALIGNMENT - 1) & ~(uint64_t)(BINARY_ALIGNMENT - 1);
+}
+
+// true if the mapped file starts with the magic of the binary format
+static bool is_binary_matrix(const char *data, size_t file_size)
+{
+    return file_size >= sizeof(binary_magic) && memcmp(data, binary_magic, sizeof(binary_magic)) == 0;
+}
+
+// checks the header of a mapped binary file and lets values/indices point into the mapping (no copy)
+static int read_binary_matrix(const char *filename, char *data, size_t file_size, ELLPACKMatrix *matrix)
+{
+    BinaryHeader header;
+
+    if (file_size < sizeof(header))
+    {
+        fprintf(stderr, "Error reading binary header. Filename: %s\n", filename);
+        return -1;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if (header.format_version != BINARY_FORMAT_VERSION || (header.index_bytes != sizeof(uint32_t) && header.index_bytes != sizeof(uint64_t)))
+    {
+        fprintf(stderr, "Error: Unsupported binary format version or index width. Filename: %s\n", filename);
+        return -1;
+    }
+
+    if (header.num_rows == 0 || header.num_cols == 0)
+    {
+        fprintf(stderr, "Error: Rows or Cols equals 0. Filename: %s\n", filename);
+        return -1;
+    }
+
+    if (header.num_rows > INT64_MAX || header.num_cols > INT64_MAX || header.num_non_zero > INT64_MAX)
+    {
+        fprintf(stderr, "Error: Matrix dimensions/Number_non_Zero exceed maximum allowed value. Filename: %s\n", filename);
+        return -1;
+    }
+
+    if (header.num_rows < header.num_non_zero)
+    {
+        fprintf(stderr, "Error: num_non_zero larger then num_rows. Rows: %ld, num_non_zero: %ld. Filename: %s\n", header.num_rows, header.num_non_zero, filename);
+        return -1;
+    }
+
+    // a crafted header must not wrap the sizes around, the arrays would then be NULL or lie outside of the file
+    uint64_t num_entries, values_bytes, indices_bytes, values_end, indices_end;
+
+    if (__builtin_mul_overflow(header.num_rows, header.num_non_zero, &num_entries) ||
+        __builtin_mul_overflow(num_entries, (uint64_t)sizeof(float), &values_bytes) ||
+        __builtin_mul_overflow(num_entries, (uint64_t)header.index_bytes, &indices_bytes) ||
+        __builtin_add_overflow(header.values_offset, values_bytes, &values_end) ||
+        __builtin_add_overflow(header.indices_offset, indices_bytes, &indices_end))
+    {
+        fprintf(stderr, "Error: Binary header sizes overflow. Filename: %s\n", filename);
+        return -1;
+    }
+
+    if (header.file_size != file_size || header.values_offset % BINARY_ALIGNMENT != 0 || header.indices_offset % BINARY_ALIGNMENT != 0 ||
+        header.values_offset < sizeof(header) || values_end > header.indices_offset ||
+        indices_end > file_size || (header.index_bytes == sizeof(uint32_t) && header.num_cols > UINT32_MAX))
+    {
+        fprintf(stderr, "Error: Binary file is truncated or its offsets are wrong. Filename: %s\n", filename);
+        return -1;
+    }
+
+    matrix->num_rows = header.num_rows;
+    matrix->num_cols = header.num_cols;
+    matrix->num_non_zero = header.num_non_zero;
+    matrix->values = num_entries > 0 ? (float *)(data + header.values_offset) : NULL;
+    matrix->indices = num_entries > 0 && header.index_bytes == sizeof(uint64_t) ? (uint64_t *)(data + header.indices_offset) : NULL;
+    matrix->indices32 = num_entries > 0 && header.index_bytes == sizeof(uint32_t) ? (uint32_t *)(data + header.indices_offset) : NULL;
+    matrix->mapping = data;
+    matrix->mapping_size = file_size;
+    return 0;
+}
+
+// true if array points into the mapped binary file of matrix (and must not be freed)
+static bool in_mapping(const ELLPACKMatrix *matrix, const void *array)
+{
+    const char *pos = (const char *)array;
+    const char *mapping = (const char *)matrix->mapping;
+
+    return mapping && pos >= mapping && pos < mapping + matrix->mapping_size;
+}
+
+// frees everything an input or result matrix holds
+void free_matrix(ELLPACKMatrix *matrix)
+{
+    if (matrix)
+    {
+        free_input_arrays(matrix);
+
+        if (matrix->result_values)
+        {
+            free_result_rows(matrix);
+        }
+
+        free(matrix->row_ptr);
+    }
+}
+
+// releases values/indices of an input matrix: unmaps a binary file, frees heap arrays (also indices converted from a mapping)
+void free_input_arrays(const ELLPACKMatrix *matrix)
+{
+    if (!in_mapping(matrix, matrix->values))
+    {
+        free(matrix->values);
+    }
+
+    if (!in_mapping(matrix, matrix->indices))
+    {
+        free(matrix->indices);
+    }
+
+    if (!in_mapping(matrix, matrix->indices32))
+    {
+        free(matrix->indices32);
+    }
+
+    if (matrix->mapping)
+    {
+        munmap(matrix->mapping, matrix->mapping_size);
+    }
+}
+
+/*
+Stores the indices of an input matrix with 32 bits (compact) or 64 bits, copying them if they have the other width.
+Returns -1 if the memory for the copy is missing or compact is requested for a matrix with more than UINT32_MAX columns.
+*/
+int set_index_width(ELLPACKMatrix *matrix, bool compact)
+{
+    uint64_t num_entries = matrix->num_rows * matrix->num_non_zero;
+
+    if (compact && matrix->num_cols > UINT32_MAX)
+    {
+        return -1;
+    }
+
+    if (compact == (matrix->indices32 != NULL) || num_entries == 0)
+    {
+        return 0;
+    }
+
+    if (compact)
+    {
+        uint32_t *indices32 = (uint32_t *)malloc(num_entries * sizeof(uint32_t));
+
+        if (!indices32)
+        {
+            return -1;
+        }
+
+        // indices that do not fit stay out of range for control_indices
+        for (uint64_t i = 0; i < num_entries; i++)
+        {
+            indices32[i] = matrix->indices[i] < UINT32_MAX ? (uint32_t)matrix->indices[i] : UINT32_MAX;
+        }
+
+        if (!in_mapping(matrix, matrix->indices))
+        {
+            free(matrix->indices);
+        }
+
+        matrix->indices = NULL;
+        matrix->indices32 = indices32;
+        return 0;
+    }
+
+    uint64_t *indices = (uint64_t *)malloc(num_entries * sizeof(uint64_t));
+
+    if (!indices)
+    {
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < num_entries; i++)
+    {
+        indices[i] = matrix->indices32[i];
+    }
+
+    if (!in_mapping(matrix, matrix->indices32))
+    {
+        free(matrix->indices32);
+    }
+
+    matrix->indices = indices;
+    matrix->indices32 = NULL;
+    return 0;
+}
+
+// writes an input matrix (values/indices with num_non_zero entries per row) in the binary ELLPACK format, indices keep their width
+int write_matrix_binary(const char *restrict filename, const ELLPACKMatrix *restrict matrix)
+{
+    uint64_t num_entries = matrix->num_rows * matrix->num_non_zero;
+    BinaryHeader header = {0};
+
+    memcpy(header.magic, binary_magic, sizeof(binary_magic));
+    header.format_version = BINARY_FORMAT_VERSION;
+    header.index_bytes = matrix->indices32 ? sizeof(uint32_t) : sizeof(uint64_t);
+    header.num_rows = matrix->num_rows;
+    header.num_cols = matrix->num_cols;
+    header.num_non_zero = matrix->num_non_zero;
+    header.values_offset = align_binary_offset(sizeof(header));
+    header.indices_offset = align_binary_offset(header.values_offset + num_entries * sizeof(float));
+    header.file_size = header.indices_offset + num_entries * header.index_bytes;
+
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Error opening file %s\n", filename);
+        return -1;
+    }
+
+    static const char zeros[BINARY_ALIGNMENT] = {0};
+    uint64_t values_padding = header.values_offset - sizeof(header);
+    uint64_t indices_padding = header.indices_offset - header.values_offset - num_entries * sizeof(float);
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(zeros, 1, values_padding, file) != values_padding ||
+        fwrite(matrix->values, sizeof(float), num_entries, file) != num_entries ||
+        fwrite(zeros, 1, indices_padding, file) != indices_padding ||
+        fwrite(matrix->indices32 ? (const void *)matrix->indices32 : (const void *)matrix->indices, header.index_bytes, num_entries, file) != num_entries)
+    {
+        fprintf(stderr, "Error writing binary file %s\n", filename);
+        fclose(file);
+        return -1;
+    }
+
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "Error writing binary file %s\n", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+// maps an input file into memory (read only), text files are parsed in one pass over the mapping
+static char *map_input_file(const char *filename, size_t *file_size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error opening file %s\n", filename);
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        fprintf(stderr, "Error opening file %s\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    *file_size = (size_t)file_stat.st_size;
+
+    if (*file_size == 0)
+    {
+        fprintf(stderr, "Error reading line 1 (dimension).\n");
+        close(fd);
+        return NULL;
+    }
+
+    char *data = (char *)mmap(NULL, *file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Error opening file %s\n", filename);
+        return NULL;
+    }
+
+    return data;
+}
+
+// reads and checks the first line of a text file (rows, columns, num_non_zero), returns -1 after printing the error
+static int parse_dimension(const char *line, const char *line_end, const char *filename, uint64_t dimension[3])
+{
+    const char *pos = line;
+
+    for (int i = 0; i < 3; i++)
+    {
+        while (pos < line_end && is_blank(*pos))
+        {
+            pos++;
+        }
+
+        if (scan_uint64(&pos, line_end, &dimension[i]) != 0)
+        {
+            // distinguish a wrong number of values from values that are no numbers (as the old getline/strtok check did)
+            int64_t count = parse_line(line, line_end, NULL, (uint64_t[3]){0}, NULL, 3);
+            if (count != 3)
+            {
+                fprintf(stderr, "Wrong number of characters in line 1 (dimension).\n");
+            }
+            else
+            {
+                fprintf(stderr, "Error reading matrix dimensions. Filename: %s\n", filename);
+            }
+            return -1;
+        }
+
+        while (pos < line_end && is_blank(*pos))
+        {
+            pos++;
+        }
+
+        if (i < 2 && (pos == line_end || *pos != ','))
+        {
+            fprintf(stderr, "Wrong number of characters in line 1 (dimension).\n");
+            return -1;
+        }
+
+        pos++;
+    }
+
+    if (pos < line_end)
+    {
+        fprintf(stderr, "Wrong number of characters in line 1 (dimension).\n");
+        return -1;
+    }
+
+    // check all values of the dimension (rows and columns must not be 0 / rows,columns and num_non_zero must not be negative / num_non_zero must not be larger than the rows)
+    if (dimension[0] == 0 || dimension[1] == 0)
+    {
+        fprintf(stderr, "Error: Rows or Cols equals 0. Filename: %s\n", filename);
+        return -1;
+    }
+
+    if (dimension[0] > INT64_MAX || dimension[1] > INT64_MAX || dimension[2] > INT64_MAX)
+    {
+        fprintf(stderr, "Error: Matrix dimensions/Number_non_Zero exceed maximum allowed value. Filename: %s\n", filename);
+        return -1;
+    }
+
+    if (dimension[0] < dimension[2])
+    {
+        fprintf(stderr, "Error: num_non_zero larger then num_rows. Rows: %ld, num_non_zero: %ld. Filename: %s\n", dimension[0], dimension[2], filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+Reads a text (three lines) or binary ELLPACK file, the format is detected by the magic at the start of the file.
+With compact_indices the indices are stored with 32 bits if num_cols fits (indices32), otherwise with 64 bits (indices).
+The values and indices lines of a text file are parsed on up to num_threads threads.
+*/
+int read_matrix(const char *restrict filename, ELLPACKMatrix *restrict matrix, bool compact_indices, int num_threads)
+{
+    size_t file_size;
+    char *data = map_input_file(filename, &file_size);
+
+    if (!data)
+    {
+        return -1;
+    }
+
+    // binary files are used in place, the mapping stays alive until free_input_arrays
+    if (is_binary_matrix(data, file_size))
+    {
+        if (read_binary_matrix(filename, data, file_size, matrix) != 0)
+        {
+            munmap(data, file_size);
+            return -1;
+        }
+
+        // a file with the other index width is converted once (values stay in the mapping)
+        if (set_index_width(matrix, compact_indices && matrix->num_cols <= UINT32_MAX) != 0)
+        {
+            fprintf(stderr, "Memory allocation failed. Filename: %s\n", filename);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    madvise(data, file_size, MADV_SEQUENTIAL);
+
+    const char *end = data + file_size;
+    const char *line = data;
+    const char *line_end = find_line_end(line, end);
+    int status = -1;
+
+    // check and read the first line of the file (dimension)
+    uint64_t dimension[3];
+
+    if (parse_dimension(line, line_end, filename, dimension) != 0)
+    {
+        goto handle_error_io;
+    }
+
+    matrix->num_rows = dimension[0];
+    matrix->num_cols = dimension[1];
+    matrix->num_non_zero = dimension[2];
+
+    // the arrays are allocated before the lines are parsed (on one or more threads), so their sizes must not wrap
+    uint64_t num_entries, values_bytes, indices_bytes;
+
+    if (__builtin_mul_overflow(matrix->num_rows, matrix->num_non_zero, &num_entries) ||
+        __builtin_mul_overflow(num_entries, (uint64_t)sizeof(float), &values_bytes) ||
+        __builtin_mul_overflow(num_entries, (uint64_t)sizeof(uint64_t), &indices_bytes))
+    {
+        fprintf(stderr, "Error: Matrix sizes overflow. Rows: %lu, num_non_zero: %lu. Filename: %s\n", (unsigned long)matrix->num_rows, (unsigned long)matrix->num_non_zero, filename);
+        goto handle_error_io;
+    }
+
+    if (matrix->num_non_zero != 0)
+    {
+        // allocate the values and indices arrays, the lines are parsed straight into them
+        matrix->values = (float *)malloc(values_bytes);
+        if (compact_indices && matrix->num_cols <= UINT32_MAX)
+        {
+            matrix->indices32 = (uint32_t *)malloc(num_entries * sizeof(uint32_t));
+        }
+        else
+        {
+            matrix->indices = (uint64_t *)malloc(indices_bytes);
+        }
+
+        if (!matrix->values || (!matrix->indices && !matrix->indices32))
+        {
+            fprintf(stderr, "Memory allocation failed. Filename: %s\n", filename);
+            goto handle_error_io;
+        }
+
+        // line 2 (values)
+        if (line_end == end)
+        {
+            fprintf(stderr, "Error reading line 2 (values).\n");
+            goto handle_error_io;
+        }
+
+        line = line_end + 1;
+        line_end = find_line_end(line, end);
+
+        int64_t count = parse_line_parallel(line, line_end, matrix->values, NULL, NULL, num_entries, num_threads);
+        if (count < 0)
+        {
+            fprintf(stderr, "Error reading value from file %s\n", filename);
+            goto handle_error_io;
+        }
+
+        if ((uint64_t)count != num_entries)
+        {
+            fprintf(stderr, "Wrong Number in line 2 (values).\n");
+            goto handle_error_io;
+        }
+
+        // line 3 (indices)
+        if (line_end == end)
+        {
+            fprintf(stderr, "Error reading line 3 (indices).\n");
+            goto handle_error_io;
+        }
+
+        line = line_end + 1;
+        line_end = find_line_end(line, end);
+
+        count = parse_line_parallel(line, line_end, NULL, matrix->indices, matrix->indices32, num_entries, num_threads);
+        if (count < 0)
+        {
+            fprintf(stderr, "Error reading index from file %s\n", filename);
+            goto handle_error_io;
+        }
+
+        if ((uint64_t)count != num_entries)
+        {
+            fprintf(stderr, "Wrong Number in line 3 (indices).\n");
+            goto handle_error_io;
+        }
+
+        if (line_end != end && line_end + 1 != end)
+        {
+            fprintf(stderr, "Error: There are more lines as 3.\n");
+            goto handle_error_io;
+        }
+    }
+    else if (line_end != end && line_end + 1 != end)
+    {
+        line = line_end + 1;
+        line_end = find_line_end(line, end);
+
+        if (!is_blank_line(line, line_end))
+        {
+            fprintf(stderr, "Error: In the values line (line 2) are characters, but num_non_zero == 0.\n");
+            goto handle_error_io;
+        }
+
+        if (line_end != end && line_end + 1 != end)
+        {
+            line = line_end + 1;
+            line_end = find_line_end(line, end);
+
+            if (!is_blank_line(line, line_end))
+            {
+                fprintf(stderr, "Error: In the indices line (line 3) are characters, but num_non_zero == 0.\n");
+                goto handle_error_io;
+            }
+        }
+
+        if (line_end != end && line_end + 1 != end)
+        {
+            fprintf(stderr, "Error: There are more lines as 3.\n");
+            goto handle_error_io;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Error: There are less then 3 lines.\n");
+        goto handle_error_io;
+    }
+
+    status = 0;
+
+handle_error_io:
+    munmap(data, file_size);
+    return status;
+}
+
+// moves pos past the next token of a line and tells if it is padding ('*'), returns 1 at the end of the line, 0 after a ','
+static int skip_token(const char **pos, const char *end, bool *padding)
+{
+    const char *curr = *pos;
+
+    while (curr < end && is_blank(*curr))
+    {
+        curr++;
+    }
+
+    *padding = curr < end && *curr == '*';
+
+    const char *comma = memchr(curr, ',', (size_t)(end - curr));
+    *pos = comma ? comma + 1 : end;
+    return comma ? 0 : 1;
+}
+
+/*
+Parses the next token of a line into value (if value != NULL) or index, '*' sets padding.
+Returns 1 at the end of the line, 0 after a ',' and -1 for a malformed token.
+*/
+static int next_token(const char **pos, const char *end, float *value, uint64_t *index, bool *padding)
+{
+    const char *curr = *pos;
+
+    while (curr < end && is_blank(*curr))
+    {
+        curr++;
+    }
+
+    *padding = curr < end && *curr == '*';
+
+    if (*padding)
+    {
+        curr++;
+    }
+    else if (value ? scan_float(&curr, end, value) != 0 : scan_uint64(&curr, end, index) != 0)
+    {
+        return -1;
+    }
+
+    while (curr < end && is_blank(*curr))
+    {
+        curr++;
+    }
+
+    if (curr == end)
+    {
+        *pos = curr;
+        return 1;
+    }
+
+    if (*curr != ',')
+    {
+        return -1;
+    }
+
+    *pos = curr + 1;
+    return 0;
+}
+
+/*
+Reads an ELLPACK file straight into the hybrid ELL+COO format (see hybrid.h). A text file is read in two passes over
+the mapping: the first counts the entries of every row for the width, the second parses both lines row by row, so
+num_rows * num_non_zero slots are never allocated. Binary files (and files without entries) are read as ELLPACK first.
+*/
+int read_matrix_hybrid(const char *restrict filename, HybridMatrix *restrict hybrid, unsigned percentile, bool compact_indices)
 {
-    // open input file
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    memset(hybrid, 0, sizeof(*hybrid));
+
+    size_t file_size;
+    char *data = map_input_file(filename, &file_size);
+
+    if (!data)
     {
-        fprintf(stderr, "Error opening file %s\n", filename);
         return -1;
     }
 
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-    long pos_getline_file;
-    long pos_scan_file;
+    const char *end = data + file_size;
+    const char *line_end = find_line_end(data, end);
+    uint64_t dimension[3] = {0};
+    bool binary = is_binary_matrix(data, file_size);
 
-    // check first line of the file (count_number_in_line counts the numbers of values)
-    if ((read = getline(&line, &len, file)) == -1)
+    if (!binary && parse_dimension(data, line_end, filename, dimension) != 0)
     {
-        fprintf(stderr, "Error reading line 1 (dimension).\n");
+        munmap(data, file_size);
+        return -1;
+    }
+
+    // binary files and matrices without entries have no padding to save, they are converted from ELLPACK
+    if (binary || dimension[2] == 0)
+    {
+        munmap(data, file_size);
+        ELLPACKMatrix matrix = {0};
+
+        if (read_matrix(filename, &matrix, compact_indices, 1) != 0)
+        {
+            free_input_arrays(&matrix);
+            return -1;
+        }
+
+        int status = ellpack_to_hybrid(&matrix, hybrid, percentile);
+        free_input_arrays(&matrix);
+
+        if (status != 0)
+        {
+            fprintf(stderr, "Memory allocation failed. Filename: %s\n", filename);
+        }
+
+        return status;
+    }
+
+    madvise(data, file_size, MADV_SEQUENTIAL);
+
+    hybrid->num_rows = dimension[0];
+    hybrid->num_cols = dimension[1];
+    uint64_t num_non_zero = dimension[2];
+    uint64_t num_entries;
+    int status = -1;
+
+    if (__builtin_mul_overflow(hybrid->num_rows, num_non_zero, &num_entries))
+    {
+        fprintf(stderr, "Error: Matrix sizes overflow. Rows: %lu, num_non_zero: %lu. Filename: %s\n", (unsigned long)hybrid->num_rows, (unsigned long)num_non_zero, filename);
+        munmap(data, file_size);
+        return -1;
+    }
+
+    uint64_t *row_length = (uint64_t *)calloc(hybrid->num_rows, sizeof(uint64_t));
+    float *row_values = (float *)malloc(num_non_zero * sizeof(float));
+    uint64_t *row_indices = (uint64_t *)malloc(num_non_zero * sizeof(uint64_t));
+
+    if (!row_length || !row_values || !row_indices)
+    {
+        fprintf(stderr, "Memory allocation failed. Filename: %s\n", filename);
         goto handle_error_io;
     }
 
-    if (count_numbers_in_line(line) != 3)
+    // line 2 (values) and line 3 (indices)
+    if (line_end == end)
     {
-        fprintf(stderr, "Wrong number of characters in line 1 (dimension).\n");
+        fprintf(stderr, "Error reading line 2 (values).\n");
         goto handle_error_io;
     }
 
-    // save "file getline position" to check the next lines and set file position to zero to read in the dimension (line 1)
-    pos_getline_file = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    const char *values_line = line_end + 1;
+    const char *values_end = find_line_end(values_line, end);
 
-    if (fscanf(file, "%" SCNu64 ",%" SCNu64 ",%" SCNu64, &matrix->num_rows, &matrix->num_cols, &matrix->num_non_zero) != 3)
+    if (values_end == end)
     {
-        fprintf(stderr, "Error reading matrix dimensions. Filename: %s\n", filename);
+        fprintf(stderr, "Error reading line 3 (indices).\n");
         goto handle_error_io;
     }
 
-    // check all values of the dimension (rows and columns must not be 0 / rows,columns and num_non_zero must not be negative / num_non_zero must not be larger than the rows)
-    if (matrix->num_rows == 0 || matrix->num_cols == 0)
+    const char *indices_line = values_end + 1;
+    const char *indices_end = find_line_end(indices_line, end);
+
+    if (indices_end != end && indices_end + 1 != end)
     {
-        fprintf(stderr, "Error: Rows or Cols equals 0. Filename: %s\n", filename);
+        fprintf(stderr, "Error: There are more lines as 3.\n");
+        goto handle_error_io;
+    }
+
+    // first pass: entries (tokens that are not '*') of every row
+    const char *pos = values_line;
+
+    for (uint64_t i = 0; i < num_entries; ++i)
+    {
+        bool padding;
+
+        if (skip_token(&pos, values_end, &padding) != (i + 1 == num_entries))
+        {
+            fprintf(stderr, "Wrong Number in line 2 (values).\n");
+            goto handle_error_io;
+        }
+
+        row_length[i / num_non_zero] += !padding;
+    }
+
+    hybrid->width = hybrid_width(row_length, hybrid->num_rows, num_non_zero, percentile);
+
+    if (hybrid_alloc(hybrid, row_length, compact_indices && hybrid->num_cols <= UINT32_MAX) != 0)
+    {
+        fprintf(stderr, "Memory allocation failed. Filename: %s\n", filename);
         goto handle_error_io;
     }
 
-    if (matrix->num_rows > INT64_MAX || matrix->num_cols > INT64_MAX || matrix->num_non_zero > INT64_MAX)
+    // second pass: both lines row by row, the entries of a row are moved to its front
+    const char *values_pos = values_line;
+    const char *indices_pos = indices_line;
+
+    for (uint64_t row = 0; row < hybrid->num_rows; ++row)
+    {
+        uint64_t length = 0;
+
+        for (uint64_t j = 0; j < num_non_zero; ++j)
+        {
+            bool last = row + 1 == hybrid->num_rows && j + 1 == num_non_zero;
+            bool padding, index_padding;
+            uint64_t index = 0;
+
+            int value_status = next_token(&values_pos, values_end, &row_values[length], NULL, &padding);
+            if (value_status < 0)
+            {
+                fprintf(stderr, "Error reading value from file %s\n", filename);
+                goto handle_error_io;
+            }
+
+            int index_status = next_token(&indices_pos, indices_end, NULL, &index, &index_padding);
+            if (index_status < 0)
+            {
+                fprintf(stderr, "Error reading index from file %s\n", filename);
+                goto handle_error_io;
+            }
+
+            if (index_status != last)
+            {
+                fprintf(stderr, "Wrong Number in line 3 (indices).\n");
+                goto handle_error_io;
+            }
+
+            if (!padding)
+            {
+                row_indices[length++] = index_padding ? 0 : index;
+            }
+        }
+
+        hybrid_store_row(hybrid, row, row_values, row_indices, length);
+    }
+
+    status = 0;
+
+handle_error_io:
+    if (status != 0)
+    {
+        free_hybrid(hybrid);
+    }
+
+    free(row_length);
+    free(row_values);
+    free(row_indices);
+    munmap(data, file_size);
+    return status;
+}
+
+// output is formatted into a large buffer that is handed to write() in one call when it is full
+#define OUTPUT_BUFFER_SIZE (8 << 20)
+
+typedef struct
+{
+    int fd;
+    char *data;
+    size_t size;
+    bool failed;
+} OutputBuffer;
+
+// one row of a result matrix: length entries in values/indices, a value of zero is printed as padding
+typedef struct
+{
+    const float *values;
+    const uint64_t *indices;
+    uint64_t length;
+} RowView;
+
+typedef RowView (*row_view)(const ELLPACKMatrix *matrix, uint64_t row);
+
+static int output_open(OutputBuffer *out, const char *filename)
+{
+    out->size = 0;
+    out->failed = false;
+    out->data = (char *)pool_alloc(OUTPUT_BUFFER_SIZE);
+    out->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (out->fd < 0 || !out->data)
+    {
+        fprintf(stderr, "Error opening file %s\n", filename);
+        if (out->fd >= 0)
+        {
+            close(out->fd);
+        }
+        pool_free(out->data);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void output_flush(OutputBuffer *out)
+{
+    size_t written = 0;
+
+    while (written < out->size && !out->failed)
+    {
+        ssize_t result = write(out->fd, out->data + written, out->size - written);
+
+        if (result < 0)
+        {
+            if (errno != EINTR)
+            {
+                out->failed = true;
+            }
+            continue;
+        }
+
+        written += (size_t)result;
+    }
+
+    out->size = 0;
+}
+
+// returns the place for up to length more characters
+static inline char *output_reserve(OutputBuffer *out, size_t length)
+{
+    if (out->size + length > OUTPUT_BUFFER_SIZE)
+    {
+        output_flush(out);
+    }
+
+    return out->data + out->size;
+}
+
+static int output_close(OutputBuffer *out, const char *filename)
+{
+    output_flush(out);
+
+    if (close(out->fd) != 0)
+    {
+        out->failed = true;
+    }
+
+    pool_free(out->data);
+
+    if (out->failed)
+    {
+        fprintf(stderr, "Error writing file %s\n", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+// the writers format a line in chunks of at most OUTPUT_CHUNK_SLOTS slots, whose text always fits into OUTPUT_CHUNK_SIZE
+#define OUTPUT_CHUNK_SIZE (2 << 20)
+#define OUTPUT_CHUNK_SLOTS (OUTPUT_CHUNK_SIZE / (FORMAT_MAX_LENGTH + 1))
+#define OUTPUT_MAX_CHUNKS 64
+
+/*
+A line of a result file is written in rounds of up to one chunk per thread: every thread formats its chunk into its own
+buffer, a prefix sum over the text lengths gives the file offset of every chunk, and the threads place their chunks with
+pwrite into the file, which is extended to the end of the round first. The buffers are used again by the next round.
+*/
+typedef struct
+{
+    const ELLPACKMatrix *matrix;
+    uint64_t num_non_zero;
+    row_view get_row;
+    bool values;
+    int fd;
+    uint64_t num_slots;   // slots of the line (rows * num_non_zero)
+    uint64_t round_begin; // first slot of the round
+    char *buffers[OUTPUT_MAX_CHUNKS];
+    size_t lengths[OUTPUT_MAX_CHUNKS];
+    uint64_t offsets[OUTPUT_MAX_CHUNKS];
+    bool failed[OUTPUT_MAX_CHUNKS];
+} OutputChunks;
+
+// formats the slots of the chunks [begin, end) of the round, every slot but the first of the line starts with ','
+static void format_chunks(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    OutputChunks *out = (OutputChunks *)context;
+
+    for (uint64_t c = begin; c < end; ++c)
+    {
+        uint64_t slot = out->round_begin + c * OUTPUT_CHUNK_SLOTS;
+        uint64_t slot_end = slot + OUTPUT_CHUNK_SLOTS < out->num_slots ? slot + OUTPUT_CHUNK_SLOTS : out->num_slots;
+        uint64_t row = slot / out->num_non_zero;
+        uint64_t j = slot % out->num_non_zero;
+        RowView view = out->get_row(out->matrix, row);
+        char *pos = out->buffers[c];
+
+        for (; slot < slot_end; ++slot, ++j)
+        {
+            if (j == out->num_non_zero)
+            {
+                view = out->get_row(out->matrix, ++row);
+                j = 0;
+            }
+
+            if (slot != 0)
+            {
+                *pos++ = ',';
+            }
+
+            if (j >= view.length || view.values[j] == 0.0f)
+            {
+                *pos++ = '*';
+            }
+            else
+            {
+                pos += out->values ? format_float(pos, view.values[j]) : format_uint64(pos, view.indices[j]);
+            }
+        }
+
+        out->lengths[c] = (size_t)(pos - out->buffers[c]);
+    }
+}
+
+// writes length bytes at offset, returns -1 on an error
+static int pwrite_all(int fd, const char *data, size_t length, uint64_t offset)
+{
+    size_t written = 0;
+
+    while (written < length)
+    {
+        ssize_t result = pwrite(fd, data + written, length - written, (off_t)(offset + written));
+
+        if (result < 0)
+        {
+            if (errno != EINTR)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        written += (size_t)result;
+    }
+
+    return 0;
+}
+
+static void write_chunks(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    OutputChunks *out = (OutputChunks *)context;
+
+    for (uint64_t c = begin; c < end; ++c)
+    {
+        out->failed[c] = pwrite_all(out->fd, out->buffers[c], out->lengths[c], out->offsets[c]) != 0;
+    }
+}
+
+// writes the values line (out->values == true) or the indices line from *offset on and moves *offset to its end
+static int output_line_parallel(OutputChunks *out, int num_chunks, uint64_t *offset)
+{
+    uint64_t round_slots = (uint64_t)num_chunks * OUTPUT_CHUNK_SLOTS;
+
+    for (out->round_begin = 0; out->round_begin < out->num_slots; out->round_begin += round_slots)
+    {
+        uint64_t remaining = out->num_slots - out->round_begin;
+        uint64_t round_chunks = (remaining + OUTPUT_CHUNK_SLOTS - 1) / OUTPUT_CHUNK_SLOTS;
+
+        if (round_chunks > (uint64_t)num_chunks)
+        {
+            round_chunks = (uint64_t)num_chunks;
+        }
+
+        if (parallel_for((int)round_chunks, round_chunks, format_chunks, out) != 0)
+        {
+            return -1;
+        }
+
+        for (uint64_t c = 0; c < round_chunks; ++c)
+        {
+            out->offsets[c] = *offset;
+            *offset += out->lengths[c];
+        }
+
+        // the chunks are written into a file that already has its size, none of the pwrites has to extend it
+        if (round_chunks > 1 && ftruncate(out->fd, (off_t)*offset) != 0)
+        {
+            return -1;
+        }
+
+        if (parallel_for((int)round_chunks, round_chunks, write_chunks, out) != 0)
+        {
+            return -1;
+        }
+
+        for (uint64_t c = 0; c < round_chunks; ++c)
+        {
+            if (out->failed[c])
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// writes a result matrix in the ELLPACK text format on up to num_threads threads, the rows are padded with '*' to num_non_zero entries
+static int write_ellpack_file(const char *filename, const ELLPACKMatrix *matrix, uint64_t num_non_zero, row_view get_row, int num_threads)
+{
+    OutputChunks *out = (OutputChunks *)calloc(1, sizeof(OutputChunks));
+    uint64_t num_slots = matrix->num_rows * num_non_zero;
+    uint64_t num_chunks = (num_slots + OUTPUT_CHUNK_SLOTS - 1) / OUTPUT_CHUNK_SLOTS;
+    int status = -1;
+
+    if (num_chunks > (uint64_t)(num_threads > 1 ? num_threads : 1))
+    {
+        num_chunks = (uint64_t)(num_threads > 1 ? num_threads : 1);
+    }
+
+    if (num_chunks > OUTPUT_MAX_CHUNKS)
+    {
+        num_chunks = OUTPUT_MAX_CHUNKS;
+    }
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool buffers = out != NULL;
+
+    for (uint64_t c = 0; buffers && c < num_chunks; ++c)
+    {
+        out->buffers[c] = (char *)pool_alloc(OUTPUT_CHUNK_SIZE);
+        buffers = out->buffers[c] != NULL;
+    }
+
+    if (fd < 0 || !buffers)
+    {
+        fprintf(stderr, "Error opening file %s\n", filename);
+        goto close_output;
+    }
+
+    char header[3 * FORMAT_MAX_LENGTH + 3];
+    char *pos = header;
+    pos += format_uint64(pos, matrix->num_rows);
+    *pos++ = ',';
+    pos += format_uint64(pos, matrix->num_cols);
+    *pos++ = ',';
+    pos += format_uint64(pos, num_non_zero);
+    *pos++ = '\n';
+
+    uint64_t offset = (uint64_t)(pos - header);
+    out->matrix = matrix;
+    out->num_non_zero = num_non_zero;
+    out->get_row = get_row;
+    out->values = true;
+    out->fd = fd;
+    out->num_slots = num_slots;
+
+    if (pwrite_all(fd, header, (size_t)offset, 0) != 0 || output_line_parallel(out, (int)num_chunks, &offset) != 0 ||
+        pwrite_all(fd, "\n", 1, offset++) != 0)
+    {
+        fprintf(stderr, "Error writing file %s\n", filename);
+        goto close_output;
+    }
+
+    out->values = false;
+
+    if (output_line_parallel(out, (int)num_chunks, &offset) != 0)
+    {
+        fprintf(stderr, "Error writing file %s\n", filename);
+        goto close_output;
+    }
+
+    status = 0;
+
+close_output:
+    if (fd >= 0 && close(fd) != 0 && status == 0)
     {
-        fprintf(stderr, "Error: Matrix dimensions/Number_non_Zero exceed maximum allowed value. Filename: %s\n", filename);
-        goto handle_error_io;
+        fprintf(stderr, "Error writing file %s\n", filename);
+        status = -1;
     }
 
-    if (matrix->num_rows < matrix->num_non_zero)
+    for (uint64_t c = 0; out && c < num_chunks; ++c)
     {
-        fprintf(stderr, "Error: num_non_zero larger then num_rows. Rows: %ld, num_non_zero: %ld. Filename: %s\n", matrix->num_rows, matrix->num_non_zero, filename);
-        goto handle_error_io;
+        pool_free(out->buffers[c]);
     }
 
-    // save "file scan position" (reading position (fscanf)) and set file position to the old "file getline position"
-    pos_scan_file = ftell(file);
-    fseek(file, pos_getline_file, SEEK_SET);
+    free(out);
+    return status;
+}
 
-    if (matrix->num_non_zero != 0)
-    {
-        // checking line 2
-        if ((read = getline(&line, &len, file)) == -1)
-        {
-            fprintf(stderr, "Error reading line 2 (values).\n");
-            goto handle_error_io;
-        }
+// rows of the one dimensional arrays (Version 1), the arrays have matrix->num_non_zero entries per row
+static RowView flat_row(const ELLPACKMatrix *matrix, uint64_t row)
+{
+    uint64_t row_begin = row * matrix->num_non_zero;
+    return (RowView){matrix->values + row_begin, matrix->indices + row_begin, matrix->num_non_zero};
+}
 
-        if (count_numbers_in_line(line) != (int)(matrix->num_rows * matrix->num_non_zero))
-        {
-            fprintf(stderr, "Wrong Number in line 2 (values).\n");
-            goto handle_error_io;
-        }
+// rows of the two dimensional arrays (Version 2)
+static RowView ragged_row(const ELLPACKMatrix *matrix, uint64_t row)
+{
+    uint64_t length = matrix->row_length ? matrix->row_length[row] : matrix->num_non_zero;
+    return (RowView){matrix->result_values[row], matrix->result_indices[row], length};
+}
 
-        // checking line 3
-        if ((read = getline(&line, &len, file)) == -1)
-        {
-            fprintf(stderr, "Error reading line 3 (indices).\n");
-            goto handle_error_io;
-        }
+// compressed rows (Version 3)
+static RowView compressed_row(const ELLPACKMatrix *matrix, uint64_t row)
+{
+    uint64_t row_begin = matrix->row_ptr[row];
+    return (RowView){matrix->values + row_begin, matrix->indices + row_begin, matrix->row_ptr[row + 1] - row_begin};
+}
 
-        if (count_numbers_in_line(line) != (int)(matrix->num_rows * matrix->num_non_zero))
-        {
-            fprintf(stderr, "Wrong Number in line 3 (indices).\n");
-            goto handle_error_io;
-        }
+// Version 1 to write the one dimensional arrays into the output file
+int write_matrix_V1(const char *restrict filename, const ELLPACKMatrix *restrict matrix, uint64_t num_non_zero, int num_threads)
+{
+    return write_ellpack_file(filename, matrix, num_non_zero, flat_row, num_threads);
+}
 
-        if ((read = getline(&line, &len, file)) != -1)
-        {
-            fprintf(stderr, "Error: There are more lines as 3.\n");
-            goto handle_error_io;
-        }
-    }
-    else if ((read = getline(&line, &len, file)) != -1)
+// Version 2 to write the two dimensional arrays into the output file
+int write_matrix_V2(const char *restrict filename, const ELLPACKMatrix *restrict matrix, int num_threads)
+{
+    return write_ellpack_file(filename, matrix, matrix->num_non_zero, ragged_row, num_threads);
+}
+
+// Version 3 to write the compressed rows (row_ptr) into the output file, the rows are padded with '*' while writing
+int write_matrix_V3(const char *restrict filename, const ELLPACKMatrix *restrict matrix, int num_threads)
+{
+    return write_ellpack_file(filename, matrix, matrix->num_non_zero, compressed_row, num_threads);
+}
+
+// reads a spill file back in large chunks
+typedef struct
+{
+    int fd;
+    char *data;
+    size_t pos;
+    size_t size;
+} InputBuffer;
+
+static int input_read(InputBuffer *in, void *destination, size_t length)
+{
+    char *out = (char *)destination;
+
+    while (length > 0)
     {
-        if (*line != '\n')
+        if (in->pos == in->size)
         {
-            fprintf(stderr, "Error: In the values line (line 2) are characters, but num_non_zero == 0.\n");
-            goto handle_error_io;
-        }
+            ssize_t result = read(in->fd, in->data, OUTPUT_BUFFER_SIZE);
 
-        if ((read = getline(&line, &len, file)) != -1)
-        {
-            if (*line != '\n')
+            if (result < 0 && errno == EINTR)
             {
-                fprintf(stderr, "Error: In the indices line (line 3) are characters, but num_non_zero == 0.\n");
-                goto handle_error_io;
+                continue;
             }
-        }
 
-        if ((read = getline(&line, &len, file)) != -1)
-        {
-            fprintf(stderr, "Error: There are more lines as 3.\n");
-            goto handle_error_io;
+            if (result <= 0)
+            {
+                return -1;
+            }
+
+            in->pos = 0;
+            in->size = (size_t)result;
         }
-    }
-    else
-    {
-        fprintf(stderr, "Error: There are less then 3 lines.\n");
-        goto handle_error_io;
-    }
 
-    // set file position to the old "file scan position" to scan the values and indices lines (line 2 and 3)
-    fseek(file, pos_scan_file, SEEK_SET);
+        size_t available = in->size - in->pos < length ? in->size - in->pos : length;
+        memcpy(out, in->data + in->pos, available);
+        in->pos += available;
+        out += available;
+        length -= available;
+    }
 
-    // allocate the values and indices arrays
-    matrix->values = (float *)malloc(matrix->num_rows * matrix->num_non_zero * sizeof(float));
-    matrix->indices = (uint64_t *)malloc(matrix->num_rows * matrix->num_non_zero * sizeof(uint64_t));
+    return 0;
+}
 
-    if (!matrix->values || !matrix->indices)
+// writes one line from a spill file that holds the entries of all rows back to back (row_length[i] entries for row i)
+static int output_spilled_line(OutputBuffer *out, InputBuffer *in, const ELLPACKMatrix *shape, const uint64_t *row_length, bool values)
+{
+    if (lseek(in->fd, 0, SEEK_SET) != 0)
     {
-        fprintf(stderr, "Memory allocation failed. Filename: %s\n", filename);
-        goto handle_error_io;
+        return -1;
     }
 
+    in->pos = 0;
+    in->size = 0;
 
-    // for loop to scan/read the values and writing them in the value array
-    for (uint64_t i = 0; i < matrix->num_rows * matrix->num_non_zero; ++i)
+    for (uint64_t i = 0; i < shape->num_rows; ++i)
     {
-        char ch;
-        if (fscanf(file, " %c", &ch) != 1)
+        for (uint64_t j = 0; j < shape->num_non_zero; j++)
         {
-            fprintf(stderr, "Error reading values from file %s\n", filename);
-            goto handle_error_io;
-        }
+            char *pos = output_reserve(out, FORMAT_MAX_LENGTH + 1);
+            size_t length = 1;
 
-        if (ch == '*')
-        {
-            matrix->values[i] = 0.0f;
-            if (fscanf(file, "%*c") != 0)
+            if (i != 0 || j != 0)
             {
-                fprintf(stderr, "Error skipping the comma (value) %s\n", filename);
-                goto handle_error_io;
+                *pos++ = ',';
+                out->size++;
             }
-        }
-        else
-        {
-            ungetc(ch, file); // Put back the character if it's not '*'
-            if (fscanf(file, "%f,", &matrix->values[i]) != 1)
+
+            if (j >= row_length[i])
             {
-                fprintf(stderr, "Error reading value from file %s\n", filename);
-                goto handle_error_io;
+                *pos = '*';
             }
-        }
-    }
-
-    // for loop to scan/read the indices and writing them in the indices array
-    for (uint64_t i = 0; i < matrix->num_rows * matrix->num_non_zero; ++i)
-    {
-        char ch;
-        if (fscanf(file, " %c", &ch) != 1)
-        {
-            fprintf(stderr, "Error reading indices from file %s\n", filename);
-            goto handle_error_io;
-        }
-
-        if (ch == '*')
-        {
-            matrix->indices[i] = 0;
-            if (fscanf(file, "%*c") != 0)
+            else if (values)
             {
-                if (i != (matrix->num_rows * matrix->num_non_zero - 1))
+                float value;
+                if (input_read(in, &value, sizeof(value)) != 0)
                 {
-                    fprintf(stderr, "Error skipping the comma (index) %s\n", filename);
-                    goto handle_error_io;
+                    return -1;
                 }
+                length = format_float(pos, value);
             }
-        }
-        else
-        {
-            ungetc(ch, file);
-            if (fscanf(file, "%" SCNu64 ",", &matrix->indices[i]) != 1)
+            else
             {
-                fprintf(stderr, "Error reading index from file %s\n", filename);
-                goto handle_error_io;
+                uint64_t index;
+                if (input_read(in, &index, sizeof(index)) != 0)
+                {
+                    return -1;
+                }
+                length = format_uint64(pos, index);
             }
+
+            out->size += length;
         }
     }
-    free(line);
-    fclose(file);
-    return 0;
-
 
-handle_error_io:
-    free(line);
-    fclose(file);
-    return -1;
+    return 0;
 }
 
-// Version 1 to write the one dimensional arrays into the output file
-int write_matrix_V1(const char *restrict filename, const ELLPACKMatrix *restrict matrix, uint64_t num_non_zero)
+// writes a result whose rows were spilled to values_fd/indices_fd by the streaming mode, shape holds rows, cols and the longest row
+int write_matrix_spilled(const char *filename, const ELLPACKMatrix *shape, const uint64_t *row_length, int values_fd, int indices_fd)
 {
-    FILE *file = fopen(filename, "w");
-    if (!file)
+    OutputBuffer out;
+    InputBuffer in = {values_fd, (char *)malloc(OUTPUT_BUFFER_SIZE), 0, 0};
+
+    if (!in.data || output_open(&out, filename) != 0)
     {
-        fprintf(stderr, "Error opening file %s\n", filename);
+        free(in.data);
         return -1;
     }
 
-    fprintf(file, "%" PRId64 ",%" PRId64 ",%" PRId64 "\n", matrix->num_rows, matrix->num_cols, num_non_zero);
+    char *pos = output_reserve(&out, 3 * FORMAT_MAX_LENGTH + 3);
+    pos += format_uint64(pos, shape->num_rows);
+    *pos++ = ',';
+    pos += format_uint64(pos, shape->num_cols);
+    *pos++ = ',';
+    pos += format_uint64(pos, shape->num_non_zero);
+    *pos++ = '\n';
+    out.size = (size_t)(pos - out.data);
+
+    int status = output_spilled_line(&out, &in, shape, row_length, true);
+    *output_reserve(&out, 1) = '\n';
+    out.size++;
 
-    for (uint64_t i = 0; i < matrix->num_rows; ++i)
+    in.fd = indices_fd;
+    if (status == 0)
     {
-        for (uint64_t j = 0; j < num_non_zero; j++)
-        {
-            if (matrix->values[i * matrix->num_non_zero + j] == 0.0f)
-            {
-                fprintf(file, "%c", '*');
-            }
-            else
-            {
-                fprintf(file, "%f", matrix->values[i * matrix->num_non_zero + j]);
-            }
-            if (i * num_non_zero + j < matrix->num_rows * num_non_zero - 1)
-            {
-                fprintf(file, ",");
-            }
-        }
+        status = output_spilled_line(&out, &in, shape, row_length, false);
     }
-    fprintf(file, "\n");
 
-    for (uint64_t i = 0; i < matrix->num_rows; ++i)
+    free(in.data);
+
+    if (status != 0)
     {
-        for (uint64_t j = 0; j < num_non_zero; j++)
-        {
-            if (matrix->values[i * matrix->num_non_zero + j] == 0.0f)
-            {
-                fprintf(file, "%c", '*');
-            }
-            else
-            {
-                fprintf(file, "%" PRId64, matrix->indices[i * matrix->num_non_zero + j]);
-            }
-            if (i * num_non_zero + j < matrix->num_rows * num_non_zero - 1)
-            {
-                fprintf(file, ",");
-            }
-        }
+        fprintf(stderr, "Error reading the spill files for %s\n", filename);
+        out.failed = true;
     }
 
-    fclose(file);
-    return 0;
+    return output_close(&out, filename);
 }
 
-// Version 1 to write the two dimensional arrays into the output file
-int write_matrix_V2(const char *restrict filename, const ELLPACKMatrix *restrict matrix)
+/*
+Writes a result in the layout its version produced. There are 3 writers, because the result arrays of the versions
+are different: one dimensional arrays (version 1), compressed rows (row_ptr) and ragged rows. All of them format and
+write the file on up to num_threads threads.
+*/
+int write_result_matrix(const char *restrict filename, ELLPACKMatrix *restrict result, int version, int num_threads)
 {
-    FILE *file = fopen(filename, "w");
-    if (!file)
+    if (version == 1)
     {
-        fprintf(stderr, "Error opening file %s\n", filename);
-        return -1;
+        return write_matrix_V1(filename, result, compute_num_non_zero(result), num_threads);
+    }
+
+    if (result->row_ptr)
+    {
+        return write_matrix_V3(filename, result, num_threads);
     }
 
-    fprintf(file, "%" PRId64 ",%" PRId64 ",%" PRId64 "\n", matrix->num_rows, matrix->num_cols, matrix->num_non_zero);
+    return write_matrix_V2(filename, result, num_threads);
+}
+
+/*
+Turns a result into an input matrix that the kernels can multiply again: the rows of whichever layout the result has
+are copied into padded values/indices with as many slots per row as the longest row has non-zero values, and the result
+arrays are freed. Entries with the value zero are dropped, like the writers print them as padding. The indices are
+stored with 32 bits if compact_indices is set and the columns fit.
+*/
+int result_to_input(ELLPACKMatrix *restrict matrix, bool compact_indices)
+{
+    row_view get_row = matrix->row_ptr ? compressed_row : matrix->result_values ? ragged_row : flat_row;
+    uint64_t width = 0;
 
-    for (uint64_t i = 0; i < matrix->num_rows; ++i)
+    for (uint64_t row = 0; row < matrix->num_rows; ++row)
     {
-        for (uint64_t j = 0; j < matrix->num_non_zero; j++)
+        RowView view = get_row(matrix, row);
+        uint64_t length = 0;
+
+        for (uint64_t j = 0; j < view.length; ++j)
         {
-            if (matrix->result_values[i][j] == 0.0f)
-            {
-                fprintf(file, "%c", '*');
-            }
-            else
-            {
-                fprintf(file, "%f", matrix->result_values[i][j]);
-            }
-            if (i * matrix->num_non_zero + j < matrix->num_rows * matrix->num_non_zero - 1)
-            {
-                fprintf(file, ",");
-            }
+            length += view.values[j] != 0.0f;
+        }
+
+        if (length > width)
+        {
+            width = length;
         }
     }
-    fprintf(file, "\n");
 
-    for (uint64_t i = 0; i < matrix->num_rows; ++i)
+    ELLPACKMatrix input = {0};
+    input.num_rows = matrix->num_rows;
+    input.num_cols = matrix->num_cols;
+    input.num_non_zero = width;
+
+    bool compact = compact_indices && matrix->num_cols <= UINT32_MAX;
+    uint64_t num_slots = input.num_rows * width;
+
+    input.values = (float *)calloc(num_slots + 1, sizeof(float));
+
+    if (compact)
     {
-        for (uint64_t j = 0; j < matrix->num_non_zero; j++)
+        input.indices32 = (uint32_t *)calloc(num_slots + 1, sizeof(uint32_t));
+    }
+    else
+    {
+        input.indices = (uint64_t *)calloc(num_slots + 1, sizeof(uint64_t));
+    }
+
+    if (!input.values || (!input.indices && !input.indices32))
+    {
+        free_matrix(&input);
+        fprintf(stderr, "Memory allocation failed for the intermediate matrix\n");
+        return -1;
+    }
+
+    for (uint64_t row = 0; row < matrix->num_rows; ++row)
+    {
+        RowView view = get_row(matrix, row);
+        uint64_t slot = row * width;
+
+        for (uint64_t j = 0; j < view.length; ++j)
         {
-            if (matrix->result_values[i][j] == 0.0f)
+            if (view.values[j] == 0.0f)
             {
-                fprintf(file, "%c", '*');
+                continue;
             }
-            else
+
+            input.values[slot] = view.values[j];
+
+            if (compact)
             {
-                fprintf(file, "%" PRId64, matrix->result_indices[i][j]);
+                input.indices32[slot] = (uint32_t)view.indices[j];
             }
-            if (i * matrix->num_non_zero + j < matrix->num_rows * matrix->num_non_zero - 1)
+            else
             {
-                fprintf(file, ",");
+                input.indices[slot] = view.indices[j];
             }
+
+            slot++;
         }
     }
-    fclose(file);
+
+    free_matrix(matrix);
+    *matrix = input;
     return 0;
 }
 
@@ -335,7 +1900,7 @@ int write_matrix_V2(const char *restrict filename, const ELLPACKMatrix *restrict
 int compute_num_non_zero(ELLPACKMatrix *restrict matrix)
 {
     uint64_t max_num_non_zero = 0;
-    for (uint64_t i = 0; i < matrix->num_cols; i++)
+    for (uint64_t i = 0; i < matrix->num_rows; i++)
     {
         uint64_t tmp_num_non_zero = 0;
         for (uint64_t j = 0; j < matrix->num_non_zero; j++)
@@ -354,81 +1919,190 @@ int compute_num_non_zero(ELLPACKMatrix *restrict matrix)
     return max_num_non_zero;
 }
 
-// function to counting the number in a line between and after the commas
-int count_numbers_in_line(char *restrict line)
+// rows with at most this many slots are checked for double indices by comparing the slots, longer ones with a marker
+#define CONTROL_PAIRWISE_MAX 16
+
+typedef enum
 {
-    int count = 0;
-    char *token = strtok(line, ",");
+    INDICES_OK,
+    INDICES_OUT_OF_BOUND,
+    INDICES_DOUBLE,
+    INDICES_DOUBLE_ZERO,
+    INDICES_NO_MEMORY
+} IndicesStatus;
 
-    while (token != NULL)
-    {
-        count++;
-        token = strtok(NULL, ",");
-    }
+// first error a thread found, its rows are checked in order
+typedef struct
+{
+    IndicesStatus status;
+    uint64_t row;
+} IndicesResult;
 
-    return count;
-}
+typedef struct
+{
+    const ELLPACKMatrix *matrix;
+    IndicesResult *results; // one per thread
+} ControlContext;
 
-// function to checks the indexes for multiple occurrences and whether an index is too large
-int control_indices(const char *filename, const ELLPACKMatrix *restrict matrix)
+/*
+Checks one row: every index must be smaller than num_cols and appear only once. Index 0 is also the padding ('*'), so
+it may appear twice (column 0 and padding); after the second 0 the rest of the row must be padding. marker[col] holds
+row + 1 for the columns seen in this row, rows without a marker compare their slots instead.
+*/
+ALWAYS_INLINE IndicesStatus control_row(const ELLPACKMatrix *matrix, uint64_t row, uint64_t *marker, bool compact)
 {
-    for (uint64_t i = 0; i < matrix->num_cols; i++)
+    uint64_t row_begin = row * matrix->num_non_zero;
+    bool first_zero = false;
+    bool second_zero = false;
+
+    for (uint64_t j = 0; j < matrix->num_non_zero; j++)
     {
-        // temp_array with the size of the rows (checking indices separate for each row)
-        bool *temp_array = (bool *)calloc(matrix->num_rows, sizeof(bool));
-        if (!temp_array)
+        uint64_t index = load_index(matrix, row_begin + j, compact);
+
+        if (index >= matrix->num_cols)
         {
-            free(temp_array);
-            fprintf(stderr, "Memory allocation failed in control_indices. Filename: %s\n", filename);
-            return -1;
+            return INDICES_OUT_OF_BOUND;
         }
-        // bools to check the zeros, because we convert the char '*' to zeros
-        bool first_zero = false;
-        bool second_zero = false;
 
-        // for loop to iterate over the temp array
-        for (uint64_t j = 0; j < matrix->num_non_zero; j++)
+        if (index != 0)
         {
-            if ((temp_array[matrix->indices[i * matrix->num_non_zero + j]] || second_zero) && matrix->indices[i * matrix->num_non_zero + j] != 0)
+            bool seen = false;
+
+            if (marker)
             {
-                free(temp_array);
-                fprintf(stderr, "Error: Double indices in row or wrong order. Filename: %s\n", filename);
-                return -1;
+                seen = marker[index] == row + 1;
+                marker[index] = row + 1;
             }
-            else if (matrix->indices[i * matrix->num_non_zero + j] >= matrix->num_rows)
+            else
             {
-                free(temp_array);
-                fprintf(stderr, "Error: Index larger then rows (Index out of bound). Filename: %s\n", filename);
-                return -1;
+                for (uint64_t l = 0; l < j && !seen; l++)
+                {
+                    seen = load_index(matrix, row_begin + l, compact) == index;
+                }
             }
-            else if (matrix->indices[i * matrix->num_non_zero + j] != 0)
+
+            if (seen || second_zero)
             {
-                temp_array[matrix->indices[i * matrix->num_non_zero + j]] = true;
+                return INDICES_DOUBLE;
             }
-            else
+        }
+        else if (first_zero)
+        {
+            if (matrix->values[row_begin + j] != 0)
             {
-                if (first_zero)
-                {
-                    if (matrix->values[i * matrix->num_non_zero + j] != 0)
-                    {
-                        free(temp_array);
-                        fprintf(stderr, "Error: Double indices (zero) in row or wrong values. Filename: %s\n", filename);
-                        return -1;
-                    }
-                    else
-                    {
-                        second_zero = true;
-                    }
-                }
-                else
-                {
-                    temp_array[matrix->indices[i * matrix->num_non_zero + j]] = true;
-                    first_zero = true;
-                }
+                return INDICES_DOUBLE_ZERO;
             }
+
+            second_zero = true;
+        }
+        else
+        {
+            first_zero = true;
         }
-        free(temp_array);
     }
 
-    return 0;
+    return INDICES_OK;
+}
+
+static void control_rows_width(void *context, int thread_id, uint64_t begin, uint64_t end, bool compact)
+{
+    ControlContext *ctx = (ControlContext *)context;
+    const ELLPACKMatrix *matrix = ctx->matrix;
+    IndicesResult *result = &ctx->results[thread_id];
+    uint64_t *marker = NULL;
+
+    *result = (IndicesResult){INDICES_OK, begin};
+
+    if (matrix->num_non_zero > CONTROL_PAIRWISE_MAX)
+    {
+        marker = (uint64_t *)calloc(matrix->num_cols, sizeof(uint64_t));
+
+        if (!marker)
+        {
+            result->status = INDICES_NO_MEMORY;
+            return;
+        }
+    }
+
+    for (uint64_t row = begin; row < end; ++row)
+    {
+        IndicesStatus status = control_row(matrix, row, marker, compact);
+
+        if (status != INDICES_OK)
+        {
+            *result = (IndicesResult){status, row};
+            break;
+        }
+    }
+
+    free(marker);
+}
+
+// INDEX_WIDTH_TASKS drops the thread id, which selects the result slot here
+static void control_rows_32(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    control_rows_width(context, thread_id, begin, end, true);
+}
+
+static void control_rows_64(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    control_rows_width(context, thread_id, begin, end, false);
+}
+
+/*
+Checks the indices of every row for multiple occurrences and whether an index is too large, on up to num_threads threads.
+The check is linear in the number of slots; like a check row after row it reports the error of the first bad row.
+*/
+int control_indices(const char *filename, const ELLPACKMatrix *restrict matrix, int num_threads)
+{
+    if (num_threads < 1)
+    {
+        num_threads = 1;
+    }
+
+    IndicesResult *results = (IndicesResult *)calloc((size_t)num_threads, sizeof(IndicesResult));
+
+    if (!results)
+    {
+        fprintf(stderr, "Memory allocation failed in control_indices. Filename: %s\n", filename);
+        return -1;
+    }
+
+    ControlContext ctx = {matrix, results};
+
+    if (parallel_for(num_threads, matrix->num_rows, matrix->indices32 ? control_rows_32 : control_rows_64, &ctx) != 0)
+    {
+        free(results);
+        return -1;
+    }
+
+    // the threads check blocks of rows in order, so the first thread with an error has the first bad row
+    IndicesStatus status = INDICES_OK;
+
+    for (int i = 0; i < num_threads && status == INDICES_OK; i++)
+    {
+        status = results[i].status;
+    }
+
+    free(results);
+
+    switch (status)
+    {
+    case INDICES_OK:
+        return 0;
+    case INDICES_OUT_OF_BOUND:
+        fprintf(stderr, "Error: Index larger then cols (Index out of bound). Filename: %s\n", filename);
+        break;
+    case INDICES_DOUBLE:
+        fprintf(stderr, "Error: Double indices in row or wrong order. Filename: %s\n", filename);
+        break;
+    case INDICES_DOUBLE_ZERO:
+        fprintf(stderr, "Error: Double indices (zero) in row or wrong values. Filename: %s\n", filename);
+        break;
+    case INDICES_NO_MEMORY:
+        fprintf(stderr, "Memory allocation failed in control_indices. Filename: %s\n", filename);
+        break;
+    }
+
+    return -1;
 }
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+
+#include "numa.h"
+#include "parallel.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// allowed cores in the order the threads are pinned to them
+static int numa_cores[CPU_SETSIZE];
+static int numa_num_cores = 0;
+static bool numa_huge_pages = false;
+
+// copies the rows of an input matrix into arrays that the copying threads touch first
+typedef struct
+{
+    const ELLPACKMatrix *source;
+    float *values;
+    uint64_t *indices;
+    uint32_t *indices32;
+} PlaceContext;
+
+static int pin_to_core(int core)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+Turns the NUMA mode on: the cores the process may run on are collected and the calling thread, thread 0 of every
+parallel_for, is pinned to the first one. Has to be called before any thread is started. Returns -1 if the affinity
+can not be read or set.
+*/
+int numa_enable(bool huge_pages)
+{
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    {
+        return -1;
+    }
+
+    numa_num_cores = 0;
+
+    for (int core = 0; core < CPU_SETSIZE; ++core)
+    {
+        if (CPU_ISSET(core, &set))
+        {
+            numa_cores[numa_num_cores++] = core;
+        }
+    }
+
+    numa_huge_pages = huge_pages;
+
+    if (numa_num_cores == 0 || pin_to_core(numa_cores[0]) != 0)
+    {
+        numa_num_cores = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+bool numa_enabled(void)
+{
+    return numa_num_cores > 0;
+}
+
+// pins the calling thread to the core of thread_id, more threads than cores share them round robin
+void numa_pin_thread(int thread_id)
+{
+    if (numa_num_cores > 0)
+    {
+        pin_to_core(numa_cores[thread_id % numa_num_cores]);
+    }
+}
+
+// node of the core the calling thread runs on, 0 outside of the NUMA mode
+int numa_current_node(void)
+{
+    unsigned cpu = 0, node = 0;
+
+    if (numa_num_cores == 0 || syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+    {
+        return 0;
+    }
+
+    return (int)node;
+}
+
+// advises the huge pages inside [memory, memory + size) to be transparent huge pages, before they are touched
+void numa_advise(void *memory, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    if (!numa_huge_pages || !memory || size < HUGE_PAGE_SIZE)
+    {
+        return;
+    }
+
+    uintptr_t begin = ((uintptr_t)memory + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)memory + size) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+
+    // without transparent huge pages in the kernel the advice fails, the memory works as before
+    if (begin < end)
+    {
+        madvise((void *)begin, end - begin, MADV_HUGEPAGE);
+    }
+#else
+    (void)memory;
+    (void)size;
+#endif
+}
+
+// memory for size bytes, aligned to huge pages if they are used and advised before anything touches it
+static void *place_alloc(size_t size)
+{
+    size = size ? size : 1;
+
+    if (!numa_huge_pages || size < HUGE_PAGE_SIZE)
+    {
+        return malloc(size);
+    }
+
+    void *memory = aligned_alloc(HUGE_PAGE_SIZE, (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    numa_advise(memory, size);
+    return memory;
+}
+
+// copies the rows [begin, end), the pages of the block are touched first by this thread
+ALWAYS_INLINE void place_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    PlaceContext *ctx = (PlaceContext *)context;
+    uint64_t slots = ctx->source->num_non_zero;
+
+    memcpy(ctx->values + begin * slots, ctx->source->values + begin * slots, (end - begin) * slots * sizeof(float));
+
+    if (compact)
+    {
+        memcpy(ctx->indices32 + begin * slots, ctx->source->indices32 + begin * slots, (end - begin) * slots * sizeof(uint32_t));
+    }
+    else
+    {
+        memcpy(ctx->indices + begin * slots, ctx->source->indices + begin * slots, (end - begin) * slots * sizeof(uint64_t));
+    }
+}
+
+INDEX_WIDTH_TASKS(place_rows)
+
+/*
+Moves the values and indices of an input matrix into memory placed by the threads of the kernels: versions 3, 4, 5 and
+9 split the rows of A into the same blocks, so the rows a thread computes are on its node. Versions 6 and 8 work on a
+SELL or CSR copy instead, which their conversion fills with the partitioning of the kernel (chunks or rows). The rows
+of B are read by all threads, split by rows they are spread evenly over the nodes. The parser and a mapped binary file
+touch the pages in another order, so the arrays are copied once. Does nothing outside of the NUMA mode, returns -1 if
+memory is missing.
+*/
+int numa_place_input(ELLPACKMatrix *matrix, int num_threads)
+{
+    uint64_t num_entries = matrix->num_rows * matrix->num_non_zero;
+
+    if (numa_num_cores == 0 || num_entries == 0)
+    {
+        return 0;
+    }
+
+    bool compact = matrix->indices32 != NULL;
+    PlaceContext ctx = {matrix, NULL, NULL, NULL};
+
+    ctx.values = (float *)place_alloc(num_entries * sizeof(float));
+
+    if (compact)
+    {
+        ctx.indices32 = (uint32_t *)place_alloc(num_entries * sizeof(uint32_t));
+    }
+    else
+    {
+        ctx.indices = (uint64_t *)place_alloc(num_entries * sizeof(uint64_t));
+    }
+
+    if (!ctx.values || (!ctx.indices && !ctx.indices32) ||
+        parallel_for(num_threads, matrix->num_rows, compact ? place_rows_32 : place_rows_64, &ctx) != 0)
+    {
+        free(ctx.values);
+        free(ctx.indices);
+        free(ctx.indices32);
+        return -1;
+    }
+
+    free_input_arrays(matrix);
+    matrix->values = ctx.values;
+    matrix->indices = ctx.indices;
+    matrix->indices32 = ctx.indices32;
+    matrix->mapping = NULL;
+    matrix->mapping_size = 0;
+    return 0;
+}
@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+#include "numa.h"
+#include "perf.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct
+{
+    parallel_task task;
+    void *context;
+    int thread_id;
+    int num_threads;
+    uint64_t num_items;
+} ParallelWorker;
+
+// number of online cores, used when no thread count is given
+int parallel_default_threads(void)
+{
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return num_cores > 0 ? (int)num_cores : 1;
+}
+
+// contiguous block of items for one thread (the first num_items % num_threads threads get one item more)
+void parallel_range(int thread_id, int num_threads, uint64_t num_items, uint64_t *begin, uint64_t *end)
+{
+    uint64_t chunk = num_items / num_threads;
+    uint64_t remain = num_items % num_threads;
+    uint64_t id = (uint64_t)thread_id;
+
+    *begin = id * chunk + (id < remain ? id : remain);
+    *end = *begin + chunk + (id < remain ? 1 : 0);
+}
+
+static void *parallel_worker(void *arg)
+{
+    ParallelWorker *worker = (ParallelWorker *)arg;
+    PerfCounters perf;
+    uint64_t begin, end;
+
+    // in the NUMA mode a thread works on its block of items on the same core every time (thread 0 is pinned already),
+    // with --perf it counts its own events and adds them to the phase before it exits (thread 0 is counted by main)
+    if (worker->thread_id > 0)
+    {
+        numa_pin_thread(worker->thread_id);
+        perf_thread_start(&perf);
+    }
+
+    parallel_range(worker->thread_id, worker->num_threads, worker->num_items, &begin, &end);
+    worker->task(worker->context, worker->thread_id, begin, end);
+
+    if (worker->thread_id > 0)
+    {
+        perf_thread_stop(&perf);
+    }
+
+    return NULL;
+}
+
+// splits num_items into one block per thread and runs task on every block (thread 0 is the calling thread)
+int parallel_for(int num_threads, uint64_t num_items, parallel_task task, void *context)
+{
+    if (num_threads < 1)
+    {
+        num_threads = 1;
+    }
+
+    if ((uint64_t)num_threads > num_items)
+    {
+        num_threads = num_items > 0 ? (int)num_items : 1;
+    }
+
+    if (num_threads == 1)
+    {
+        task(context, 0, 0, num_items);
+        return 0;
+    }
+
+    pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    ParallelWorker *workers = (ParallelWorker *)malloc(num_threads * sizeof(ParallelWorker));
+
+    if (!threads || !workers)
+    {
+        free(threads);
+        free(workers);
+        fprintf(stderr, "Memory allocation failed (parallel_for)\n");
+        return -1;
+    }
+
+    int started = 1;
+    int status = 0;
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        workers[i] = (ParallelWorker){task, context, i, num_threads, num_items};
+    }
+
+    for (int i = 1; i < num_threads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, parallel_worker, &workers[i]) != 0)
+        {
+            fprintf(stderr, "Error creating thread %d (parallel_for)\n", i);
+            status = -1;
+            break;
+        }
+        started++;
+    }
+
+    // the calling thread works on the first block itself
+    if (status == 0)
+    {
+        parallel_worker(&workers[0]);
+    }
+
+    for (int i = 1; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(workers);
+    return status;
+}
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+
+#include "perf.h"
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+
+typedef struct
+{
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} CounterConfig;
+
+static const CounterConfig counter_configs[NUM_PERF_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "LLC-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "dTLB-misses"},
+};
+
+// counts of the worker threads of parallel_for since perf_start, every worker adds its own before it exits
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static double worker_count[NUM_PERF_COUNTERS];
+static bool perf_active = false;
+
+void perf_init(PerfCounters *perf)
+{
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        perf->fd[i] = -1;
+    }
+}
+
+// opens one counter per event for user space of the calling thread only, returns the number of open counters
+static int open_counters(PerfCounters *perf)
+{
+    int num_open = 0;
+    perf_init(perf);
+
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter_configs[i].type;
+        attr.config = counter_configs[i].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        perf->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+        if (perf->fd[i] >= 0)
+        {
+            num_open++;
+        }
+    }
+
+    return num_open;
+}
+
+/*
+Opens the counters of the calling thread, the counters are read before and after a phase instead of being reset.
+The worker threads of parallel_for open their own counters while they run (perf_thread_start and perf_thread_stop),
+so the counts of all threads of a phase are complete once parallel_for returns. Returns the number of counters that
+could be opened (0 if perf_event_open is not allowed or there is no PMU).
+*/
+int perf_open(PerfCounters *perf)
+{
+    int num_open = open_counters(perf);
+    perf_active = num_open > 0;
+    return num_open;
+}
+
+static void close_counters(PerfCounters *perf)
+{
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        if (perf->fd[i] >= 0)
+        {
+            close(perf->fd[i]);
+            perf->fd[i] = -1;
+        }
+    }
+}
+
+void perf_close(PerfCounters *perf)
+{
+    perf_active = false;
+    close_counters(perf);
+}
+
+// reads value, time enabled and time running of a counter
+static bool read_counter(int fd, uint64_t data[3])
+{
+    return fd >= 0 && read(fd, data, 3 * sizeof(uint64_t)) == 3 * sizeof(uint64_t);
+}
+
+// reads the counters at the start of a phase, counters that can not be read start at zero
+static void start_counters(PerfCounters *perf)
+{
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        if (!read_counter(perf->fd[i], perf->start[i]))
+        {
+            perf->start[i][0] = perf->start[i][1] = perf->start[i][2] = 0;
+        }
+    }
+}
+
+// counts between start and end, scaled up if the kernel had to multiplex the counters
+static double counter_delta(const uint64_t start[3], const uint64_t end[3])
+{
+    uint64_t enabled = end[1] - start[1];
+    uint64_t running = end[2] - start[2];
+    double count = (double)(end[0] - start[0]);
+
+    if (running > 0 && running < enabled)
+    {
+        count *= (double)enabled / (double)running;
+    }
+
+    return count;
+}
+
+void perf_start(PerfCounters *perf)
+{
+    pthread_mutex_lock(&worker_lock);
+    memset(worker_count, 0, sizeof(worker_count));
+    pthread_mutex_unlock(&worker_lock);
+
+    start_counters(perf);
+}
+
+// adds the counts of the calling thread and of the finished worker threads since perf_start to sample
+void perf_stop(PerfCounters *perf, PerfSample *sample)
+{
+    pthread_mutex_lock(&worker_lock);
+
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        uint64_t end[3];
+
+        if (!read_counter(perf->fd[i], end))
+        {
+            continue;
+        }
+
+        sample->count[i] += counter_delta(perf->start[i], end) + worker_count[i];
+        sample->available[i] = true;
+    }
+
+    pthread_mutex_unlock(&worker_lock);
+    sample->num_runs++;
+}
+
+// opens the counters of a worker thread of parallel_for, nothing is opened if the counters of the process are closed
+void perf_thread_start(PerfCounters *perf)
+{
+    perf_init(perf);
+
+    if (perf_active)
+    {
+        open_counters(perf);
+        start_counters(perf);
+    }
+}
+
+// adds the counts of a worker thread to the current phase and closes its counters, before the thread exits
+void perf_thread_stop(PerfCounters *perf)
+{
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        uint64_t end[3];
+
+        if (read_counter(perf->fd[i], end))
+        {
+            double count = counter_delta(perf->start[i], end);
+
+            pthread_mutex_lock(&worker_lock);
+            worker_count[i] += count;
+            pthread_mutex_unlock(&worker_lock);
+        }
+    }
+
+    close_counters(perf);
+}
+
+// floating point operations of the product (a multiplication and an addition per pair of non-zero entries)
+uint64_t perf_multiply_flops(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b)
+{
+    uint64_t flops = 0;
+
+    for (uint64_t index_a = 0; index_a < matrix_a->num_rows * matrix_a->num_non_zero; ++index_a)
+    {
+        if (matrix_a->values[index_a] == 0.0f)
+        {
+            continue;
+        }
+
+        uint64_t base_index_b = ellpack_index(matrix_a, index_a) * matrix_b->num_non_zero;
+
+        for (uint64_t curr_non_zero_b = 0; curr_non_zero_b < matrix_b->num_non_zero; ++curr_non_zero_b)
+        {
+            if (matrix_b->values[base_index_b + curr_non_zero_b] != 0.0f)
+            {
+                flops += 2;
+            }
+        }
+    }
+
+    return flops;
+}
+
+// bytes of one slot of an input matrix: a value and an index of the width it is stored with
+static uint64_t input_slot_size(const ELLPACKMatrix *matrix)
+{
+    return sizeof(float) + (matrix->indices32 ? sizeof(uint32_t) : sizeof(uint64_t));
+}
+
+/*
+Bytes the kernels have to move at least: every slot of A once, one padded row of B per non-zero entry of A
+and the result (padded rows of values and indices). The inputs count with the width of their indices, the result
+always has 64-bit indices.
+*/
+uint64_t perf_multiply_bytes(const ELLPACKMatrix *matrix_a, const ELLPACKMatrix *matrix_b, const ELLPACKMatrix *matrix_result)
+{
+    const uint64_t result_slot_size = sizeof(float) + sizeof(uint64_t);
+    uint64_t non_zero_a = 0;
+
+    for (uint64_t index_a = 0; index_a < matrix_a->num_rows * matrix_a->num_non_zero; ++index_a)
+    {
+        if (matrix_a->values[index_a] != 0.0f)
+        {
+            non_zero_a++;
+        }
+    }
+
+    return matrix_a->num_rows * matrix_a->num_non_zero * input_slot_size(matrix_a) +
+           non_zero_a * matrix_b->num_non_zero * input_slot_size(matrix_b) +
+           matrix_result->num_rows * matrix_result->num_non_zero * result_slot_size;
+}
+
+// prints the counters of one phase per run, with GFLOP/s and bytes/s if flops or bytes are known
+void perf_report(FILE *file, const char *phase, const PerfSample *sample, double seconds, uint64_t flops, uint64_t bytes)
+{
+    int runs = sample->num_runs > 0 ? sample->num_runs : 1;
+
+    fprintf(file, "perf %-16s", phase);
+
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    {
+        if (sample->available[i])
+        {
+            fprintf(file, " %s=%.0f", counter_configs[i].name, sample->count[i] / runs);
+        }
+        else
+        {
+            fprintf(file, " %s=n/a", counter_configs[i].name);
+        }
+    }
+
+    if (sample->available[PERF_CYCLES] && sample->available[PERF_INSTRUCTIONS] && sample->count[PERF_CYCLES] > 0)
+    {
+        fprintf(file, " IPC=%.2f", sample->count[PERF_INSTRUCTIONS] / sample->count[PERF_CYCLES]);
+    }
+
+    if (seconds > 0 && flops > 0)
+    {
+        fprintf(file, " GFLOP/s=%.3f", flops / seconds * 1e-9);
+    }
+
+    if (seconds > 0 && bytes > 0)
+    {
+        fprintf(file, " GB/s=%.3f", bytes / seconds * 1e-9);
+    }
+
+    fprintf(file, "\n");
+}
@@ -0,0 +1,440 @@
+#include "reorder.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// copies the rows of an input matrix in a new order, the indices of A are renumbered with rank on the way
+typedef struct
+{
+    const ELLPACKMatrix *source;
+    float *values;
+    uint64_t *indices;
+    uint32_t *indices32;
+    const uint64_t *order;
+    const uint64_t *rank; // NULL: the indices are copied as they are
+    uint64_t num_rank;
+} PermuteContext;
+
+// copies the compressed rows of a result to the positions of the rows of A they belong to
+typedef struct
+{
+    const ELLPACKMatrix *result;
+    float *values;
+    uint64_t *indices;
+    const uint64_t *row_ptr;
+    const uint64_t *order;
+} RestoreContext;
+
+void free_reordering(Reordering *reordering)
+{
+    free(reordering->row_order);
+    free(reordering->inner_order);
+    memset(reordering, 0, sizeof(*reordering));
+}
+
+/*
+Cuthill-McKee on the bipartite graph of A: a breadth-first walk from row to column to row, that starts in a row of the
+smallest degree and visits the rows of a column in the order of their degree. Rows are numbered when the walk reaches
+them, columns when the walk first crosses them, so rows that share columns and the rows of B they need get neighbouring
+numbers. The order is not reversed: that only matters for the fill-in of a factorization. Rows without entries go to
+the end, as do columns that no row uses. rank[c] is the new number of column c. Returns -1 if memory is missing.
+*/
+static int order_bipartite(const ELLPACKMatrix *matrix, Reordering *reordering, uint64_t *rank)
+{
+    uint64_t rows = matrix->num_rows, cols = matrix->num_cols, slots = matrix->num_non_zero;
+    uint64_t *degree = (uint64_t *)calloc(rows + 1, sizeof(uint64_t));
+    uint64_t *degree_count = (uint64_t *)calloc(slots + 2, sizeof(uint64_t));
+    uint64_t *by_degree = (uint64_t *)malloc((rows + 1) * sizeof(uint64_t));
+    uint64_t *col_ptr = (uint64_t *)calloc(cols + 1, sizeof(uint64_t));
+    unsigned char *visited = (unsigned char *)calloc(rows + 1, 1);
+    uint64_t *col_rows = NULL;
+    int status = -1;
+
+    if (!degree || !degree_count || !by_degree || !col_ptr || !visited)
+    {
+        goto free_order;
+    }
+
+    // degree of every row and entries of every column, the padding is left out
+    for (uint64_t row = 0; row < rows; ++row)
+    {
+        for (uint64_t j = row * slots; j < (row + 1) * slots; ++j)
+        {
+            if (matrix->values[j] != 0.0f)
+            {
+                degree[row]++;
+                col_ptr[ellpack_index(matrix, j) + 1]++;
+            }
+        }
+
+        degree_count[degree[row] + 1]++;
+    }
+
+    for (uint64_t d = 0; d <= slots; ++d)
+    {
+        degree_count[d + 1] += degree_count[d];
+    }
+
+    for (uint64_t row = 0; row < rows; ++row)
+    {
+        by_degree[degree_count[degree[row]]++] = row;
+    }
+
+    for (uint64_t col = 0; col < cols; ++col)
+    {
+        col_ptr[col + 1] += col_ptr[col];
+    }
+
+    col_rows = (uint64_t *)malloc((col_ptr[cols] + 1) * sizeof(uint64_t));
+
+    if (!col_rows)
+    {
+        goto free_order;
+    }
+
+    // the rows of every column by increasing degree, rank is the fill position of a column until the walk
+    memcpy(rank, col_ptr, cols * sizeof(uint64_t));
+
+    for (uint64_t i = 0; i < rows; ++i)
+    {
+        uint64_t row = by_degree[i];
+
+        for (uint64_t j = row * slots; j < (row + 1) * slots; ++j)
+        {
+            if (matrix->values[j] != 0.0f)
+            {
+                col_rows[rank[ellpack_index(matrix, j)]++] = row;
+            }
+        }
+    }
+
+    for (uint64_t col = 0; col < cols; ++col)
+    {
+        rank[col] = UINT64_MAX;
+    }
+
+    // the walk, row_order is its queue
+    uint64_t *queue = reordering->row_order;
+    uint64_t head = 0, tail = 0, num_ranked = 0;
+
+    for (uint64_t i = 0; i < rows; ++i)
+    {
+        uint64_t start = by_degree[i];
+
+        if (visited[start] || degree[start] == 0)
+        {
+            continue;
+        }
+
+        visited[start] = 1;
+        queue[tail++] = start;
+
+        while (head < tail)
+        {
+            uint64_t row = queue[head++];
+
+            for (uint64_t j = row * slots; j < (row + 1) * slots; ++j)
+            {
+                uint64_t col = ellpack_index(matrix, j);
+
+                if (matrix->values[j] == 0.0f || rank[col] != UINT64_MAX)
+                {
+                    continue;
+                }
+
+                rank[col] = num_ranked;
+                reordering->inner_order[num_ranked++] = col;
+
+                for (uint64_t k = col_ptr[col]; k < col_ptr[col + 1]; ++k)
+                {
+                    if (!visited[col_rows[k]])
+                    {
+                        visited[col_rows[k]] = 1;
+                        queue[tail++] = col_rows[k];
+                    }
+                }
+            }
+        }
+    }
+
+    for (uint64_t row = 0; row < rows; ++row)
+    {
+        if (!visited[row])
+        {
+            queue[tail++] = row;
+        }
+    }
+
+    for (uint64_t col = 0; col < cols; ++col)
+    {
+        if (rank[col] == UINT64_MAX)
+        {
+            rank[col] = num_ranked;
+            reordering->inner_order[num_ranked++] = col;
+        }
+    }
+
+    status = 0;
+
+free_order:
+    free(degree);
+    free(degree_count);
+    free(by_degree);
+    free(col_ptr);
+    free(visited);
+    free(col_rows);
+    return status;
+}
+
+// copies the rows [begin, end) of the new order
+ALWAYS_INLINE void permute_rows_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    PermuteContext *ctx = (PermuteContext *)context;
+    const ELLPACKMatrix *source = ctx->source;
+    uint64_t slots = source->num_non_zero;
+
+    for (uint64_t row = begin; row < end; ++row)
+    {
+        uint64_t from = ctx->order[row] * slots;
+
+        memcpy(ctx->values + row * slots, source->values + from, slots * sizeof(float));
+
+        for (uint64_t j = 0; j < slots; ++j)
+        {
+            uint64_t index = load_index(source, from + j, compact);
+
+            // the padding may carry any index, it keeps it
+            if (ctx->rank && index < ctx->num_rank)
+            {
+                index = ctx->rank[index];
+            }
+
+            if (compact)
+            {
+                ctx->indices32[row * slots + j] = (uint32_t)index;
+            }
+            else
+            {
+                ctx->indices[row * slots + j] = index;
+            }
+        }
+    }
+}
+
+INDEX_WIDTH_TASKS(permute_rows)
+
+// fills new arrays with the rows of an input matrix in the given order (and its indices renumbered with rank)
+static int permute_prepare(const ELLPACKMatrix *matrix, const uint64_t *order, const uint64_t *rank, uint64_t num_rank, int num_threads, PermuteContext *ctx)
+{
+    bool compact = matrix->indices32 != NULL;
+    uint64_t num_entries = matrix->num_rows * matrix->num_non_zero;
+    uint64_t allocated = num_entries ? num_entries : 1;
+
+    *ctx = (PermuteContext){matrix, NULL, NULL, NULL, order, rank, num_rank};
+    ctx->values = (float *)malloc(allocated * sizeof(float));
+
+    if (compact)
+    {
+        ctx->indices32 = (uint32_t *)malloc(allocated * sizeof(uint32_t));
+    }
+    else
+    {
+        ctx->indices = (uint64_t *)malloc(allocated * sizeof(uint64_t));
+    }
+
+    if (!ctx->values || (!ctx->indices && !ctx->indices32) ||
+        parallel_for(num_threads, matrix->num_rows, compact ? permute_rows_32 : permute_rows_64, ctx) != 0)
+    {
+        free(ctx->values);
+        free(ctx->indices);
+        free(ctx->indices32);
+        *ctx = (PermuteContext){0};
+        return -1;
+    }
+
+    return 0;
+}
+
+// replaces the arrays of an input matrix, the old ones may be a mapped binary file, the new ones are heap memory
+static void permute_commit(ELLPACKMatrix *matrix, const PermuteContext *ctx)
+{
+    free_input_arrays(matrix);
+    matrix->values = ctx->values;
+    matrix->indices = ctx->indices;
+    matrix->indices32 = ctx->indices32;
+    matrix->mapping = NULL;
+    matrix->mapping_size = 0;
+}
+
+/*
+Renumbers the rows of A and the rows of B (the columns of A) of the product A x B, see Reordering. The inputs get new
+heap arrays, the multiplication works on them as usual. Returns -1 if the dimensions do not match or memory is missing,
+the inputs are unchanged then.
+*/
+int reorder_inputs(ELLPACKMatrix *matrix_a, ELLPACKMatrix *matrix_b, int num_threads, Reordering *reordering)
+{
+    memset(reordering, 0, sizeof(*reordering));
+
+    if (matrix_a->num_cols != matrix_b->num_rows || (matrix_a->indices32 != NULL) != (matrix_b->indices32 != NULL))
+    {
+        fprintf(stderr, "Matrix dimensions or index widths do not match for the reordering\n");
+        return -1;
+    }
+
+    reordering->num_rows = matrix_a->num_rows;
+    reordering->num_inner = matrix_a->num_cols;
+    reordering->row_order = (uint64_t *)malloc((matrix_a->num_rows + 1) * sizeof(uint64_t));
+    reordering->inner_order = (uint64_t *)malloc((matrix_a->num_cols + 1) * sizeof(uint64_t));
+    uint64_t *rank = (uint64_t *)malloc((matrix_a->num_cols + 1) * sizeof(uint64_t));
+
+    PermuteContext permuted_a = {0}, permuted_b = {0};
+
+    // both inputs are copied before either is replaced, so that a failure leaves them consistent
+    if (!reordering->row_order || !reordering->inner_order || !rank || order_bipartite(matrix_a, reordering, rank) != 0 ||
+        permute_prepare(matrix_a, reordering->row_order, rank, matrix_a->num_cols, num_threads, &permuted_a) != 0 ||
+        permute_prepare(matrix_b, reordering->inner_order, NULL, 0, num_threads, &permuted_b) != 0)
+    {
+        free(permuted_a.values);
+        free(permuted_a.indices);
+        free(permuted_a.indices32);
+        free(rank);
+        free_reordering(reordering);
+        return -1;
+    }
+
+    permute_commit(matrix_a, &permuted_a);
+    permute_commit(matrix_b, &permuted_b);
+    free(rank);
+    return 0;
+}
+
+// copies the compressed rows [begin, end) of the renumbered result to their rows of A
+static void restore_rows(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    RestoreContext *ctx = (RestoreContext *)context;
+    const ELLPACKMatrix *result = ctx->result;
+
+    for (uint64_t row = begin; row < end; ++row)
+    {
+        uint64_t from = result->row_ptr[row];
+        uint64_t length = result->row_ptr[row + 1] - from;
+        uint64_t to = ctx->row_ptr[ctx->order[row]];
+
+        memcpy(ctx->values + to, result->values + from, length * sizeof(float));
+        memcpy(ctx->indices + to, result->indices + from, length * sizeof(uint64_t));
+    }
+}
+
+// moves element i of array (size bytes each) to position order[i], copy holds num_rows elements
+static void unpermute(void *array, size_t size, const uint64_t *order, uint64_t num_rows, char *copy)
+{
+    memcpy(copy, array, num_rows * size);
+
+    for (uint64_t row = 0; row < num_rows; ++row)
+    {
+        memcpy((char *)array + order[row] * size, copy + row * size, size);
+    }
+}
+
+/*
+Puts the rows of a result of renumbered inputs back into the order of A, for all three result layouts: ragged rows only
+swap their pointers, compressed rows (versions 4 and 8) and the one dimensional arrays (version 1) are copied. The
+entries of the rows are the ones of the product of the original inputs, so the output does not change. Returns -1 if
+memory is missing, the result is unchanged then.
+*/
+int restore_result_rows(ELLPACKMatrix *result, const Reordering *reordering, int num_threads)
+{
+    uint64_t rows = result->num_rows;
+
+    if (rows != reordering->num_rows)
+    {
+        return -1;
+    }
+
+    if (rows == 0)
+    {
+        return 0;
+    }
+
+    if (result->row_ptr)
+    {
+        uint64_t total = result->row_ptr[rows];
+        RestoreContext ctx = {result, NULL, NULL, NULL, reordering->row_order};
+        uint64_t *row_ptr = (uint64_t *)calloc(rows + 1, sizeof(uint64_t));
+
+        ctx.values = (float *)malloc((total ? total : 1) * sizeof(float));
+        ctx.indices = (uint64_t *)malloc((total ? total : 1) * sizeof(uint64_t));
+        ctx.row_ptr = row_ptr;
+
+        if (!row_ptr || !ctx.values || !ctx.indices)
+        {
+            free(row_ptr);
+            free(ctx.values);
+            free(ctx.indices);
+            return -1;
+        }
+
+        for (uint64_t row = 0; row < rows; ++row)
+        {
+            row_ptr[reordering->row_order[row] + 1] = result->row_ptr[row + 1] - result->row_ptr[row];
+        }
+
+        for (uint64_t row = 0; row < rows; ++row)
+        {
+            row_ptr[row + 1] += row_ptr[row];
+        }
+
+        if (parallel_for(num_threads, rows, restore_rows, &ctx) != 0)
+        {
+            free(row_ptr);
+            free(ctx.values);
+            free(ctx.indices);
+            return -1;
+        }
+
+        free(result->values);
+        free(result->indices);
+        free(result->row_ptr);
+        result->values = ctx.values;
+        result->indices = ctx.indices;
+        result->row_ptr = row_ptr;
+        return 0;
+    }
+
+    // the one dimensional arrays have num_non_zero entries per row, the ragged rows one pointer
+    bool ragged = result->result_values != NULL;
+    size_t size = ragged ? sizeof(uint64_t) : result->num_non_zero * sizeof(uint64_t);
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    char *copy = (char *)malloc(rows * size);
+
+    if (!copy)
+    {
+        return -1;
+    }
+
+    if (ragged)
+    {
+        unpermute(result->result_values, sizeof(float *), reordering->row_order, rows, copy);
+        unpermute(result->result_indices, sizeof(uint64_t *), reordering->row_order, rows, copy);
+
+        if (result->row_length)
+        {
+            unpermute(result->row_length, sizeof(uint64_t), reordering->row_order, rows, copy);
+        }
+    }
+    else
+    {
+        unpermute(result->values, result->num_non_zero * sizeof(float), reordering->row_order, rows, copy);
+        unpermute(result->indices, result->num_non_zero * sizeof(uint64_t), reordering->row_order, rows, copy);
+    }
+
+    free(copy);
+    return 0;
+}
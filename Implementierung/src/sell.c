@@ -0,0 +1,205 @@
+#include "sell.h"
+#include "parallel.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    uint64_t length;
+    uint64_t row;
+} RowKey;
+
+// longest row first, equal lengths keep the order of the rows
+static int compare_row_keys(const void *a, const void *b)
+{
+    const RowKey *x = (const RowKey *)a, *y = (const RowKey *)b;
+
+    if (x->length != y->length)
+    {
+        return x->length < y->length ? 1 : -1;
+    }
+
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+void free_sell(SELLMatrix *sell)
+{
+    free(sell->chunk_ptr);
+    free(sell->row_order);
+    free(sell->row_position);
+    free(sell->row_length);
+    free(sell->row_start);
+    free(sell->values);
+    free(sell->indices);
+    free(sell->indices32);
+    memset(sell, 0, sizeof(*sell));
+}
+
+typedef struct
+{
+    const ELLPACKMatrix *matrix;
+    SELLMatrix *sell;
+    RowKey *keys;
+} ConvertContext;
+
+// length of the rows [begin, end), it ends after the last non-zero value
+static void measure_rows(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    ConvertContext *ctx = (ConvertContext *)context;
+    const ELLPACKMatrix *matrix = ctx->matrix;
+
+    for (uint64_t row = begin; row < end; ++row)
+    {
+        uint64_t length = matrix->num_non_zero;
+
+        while (length > 0 && matrix->values[row * matrix->num_non_zero + length - 1] == 0.0f)
+        {
+            length--;
+        }
+
+        ctx->keys[row] = (RowKey){length, row};
+    }
+}
+
+// sorts the rows within the windows [begin, end) of sigma rows
+static void sort_windows(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    ConvertContext *ctx = (ConvertContext *)context;
+    uint64_t num_rows = ctx->sell->num_rows, sigma = ctx->sell->sigma;
+
+    for (uint64_t window = begin; window < end; ++window)
+    {
+        uint64_t first = window * sigma;
+        uint64_t count = num_rows - first < sigma ? num_rows - first : sigma;
+        qsort(ctx->keys + first, count, sizeof(RowKey), compare_row_keys);
+    }
+}
+
+// positions of the rows of the chunks [begin, end), every chunk is as wide as its longest row (its size is stored in chunk_ptr[chunk + 1])
+static void layout_chunks(void *context, int thread_id, uint64_t begin, uint64_t end)
+{
+    (void)thread_id;
+    ConvertContext *ctx = (ConvertContext *)context;
+    SELLMatrix *sell = ctx->sell;
+
+    for (uint64_t chunk = begin; chunk < end; ++chunk)
+    {
+        uint64_t first = chunk * sell->chunk_size;
+        uint64_t last = first + sell->chunk_size < sell->num_rows ? first + sell->chunk_size : sell->num_rows;
+        uint64_t width = 0;
+
+        for (uint64_t pos = first; pos < last; ++pos)
+        {
+            width = ctx->keys[pos].length > width ? ctx->keys[pos].length : width;
+
+            sell->row_order[pos] = ctx->keys[pos].row;
+            sell->row_position[ctx->keys[pos].row] = pos;
+            sell->row_length[pos] = ctx->keys[pos].length;
+        }
+
+        sell->chunk_ptr[chunk + 1] = width * sell->chunk_size;
+    }
+}
+
+// copies the rows of the chunks [begin, end), split like the chunks of version 6 so the thread touches their pages first
+ALWAYS_INLINE void fill_chunks_width(void *context, uint64_t begin, uint64_t end, bool compact)
+{
+    ConvertContext *ctx = (ConvertContext *)context;
+    const ELLPACKMatrix *matrix = ctx->matrix;
+    SELLMatrix *sell = ctx->sell;
+    uint64_t last_pos = end * sell->chunk_size < sell->num_rows ? end * sell->chunk_size : sell->num_rows;
+
+    for (uint64_t pos = begin * sell->chunk_size; pos < last_pos; ++pos)
+    {
+        uint64_t chunk = pos / sell->chunk_size;
+        uint64_t row_begin = sell->row_order[pos] * matrix->num_non_zero;
+        sell->row_start[pos] = sell->chunk_ptr[chunk] + (pos - chunk * sell->chunk_size);
+
+        for (uint64_t j = 0; j < sell->row_length[pos]; ++j)
+        {
+            uint64_t slot = sell->row_start[pos] + j * sell->chunk_size;
+            sell->values[slot] = matrix->values[row_begin + j];
+
+            if (compact)
+            {
+                sell->indices32[slot] = matrix->indices32[row_begin + j];
+            }
+            else
+            {
+                sell->indices[slot] = matrix->indices[row_begin + j];
+            }
+        }
+    }
+}
+
+INDEX_WIDTH_TASKS(fill_chunks)
+
+/*
+Converts an ELLPACK input matrix to SELL-C-sigma. The length of a row ends after its last non-zero value, so the
+'*' padding (and trailing explicit zeros) are dropped. The indices keep the width of the ELLPACK matrix. The chunks
+are laid out and copied by the threads that compute them in version 6. Returns -1 if memory is missing.
+*/
+int ellpack_to_sell(const ELLPACKMatrix *matrix, SELLMatrix *sell, uint64_t chunk_size, uint64_t sigma, int num_threads)
+{
+    memset(sell, 0, sizeof(*sell));
+    sell->num_rows = matrix->num_rows;
+    sell->num_cols = matrix->num_cols;
+    sell->chunk_size = chunk_size;
+    sell->sigma = sigma;
+    sell->num_chunks = (matrix->num_rows + chunk_size - 1) / chunk_size;
+
+    bool compact = matrix->indices32 != NULL;
+    RowKey *keys = (RowKey *)malloc(matrix->num_rows * sizeof(RowKey));
+    ConvertContext ctx = {matrix, sell, keys};
+    sell->chunk_ptr = (uint64_t *)malloc((sell->num_chunks + 1) * sizeof(uint64_t));
+    sell->row_order = (uint64_t *)malloc(matrix->num_rows * sizeof(uint64_t));
+    sell->row_position = (uint64_t *)malloc(matrix->num_rows * sizeof(uint64_t));
+    sell->row_length = (uint64_t *)malloc(matrix->num_rows * sizeof(uint64_t));
+    sell->row_start = (uint64_t *)malloc(matrix->num_rows * sizeof(uint64_t));
+
+    // length of every row, sorted within every window of sigma rows, then the width of every chunk
+    if (!keys || !sell->chunk_ptr || !sell->row_order || !sell->row_position || !sell->row_length || !sell->row_start ||
+        parallel_for(num_threads, matrix->num_rows, measure_rows, &ctx) != 0 ||
+        (sigma > 1 && parallel_for(num_threads, (matrix->num_rows + sigma - 1) / sigma, sort_windows, &ctx) != 0) ||
+        parallel_for(num_threads, sell->num_chunks, layout_chunks, &ctx) != 0)
+    {
+        free(keys);
+        free_sell(sell);
+        return -1;
+    }
+
+    free(keys);
+
+    // the widths become the chunk offsets
+    sell->chunk_ptr[0] = 0;
+
+    for (uint64_t chunk = 0; chunk < sell->num_chunks; ++chunk)
+    {
+        sell->chunk_ptr[chunk + 1] += sell->chunk_ptr[chunk];
+    }
+
+    uint64_t num_slots = sell->chunk_ptr[sell->num_chunks];
+
+    // the padding of the chunks is zeroed, the kernels never read it
+    sell->values = (float *)calloc(num_slots ? num_slots : 1, sizeof(float));
+
+    if (compact)
+    {
+        sell->indices32 = (uint32_t *)calloc(num_slots ? num_slots : 1, sizeof(uint32_t));
+    }
+    else
+    {
+        sell->indices = (uint64_t *)calloc(num_slots ? num_slots : 1, sizeof(uint64_t));
+    }
+
+    if (!sell->values || (!sell->indices && !sell->indices32) ||
+        parallel_for(num_threads, sell->num_chunks, compact ? fill_chunks_32 : fill_chunks_64, &ctx) != 0)
+    {
+        free_sell(sell);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stream.h"
+#include "matrix_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// writes all bytes to a spill file
+static int write_all(int fd, const void *data, size_t size)
+{
+    const char *pos = (const char *)data;
+
+    while (size > 0)
+    {
+        ssize_t written = write(fd, pos, size);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        pos += written;
+        size -= (size_t)written;
+    }
+
+    return 0;
+}
+
+// creates an anonymous spill file next to the output file (it is unlinked at once, so it disappears with the process)
+static int open_spill_file(const char *output_file)
+{
+    size_t length = strlen(output_file);
+    char *path = (char *)malloc(length + sizeof(".spill.XXXXXX"));
+
+    if (!path)
+    {
+        return -1;
+    }
+
+    memcpy(path, output_file, length);
+    memcpy(path + length, ".spill.XXXXXX", sizeof(".spill.XXXXXX"));
+
+    int fd = mkstemp(path);
+    if (fd >= 0)
+    {
+        unlink(path);
+    }
+
+    free(path);
+    return fd;
+}
+
+/*
+Multiplies matrix_a with matrix_b in blocks of rows of matrix_a (version 4 for every block) and writes the result to output_file.
+The values and indices of every block go to two spill files as soon as the block is done, because the padding of the
+ELLPACK output (the longest row) is only known at the end. The files are then stitched into the output.
+A block is as large as the memory budget allows, its size is bounded by the flop count of its rows.
+*/
+int matr_mult_streaming(const ELLPACKMatrix *restrict matrix_a, const ELLPACKMatrix *restrict matrix_b, const char *output_file, uint64_t memory_budget, int num_threads, AccumulatorType accumulator)
+{
+    if (matrix_a->num_cols != matrix_b->num_rows)
+    {
+        fprintf(stderr, "Matrix dimensions do not match for multiplication (matr_mult_streaming)\n");
+        return -1;
+    }
+
+    // memory that does not depend on the block size: row lengths, the accumulators of the threads and the I/O buffers
+    uint64_t accumulator_size = accumulator == ACCUMULATOR_DENSE ? matrix_b->num_cols * (sizeof(float) + sizeof(uint32_t) + sizeof(uint64_t)) : 0;
+    uint64_t fixed_size = (matrix_a->num_rows + matrix_b->num_rows) * sizeof(uint64_t) + (uint64_t)num_threads * accumulator_size + 2 * (8 << 20);
+
+    if (fixed_size >= memory_budget)
+    {
+        fprintf(stderr, "Memory budget too small for streaming: at least %lu MB are needed\n", (unsigned long)(fixed_size >> 20) + 1);
+        return -1;
+    }
+
+    uint64_t block_budget = memory_budget - fixed_size;
+    uint64_t *row_length = (uint64_t *)calloc(matrix_a->num_rows, sizeof(uint64_t));
+    uint64_t *row_length_b = (uint64_t *)calloc(matrix_b->num_rows, sizeof(uint64_t));
+    int values_fd = open_spill_file(output_file);
+    int indices_fd = open_spill_file(output_file);
+    int status = -1;
+
+    if (!row_length || !row_length_b || values_fd < 0 || indices_fd < 0)
+    {
+        fprintf(stderr, "Error creating the spill files (matr_mult_streaming)\n");
+        goto cleanup;
+    }
+
+    // row lengths of matrix_b bound the flops and with them the non-zero entries of a result row
+    for (uint64_t row_b = 0; row_b < matrix_b->num_rows; ++row_b)
+    {
+        for (uint64_t curr_non_zero_b = 0; curr_non_zero_b < matrix_b->num_non_zero; ++curr_non_zero_b)
+        {
+            if (matrix_b->values[row_b * matrix_b->num_non_zero + curr_non_zero_b] != 0.0f)
+            {
+                row_length_b[row_b]++;
+            }
+        }
+    }
+
+    uint64_t max_non_zero = 0;
+    uint64_t first_row = 0;
+
+    while (first_row < matrix_a->num_rows)
+    {
+        // grow the block while its row pointers and its largest possible result fit into the budget
+        uint64_t block_rows = 0;
+        uint64_t block_size = sizeof(uint64_t);
+
+        while (first_row + block_rows < matrix_a->num_rows)
+        {
+            uint64_t row = first_row + block_rows;
+            uint64_t flops = 0;
+
+            for (uint64_t curr_non_zero_a = 0; curr_non_zero_a < matrix_a->num_non_zero; ++curr_non_zero_a)
+            {
+                uint64_t index_a = row * matrix_a->num_non_zero + curr_non_zero_a;
+
+                if (matrix_a->values[index_a] != 0.0f)
+                {
+                    flops += row_length_b[ellpack_index(matrix_a, index_a)];
+                }
+            }
+
+            uint64_t row_size = sizeof(uint64_t) + (flops < matrix_b->num_cols ? flops : matrix_b->num_cols) * (sizeof(float) + sizeof(uint64_t));
+
+            if (block_size + row_size > block_budget)
+            {
+                break;
+            }
+
+            block_size += row_size;
+            block_rows++;
+        }
+
+        if (block_rows == 0)
+        {
+            fprintf(stderr, "Memory budget too small for streaming: row %lu of A does not fit\n", (unsigned long)first_row);
+            goto cleanup;
+        }
+
+        ELLPACKMatrix block = {0};
+        matr_mult_ellpack_V4_rows(matrix_a, matrix_b, &block, first_row, block_rows, num_threads, accumulator);
+
+        uint64_t block_non_zero = block.row_ptr[block_rows];
+
+        for (uint64_t row = 0; row < block_rows; ++row)
+        {
+            row_length[first_row + row] = block.row_ptr[row + 1] - block.row_ptr[row];
+        }
+
+        if (block.num_non_zero > max_non_zero)
+        {
+            max_non_zero = block.num_non_zero;
+        }
+
+        int spill_status = write_all(values_fd, block.values, block_non_zero * sizeof(float)) | write_all(indices_fd, block.indices, block_non_zero * sizeof(uint64_t));
+
+        free(block.values);
+        free(block.indices);
+        free(block.row_ptr);
+
+        if (spill_status != 0)
+        {
+            fprintf(stderr, "Error writing the spill files (matr_mult_streaming): %s\n", strerror(errno));
+            goto cleanup;
+        }
+
+        first_row += block_rows;
+    }
+
+    // stitch the spill files into the output, now that the longest row is known
+    ELLPACKMatrix shape = {0};
+    shape.num_rows = matrix_a->num_rows;
+    shape.num_cols = matrix_b->num_cols;
+    shape.num_non_zero = max_non_zero;
+
+    status = write_matrix_spilled(output_file, &shape, row_length, values_fd, indices_fd);
+
+cleanup:
+    free(row_length);
+    free(row_length_b);
+    if (values_fd >= 0)
+    {
+        close(values_fd);
+    }
+    if (indices_fd >= 0)
+    {
+        close(indices_fd);
+    }
+    return status;
+}